@@ -1,574 +1,4147 @@
-/*-
- * SPDX-License-Identifier: BSD-2-Clause
- *
- * Copyright (c) 2023 Georg Lindenberg
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions
- * are met:
- * 1. Redistributions of source code must retain the above copyright
- *    notice, this list of conditions and the following disclaimer.
- * 2. Redistributions in binary form must reproduce the above copyright
- *    notice, this list of conditions and the following disclaimer in the
- *    documentation and/or other materials provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
- * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
- * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
- * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
- * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
- * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
- * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
- * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
- * SUCH DAMAGE.
- */
-
-/* -------------------------------	*/
-/* FreeBSD acpi generic fan driver	*/
-/* ACPI specification: 6.5			*/
-/* Section: 11.3 					*/
-/* -------------------------------	*/
-
-#include <sys/cdefs.h>
-__FBSDID("$FreeBSD$");
-
-#include "opt_acpi.h"
-#include <sys/param.h>
-// //#include <sys/kobj.h>
-#include <sys/kernel.h>
-#include <sys/bus.h>
-#include <sys/module.h>
-
-
-#include <sys/types.h>
-#include <sys/malloc.h>
-
-#include <sys/sysctl.h>
-
-#include <machine/bus.h>
-#include <sys/rman.h>
-
-#include <contrib/dev/acpica/include/acpi.h>
-
-#include <dev/acpica/acpivar.h>
-#include <dev/acpica/acpiio.h>
-
-/* Hooks for the ACPI CA debugging infrastructure */
-#define	_COMPONENT	ACPI_FAN
-ACPI_MODULE_NAME("FAN")
-
-static MALLOC_DEFINE(M_ACPIFAN, "acpifan",
-    "ACPI fan performance states data");
-
-
-ACPI_SERIAL_DECL(fan, "ACPI fan");
-
-/* ********************************************************************* */
-/* structures required by acpi version 4.0 fan control: _FPS, _FIF, _FST */
-/* ********************************************************************* */
-
-
-struct acpi_fan_fps {
-	int control;
-	int trip_point;
-	int speed;
-	int noise_level;
-	int power;
-};
-
-struct acpi_fan_fif {
-	int rev;	/* revision always zero */
-	int fine_grain_ctrl;	/* fine grain control */
-	int stepsize;	/* step size 1-9 */
-	int low_fanspeed;	/* low fan speed notification, 0x80, either zero or nonzero */
-};
-
-struct acpi_fan_fst {
-	int revision;
-	int control;
-	int speed;
-};
-
-/* *********************** */
-/* driver software context */
-/* *********************** */
-
-struct acpi_fan_softc {
-	device_t	dev;
-	int			acpi4;	/* either ACPI 1.0 or 4.0 */
-	
-	int			fan_powered;
-
-	struct acpi_fan_fif		fif;
-	struct acpi_fan_fps		fps;
-	//ACPI_OBJECT *acpi_fan_fps;
-	int					max_fps;
-	struct acpi_fan_fst		fst;
-};
-
-static devclass_t acpi_fan_devclass;
-
-/* (dynamic) sysctls */
-
-
-/* ---------------- *
- * helper functions *
- * ---------------- */
-static int acpi_fan_get_fif(device_t dev);
-static int acpi_fan_get_fst(device_t dev);
-static int acpi_fan_get_fps(device_t dev);
-static int acpi_fan_level_sysctl(SYSCTL_HANDLER_ARGS);
-static int acpi_fan_powered_sysctl(SYSCTL_HANDLER_ARGS);
-static int acpi_fan_rpm_sysctl(SYSCTL_HANDLER_ARGS);
-static void acpi_fan_set_power(device_t dev, int new_state);
-static int acpi_fan_get_power_state(device_t dev);
-
-
-/*-------------- * 
- *Device methods *
- * ------------- */
-static int acpi_fan_probe(device_t dev);
-static int acpi_fan_attach(device_t dev);
-static int acpi_fan_detach(device_t dev);
-static int acpi_fan_suspend(device_t dev);
-static int acpi_fan_resume(device_t dev);
-
-static device_method_t acpi_fan_methods[] = {
-    
-	/* Device interface */
-    DEVMETHOD(device_probe,		acpi_fan_probe),
-    DEVMETHOD(device_attach,	acpi_fan_attach),
-    DEVMETHOD(device_detach,	acpi_fan_detach),
-	DEVMETHOD(device_suspend,	acpi_fan_suspend),
-	DEVMETHOD(device_resume,	acpi_fan_resume),
-	
-    DEVMETHOD_END
-};
-
-
-/* probe the fan */
-static int
-acpi_fan_probe(device_t dev)
-{
-    static char *fan_ids[] = { \
-	"PNP0C0B", 		/* Generic Fan */ \
-	"INT3404",		/* Fan */ \
-	"INTC1044",		/* Fan for Tiger Lake generation */ \
-	"INTC1048", 	/* Fan for Alder Lake generation */ \
-	"INTC1063", 	/* Fan for Meteor Lake generation */ \
-	"INTC10A2", 	/* Fan for Raptor Lake generation */ \
-	NULL };
-    int rv;
-    
-    if (acpi_disabled("fan"))
-	return (ENXIO);
-    rv = ACPI_ID_PROBE(device_get_parent(dev), dev, fan_ids, NULL);
-    if (rv <= 0)
-	device_set_desc(dev, "ACPI FAN");
-	/* XXX: we can do strncmp and then set a more precise description. */
-	/* For now, this will do. */
-
-    return (rv);
-}
-
-
-static int
-acpi_fan_attach(device_t dev)
-{
-//	int	error;
-	ACPI_HANDLE	handle;
-	ACPI_HANDLE tmp;
-	struct acpi_fan_softc *sc;
-
-	
-    sc = device_get_softc(dev);
-    handle = acpi_get_handle(dev);
-    sc->dev = dev;
-
-	/* acpi subsystem powers on all new devices, right? No need to check. XXX: btw this is not a check. */
-	sc->fan_powered=1;
-
-	/* create sysctls for 3 scenarios: 
-	fan control via percentage (1)
-	fan control via fan levels (2)
-	fan control via acpi version 1.0 (3) */
-
-	/* sysctl context XXX: Delete? */
-	struct sysctl_oid *fan_oid = device_get_sysctl_tree(dev);
-
-
-	/* fans are either acpi 1.0 or 4.0 compatible, so check now. */
-	if (acpi_fan_get_fif(dev) &&
-		acpi_fan_get_fst(dev) &&
-		acpi_fan_get_fps(dev) &&
-		ACPI_SUCCESS(acpi_GetHandleInScope(handle, "_FSL", &tmp))) {
-		
-		sc->acpi4=1;	/* acpi 4.0 compatible */
-		/* XXX: ACPI 4.0 will be implemented later!!!! */
-		}
-		
-		/*
-		// Maybe these syssctls can be handled in a single sysctl-handler using arg2 for a switch statement? 
-		
-		if(sc->fif.fine_grain_ctrl) { // fan control via percentage
-			SYSCTL_ADD_PROC(NULL, SYSCTL_CHILDREN(fan_oid), OID_AUTO,
-			"fan_speed", CTLTYPE_INT | CTLFLAG_RW, sc, 0,
-			acpi_fan_level_sysctl, "I" ,"Fan speed in %");
-
-			SYSCTL_ADD_INT(NULL, SYSCTL_CHILDREN(fan_oid), OID_AUTO, 
-			"Step_size", CTLFLAG_RD, sc, 0, "Step size");
-		}
-		else {	// fan control via levels
-			SYSCTL_ADD_PROC(NULL, SYSCTL_CHILDREN(fan_oid), OID_AUTO,
-			"current_fan_level", CTLTYPE_INT | CTLFLAG_RW, sc, 0,
-			acpi_fan_level_sysctl, "I", "Fan level");
-		
-			// XXX: available fan levels, string? array?
-			SYSCTL_ADD_INT(NULL, SYSCTL_CHILDREN(fan_oid), OID_AUTO,
-			"max_fan_levels", CTLFLAG_RD, sc, 0,"max fan levels");
-		}
-	
-	
-		if(acpi_fan_get_fst(dev))
-			SYSCTL_ADD_PROC(NULL, SYSCTL_CHILDREN(fan_oid), OID_AUTO,
-			"rpm", CTLTYPE_INT | CTLFLAG_RD, sc, 0,
-			acpi_fan_rpm_sysctl, "I" ,"current revolutions per minute"); // XXX: what is acpi_fan_rpm_sysctl? Why is this not an int readable?
-	}	
-	*/
-
-	else {	/* acpi 1.0 */
-		sc->acpi4 = 0;
-		
-		SYSCTL_ADD_PROC(NULL, SYSCTL_CHILDREN(fan_oid), OID_AUTO,
-		"powered", CTLTYPE_INT | CTLFLAG_RW, sc, sc->fan_powered,
-		acpi_fan_powered_sysctl, "I" ,"Fan OFF=0 ON=1 UNKNOWN=2");
-	}	
-	
-	// XXX: Add a debug sysctl for testing!
-	
-	return 0;
-}
-
-static int
-acpi_fan_detach(device_t dev) {
-	
-//	struct acpi_fan_softc *sc;
-//    sc = device_get_softc(dev);
-
-//	if(sc->acpi4)
-//		AcpiOsFree(sc->fps);		/* remove the sysctls, dont change fan settings and leave. */
-	return 0;
-}
-
-static int
-acpi_fan_suspend(device_t dev) {
-	//acpi_fan_set_power(dev, 0);				/* fan should be off in suspend mode, right? */
-	return 0;
-}
-
-static int
-acpi_fan_resume(device_t dev) {
-	//acpi_fan_set_power(dev, 1);				/* turn fan on on resume. XXX: Do we need to check anything? */
-	return 0;
-}
-
-
-/* Userland requestet fan level sysctl */
-static int
-acpi_fan_level_sysctl(SYSCTL_HANDLER_ARGS)
-{
-	struct sysctl_oid *parent;
-    struct acpi_fan_softc *sc;
-    device_t dev;
-    ACPI_HANDLE h;
-	ACPI_STATUS status;
-	long fan_index;
-	int requested_speed;
-
-    parent = SYSCTL_PARENT(oidp); 
-    fan_index = strtol(parent->oid_name, NULL, 0);
-    dev = devclass_get_device(acpi_fan_devclass, (int) fan_index);
-
-    h = acpi_get_handle(dev);		
-    sc = device_get_softc(dev);
-
-//	ACPI_SERIAL_BEGIN(fan);
-	
-    if(req->newptr) {	/* Write request */
-		
-		if(!sc->fan_powered)
-			acpi_fan_set_power(dev, 1);	/* XXX: will this work? Do we need to sleep a bit? */
-
-		SYSCTL_IN(req, &requested_speed, sizeof(requested_speed));
-			
-		if(sc->fif.fine_grain_ctrl) { /* fan is set via percentage: 0-100 % */
-			
-			/* check input */
-			if((requested_speed <= 100) && (requested_speed >= 0)) {
-				
-				status = acpi_SetInteger(h, "_FSL", requested_speed);
-				if (ACPI_FAILURE(status))
-					ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
-					"setting fan level: failed --%s\n", AcpiFormatException(status));
-			}
-
-			/* else: invalid input */
-		}
-		
-		else {	/* fan is set via levels */ 
-		
-			if((requested_speed <= 100) && (requested_speed >= 0)) {	/* XXX: what is max fan level according to the spec? */
-			
-				status = acpi_SetInteger(h, "_FSL", requested_speed);
-				if (ACPI_FAILURE(status))
-					ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
-					"setting fan level: failed --%s\n", AcpiFormatException(status));
-			}
-			
-			/* else: invalid input */
-		}
-	}
-
-    else /* read request */ {		
-		acpi_fan_get_fst(dev); /* XXX: does it matter, whether it is fan level control or percentage level? */
-		SYSCTL_OUT(req, &sc->fst.control, sizeof(sc->fst.control));
-	}
-	
-//	ACPI_SERIAL_END(fan);
-	
-    return 0;
-}
-
-/* This sysctl controls if the fan is on or off. */
-static int
-acpi_fan_powered_sysctl(SYSCTL_HANDLER_ARGS) {
-	
-	struct acpi_fan_softc *sc;
-	int error;
-	
-	sc = (struct acpi_fan_softc *) oidp->oid_arg1;
-
-	if(!req->newptr) { /* Read request. */
-		SYSCTL_OUT(req, &sc->fan_powered, sizeof(sc->fan_powered));
-	}
-	
-	else { /* Write request. */
-		error = SYSCTL_IN(req, &sc->fan_powered, sizeof(sc->fan_powered));
-		if (error)
-			return (error);
-
-		/* Correct bogus writes to either 0 or 1. */
-		if (sc->fan_powered !=0)
-			sc->fan_powered = 1;
-		
-		/* Attempt to set the power state. */
-		if (acpi_DeviceIsPresent(sc->dev)) {
-			error = acpi_fan_get_power_state(sc->dev);
-			if (error == 2) {
-				/*XXX: My 1.0 compatible mainboard ends up here... */
-				return (0);
-			}
-			if (error != sc->fan_powered)
-				acpi_fan_set_power(sc->dev, sc->fan_powered);
-		}
-	}
-	return (0);
-}
-
-
-/* This sysctl returns revolutions per minute */
-static int acpi_fan_rpm_sysctl(SYSCTL_HANDLER_ARGS) {
-	
-	struct sysctl_oid *parent;
-    struct acpi_fan_softc *sc;
-    device_t dev;
-//    ACPI_HANDLE h;
-	long fan_index;
-
-    parent = SYSCTL_PARENT(oidp); 
-    fan_index = strtol(parent->oid_name, NULL, 0);
-    dev = devclass_get_device(acpi_fan_devclass, (int) fan_index);
-
-//    h = acpi_get_handle(dev);
-    sc = device_get_softc(dev);	
-	
-
-    if(!req->newptr) {	/* read request */
-		if(acpi_fan_get_fst(dev))
-			SYSCTL_OUT(req, &sc->fst.speed, sizeof(sc->fst.speed));
-		/* else error */
-	}
-    return 0;
-}
-
-
-static int acpi_fan_get_power_state(device_t dev) {
-
-	ACPI_STATUS status;
-	ACPI_HANDLE h;
-	UINT32 state;
-	
-
-	h = acpi_get_handle(dev);
-
-	/*
-	* If no _STA method or if it failed, then assume that
-	* it is ... Unknown (state=2)? Running (state=1)? 
-	*/
-//	ACPI_SERIAL_BEGIN(fan);
-	
-	status = acpi_GetInteger(h, "_STA",  &state);
-	if(ACPI_FAILURE(status)) {
-		ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev), 
-		"Getting power status: failed --%s\n", AcpiFormatException(status));
-		state = 2;
-	}
-	
-//	ACPI_SERIAL_END(fan);
-	
-	return state;
-}
-
-
-/* This function turns the fan on and off. */
-static void
-acpi_fan_set_power(device_t dev, int new_state) {
-
-	ACPI_HANDLE h;
-	ACPI_STATUS status;
-
-	h = acpi_get_handle(dev);
-
-		if(new_state == 1) {
-			// set fan to  D3 (On)
-			//XXX: which one?
-			//status = acpi_set_powerstate(dev, ACPI_STATE_D3); 
-			//	status = acpi_pwr_switch_consumer(acpi_get_handle(dev), ACPI_STATE_D3);
-			//status = AcpiEvaluateObject(h, "_PS3", NULL, NULL);
-			status = AcpiEvaluateObject(h, "_ON", NULL, NULL);
-			
-						
-			//status = AcpiEvaluateObject(h, "_PS3", NULL, NULL);
-			if(ACPI_FAILURE(status)) 
-				ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev), 
-				"turning fan on: failed --%s\n", AcpiFormatException(status));
-		}
-	
-		else if (new_state == 0) {
-		//set fan to  D0 (Off)
-			status = AcpiEvaluateObject(h, "_OFF", NULL, NULL);
-			
-			if(ACPI_FAILURE(status))
-				ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
-				"turning fan off: failed --%s\n", AcpiFormatException(status));
-		}
-		return;
-}
-
-static int acpi_fan_get_fif(device_t dev) {
-	/*
-    struct acpi_fan_softc *sc;
-    ACPI_STATUS	as;
-	ACPI_HANDLE	h;
-	ACPI_HANDLE tmp;
-	ACPI_BUFFER	fif_buffer;
-	
-	sc = device_get_softc(dev);
-    h = acpi_get_handle(dev);
-	
-	
-	if(ACPI_FAILURE(acpi_GetHandleInScope(h, "_FIF", &tmp)))
-		return 0;
-	
-	
-	as = AcpiEvaluateObject(h, "_FIF", NULL, &fif_buffer);
-    if (ACPI_FAILURE(as)) {
-	ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
-	    "error fetching: _FIF -- %s\n",
-	    AcpiFormatException(as));
-		return 0;
-	}	
-	memcpy(fif_buffer, &sc->fif, sizeof(fif_buffer)); */
-	return 1;
-}
-
-
-static int acpi_fan_get_fst(device_t dev) {
-	/*	
-    struct acpi_fan_softc *sc;
-    ACPI_STATUS	as;
-	ACPI_HANDLE	h;
-	ACPI_HANDLE tmp;
-	ACPI_BUFFER	fst_buffer;
-	
-	sc = device_get_softc(dev);
-    h = acpi_get_handle(dev);
-	
-	
-	if(ACPI_FAILURE(acpi_GetHandleInScope(h, "_FST", &tmp)))
-		return 0;
-	
-	as = AcpiEvaluateObject(h, "_FST", NULL, &fst_buffer);
-    if (ACPI_FAILURE(as)) {
-		ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
-	    "error fetching: _FST -- %s\n",
-	    AcpiFormatException(as));
-		return 0;
-	}
-	memcpy(fst_buffer, &sc->fst, sizeof(*fst_buffer));
-	// ACPIOsFree(fst_buffer); ??
-	*/
-	return 1;
-}
-
-static int acpi_fan_get_fps(device_t dev) {
-
-/*
-    struct acpi_cmbat_softc *sc;
-	ACPI_HANDLE	handle;
-	ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	ACPI_OBJECT *obj;
-	ACPI_STATUS status;
-
-	int i;
-	
-	sc = device_get_softc(dev);
-	handle = acpi_get_handle(dev);
-	
-	if(ACPI_FAILURE(acpi_GetHandleInScope(handle, "_FST", &tmp)))
-	return 0;
-	
-	status = acpi_evaluate_object(handle, "_FST", NULL, &buffer);
-	if (ACPI_FAILURE(status))
-		return 0;
-
-	obj = buffer.pointer;
-	if (!obj || obj->type != ACPI_TYPE_PACKAGE || obj->package.count < 2) {
-		ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
-	    "error: invalid fps -- %s\n",
-	    AcpiFormatException(as));
-		//AcpiOsFree ??
-		return 0;
-	}
-
-	sc->max_fps = obj->package.count - 1; */	/* minus revision field */
-	
-//	sc->acpi_fps = malloc(sizeof(obj), M_ACPIFAN, M_WAITOK); ???
-//	sc->acpi_fan_fps = obj;
-
-	return 1;
-}
-
-/* ------------------- */
-/* Register the driver */
-/* ------------------- */
-static driver_t acpi_fan_driver = {
-    "fan",
-    acpi_fan_methods,
-    sizeof(struct acpi_fan_softc),
-};
-
-DRIVER_MODULE(acpi_fan, acpi, acpi_fan_driver, 0, 0);
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Georg Lindenberg
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* -------------------------------	*/
+/* FreeBSD acpi generic fan driver	*/
+/* ACPI specification: 6.5			*/
+/* Section: 11.3 					*/
+/* -------------------------------	*/
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include "opt_acpi.h"
+#include <sys/param.h>
+// //#include <sys/kobj.h>
+#include <sys/kernel.h>
+#include <sys/bus.h>
+#include <sys/module.h>
+
+
+#include <sys/types.h>
+#include <sys/cpuset.h>
+#include <sys/fail.h>
+#include <sys/malloc.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/queue.h>
+#include <sys/resource.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/taskqueue.h>
+#include <sys/time.h>
+
+#include <sys/sysctl.h>
+
+#include <machine/atomic.h>
+#include <machine/bus.h>
+#include <machine/stdarg.h>
+#include <sys/rman.h>
+
+#include <contrib/dev/acpica/include/acpi.h>
+
+#include <dev/acpica/acpivar.h>
+#include <dev/acpica/acpiio.h>
+#include <dev/acpica/acpi_fanio.h>
+
+/* Hooks for the ACPI CA debugging infrastructure */
+#define	_COMPONENT	ACPI_FAN
+ACPI_MODULE_NAME("FAN")
+
+static MALLOC_DEFINE(M_ACPIFAN, "acpifan",
+    "ACPI fan performance states data");
+
+
+ACPI_SERIAL_DECL(fan, "ACPI fan");
+
+#define	ACPI_FAN_FANTZ	ACPI_FAN_SAMPLE_NTZ	/* thermal zones per fan */
+#define	ACPI_FAN_POWER_UNKNOWN	2	/* _STA missing or failed */
+#define	ACPI_FAN_FC_MAX	32	/* forecast window limit */
+#define	ACPI_FAN_RBANDS	4	/* speed bands of the resistance estimate */
+#define	ACPI_FAN_STA_SWEEPS	16	/* sweeps between _STA checks */
+
+/*
+ * Model-predictive control.  The thermal model of a fan's zones,
+ *	T[k+1] = a T[k] + b u[k] + c L[k] + d,
+ * with u the fan level and L the load average, is identified online by
+ * recursive least squares.  There is no FPU in the kernel, so all
+ * quantities are Q16 fixed point and the inputs are normalized to about
+ * [0, 1]: T / 128 C, u / 128, L / 16.
+ */
+#define	ACPI_FAN_MPC_N		4		/* a, b, c, d */
+#define	ACPI_FAN_Q		16
+#define	ACPI_FAN_QONE		((int64_t)1 << ACPI_FAN_Q)
+#define	ACPI_FAN_MPC_LAMBDA	(ACPI_FAN_QONE * 99 / 100)	/* forgetting */
+#define	ACPI_FAN_MPC_P0		(ACPI_FAN_QONE * 100)	/* initial P */
+#define	ACPI_FAN_MPC_PMAX	(ACPI_FAN_QONE * 1000)	/* windup limit */
+#define	ACPI_FAN_MPC_MINUPD	20	/* updates before the model is used */
+
+struct acpi_fan_mpc {
+	int64_t		theta[ACPI_FAN_MPC_N];
+	int64_t		p[ACPI_FAN_MPC_N][ACPI_FAN_MPC_N];
+	int64_t		phi[ACPI_FAN_MPC_N];	/* regressor of last sample */
+	int		have_phi;
+	u_int		updates;
+};
+
+/* devctl event coalescing, one per fan and ACPI_FAN_EV_* type */
+struct acpi_fan_evstate {
+	sbintime_t	start;		/* start of the current window */
+	u_int		suppressed;	/* events coalesced into data */
+	char		data[96];	/* latest coalesced event */
+};
+
+/* ********************************************************************* */
+/* structures required by acpi version 4.0 fan control: _FPS, _FIF, _FST */
+/* ********************************************************************* */
+
+
+struct acpi_fan_fps {
+	int control;
+	int trip_point;
+	int speed;
+	int noise_level;
+	int power;
+};
+
+struct acpi_fan_fif {
+	int rev;	/* revision always zero */
+	int fine_grain_ctrl;	/* fine grain control */
+	int stepsize;	/* step size 1-9 */
+	int low_fanspeed;	/* low fan speed notification, 0x80, either zero or nonzero */
+};
+
+struct acpi_fan_fst {
+	int revision;
+	int control;
+	int speed;
+};
+
+/* *********************** */
+/* driver software context */
+/* *********************** */
+
+struct acpi_fan_softc {
+	device_t	dev;
+	int			acpi4;	/* either ACPI 1.0 or 4.0 */
+	
+	int			fan_powered;
+
+	struct acpi_fan_fif		fif;
+	struct acpi_fan_fps		*fps;	/* _FPS table, max_fps entries */
+	int					max_fps;
+	struct acpi_fan_fst		fst;
+	int			level;	/* last level written to _FSL, -1 none */
+
+	uint64_t		gen;	/* generation of last published change */
+	TAILQ_ENTRY(acpi_fan_softc)	link;
+
+	/*
+	 * sample history, a ring of hist_size; hist_head is the next slot.
+	 * hist and log_ring are only allocated once read, see
+	 * acpi_fan_buf_reap.
+	 */
+	struct acpi_fan_sample	*hist;
+	u_int			hist_size;
+	u_int			hist_head;
+	u_int			hist_len;
+	sbintime_t		hist_used;	/* last read */
+
+	/* binary log encoder, see acpi_fanio.h */
+	struct acpi_fan_log_blk	*log_cur;	/* block being filled */
+	struct acpi_fan_sample	log_prev;	/* last sample in log_cur */
+	struct acpi_fan_log_blk	*log_ring;	/* completed blocks */
+	u_int			log_nblk;	/* log_cur is one past these */
+	uint64_t		log_seq;	/* seq of last completed block */
+	uint64_t		log_base;	/* blocks up to here are gone */
+	sbintime_t		log_used;	/* last read */
+
+	/*
+	 * flight recorder, a ring like hist but sampled at a high rate;
+	 * like hist only allocated once read, and only fans with a ring
+	 * are sampled by the recorder sweep
+	 */
+	struct acpi_fan_sample	*rec;
+	sbintime_t		rec_used;	/* last read */
+	u_int			rec_size;
+	u_int			rec_head;
+	u_int			rec_len;
+	int			rec_reason;	/* ACPI_FAN_REC_*, NONE if armed */
+	u_int			rec_post;	/* samples left until frozen */
+	uint64_t		rec_time;	/* time of the trigger */
+	u_int			rec_pending;	/* trigger from notify context */
+
+	int			stall_count;	/* consecutive stalled samples */
+	u_int			notify_count;	/* device notifications seen */
+
+	/* thermal zones cooled by this fan and their hottest temperature */
+	ACPI_HANDLE		tz[ACPI_FAN_FANTZ];
+	int			tz_temp[ACPI_FAN_FANTZ];	/* last _TMP */
+	sbintime_t		tz_time[ACPI_FAN_FANTZ];	/* when read */
+	int			tz_ac[ACPI_FAN_FANTZ];	/* _ALx listing us, -1 */
+	int			tz_trip[ACPI_FAN_FANTZ];	/* its _ACx, -1 */
+	int			tz_crt[ACPI_FAN_FANTZ];	/* _CRT, -1 unknown */
+	int			ntz;
+	int			temp;		/* tenths of Kelvin, -1 unknown */
+	sbintime_t		temp_time;	/* oldest zone reading */
+	int			temp_reused;	/* a zone was not read now */
+	int			hot;		/* a zone past its trip or _CRT */
+
+	int			ctl_mode;	/* ACPI_FAN_CTL_* */
+	struct acpi_fan_mpc	mpc;
+	int			mpc_limit;	/* tenths of Kelvin */
+
+	/* recent temperatures for the forecast, a ring like hist */
+	int			fc_temp[ACPI_FAN_FC_MAX];
+	uint64_t		fc_time[ACPI_FAN_FC_MAX];	/* ms of uptime */
+	u_int			fc_head;
+	u_int			fc_len;
+	int			forecast;	/* tenths of Kelvin, -1 unknown */
+	int			headroom;	/* percent of speed left */
+	int			fc_above;	/* forecast above threshold */
+
+	/* control policy program, see acpi_fanio.h */
+	struct acpi_fan_insn	*pol;
+	int			pol_len;
+	u_int			pol_faults;	/* runs aborted at run time */
+
+	int			detached;	/* buffers freed, fail late sysctls */
+
+	/* health, see acpi_fan_health */
+	int			health;		/* ACPI_FAN_HEALTH_* */
+	int			health_score;
+	u_int			health_reasons;	/* ACPI_FAN_HR_* */
+	uint32_t		fst_fails;	/* one bit per sample, newest 0 */
+	u_int			notify_seen;	/* notify_count at last sweep */
+	int			notify_hold;	/* sweeps to keep HR_NOTIFY */
+	int			prev_control;
+	int			sta_wait;	/* sweeps to the next _STA */
+	int			absent;		/* _STA said not present */
+	int			eff;		/* EWMA of speed/expected, Q16 */
+	int			eff_n;		/* samples in eff, capped */
+	int			eff_base;	/* eff once settled, 0 unset */
+
+	/* airflow obstruction, see acpi_fan_resist */
+	int			r_cur[ACPI_FAN_RBANDS];	/* EWMA, Q8 */
+	int			r_base[ACPI_FAN_RBANDS];	/* 0 unset */
+	u_int			r_n[ACPI_FAN_RBANDS];
+	int			r_over;		/* sweeps above threshold */
+	int			obstructed;
+
+	/* firmware overrides, see acpi_fan_owner */
+	uint16_t		own_miss;	/* one bit per sample, newest 0 */
+	int			owner;		/* ACPI_FAN_OWNER_* */
+	int			own_backoff;	/* log2 of sweeps between writes */
+	int			own_skip;	/* sweeps until the next write */
+	u_int			own_skipped;	/* writes not issued */
+
+	/* power cap, see acpi_fan_cap */
+	int			max_power;	/* mW at level 100, model only */
+	int			capped;		/* level held below demand */
+	int			cap_demand;	/* level asked for, -1 none */
+	int			cap_grant;	/* level allowed this sweep */
+	int			cap_rank;	/* position in this sweep */
+
+	/* sweep order, see acpi_fan_order */
+	int			priority;	/* 0 highest */
+	int			prio_age;	/* sweeps with reads deferred */
+
+	struct acpi_fan_evstate	ev[ACPI_FAN_EV_MAX];
+	int			ev_speed;	/* speed of last SPEED event, -1 none */
+
+	/* this fan's sample of sweep ep_num */
+	struct acpi_fan_sample	ep_sample;
+	uint64_t		ep_num;
+};
+
+/* all attached fans, protected by ACPI_SERIAL(fan) */
+static TAILQ_HEAD(, acpi_fan_softc) acpi_fan_list =
+    TAILQ_HEAD_INITIALIZER(acpi_fan_list);
+static int acpi_fan_count;
+
+/* global generation, bumped whenever a fan's published state changes */
+static uint64_t acpi_fan_gen;
+
+/* last complete sampler sweep, see acpi_fanio.h */
+static uint64_t acpi_fan_epoch;
+static uint64_t acpi_fan_epoch_time;
+
+/* sampler, one sweep over all fans per interval */
+static struct callout	acpi_fan_sample_callout;
+static struct task	acpi_fan_sample_task;
+static int		acpi_fan_sampling;	/* sampler armed */
+
+/*
+ * Sweeps run on a private taskqueue whose thread, like the callouts,
+ * is bound to hw.acpi.fan.cpu, a housekeeping CPU, so fan management
+ * stays off cores kept quiet for other work.  -1 leaves them unbound.
+ */
+static struct taskqueue	*acpi_fan_tq;
+static int acpi_fan_cpu = 0;
+TUNABLE_INT("hw.acpi.fan.cpu", &acpi_fan_cpu);
+
+static int acpi_fan_sample_ms = 1000;
+TUNABLE_INT("hw.acpi.fan.sample_interval", &acpi_fan_sample_ms);
+static int acpi_fan_history_size = 256;
+TUNABLE_INT("hw.acpi.fan.history_size", &acpi_fan_history_size);
+static int acpi_fan_log_blocks = 4;
+TUNABLE_INT("hw.acpi.fan.log_blocks", &acpi_fan_log_blocks);
+static int acpi_fan_buf_idle = 600;
+TUNABLE_INT("hw.acpi.fan.buffer_idle", &acpi_fan_buf_idle);
+
+/* flight recorder, sampled by its own callout */
+static struct callout	acpi_fan_rec_callout;
+static struct task	acpi_fan_rec_task;
+
+static int acpi_fan_rec_ms = 100;
+TUNABLE_INT("hw.acpi.fan.recorder_interval", &acpi_fan_rec_ms);
+static int acpi_fan_rec_size = 600;
+TUNABLE_INT("hw.acpi.fan.recorder_size", &acpi_fan_rec_size);
+static int acpi_fan_rec_post = 20;
+TUNABLE_INT("hw.acpi.fan.recorder_post", &acpi_fan_rec_post);
+/*
+ * Fans are swept in order of priority, so on a busy EC a CPU fan is
+ * read and driven before auxiliary fans consume the AML budget.  A fan
+ * whose reads were deferred gains one level per sweep until serviced.
+ */
+#define	ACPI_FAN_PRIO_MAX	7
+static int acpi_fan_priority = 4;
+TUNABLE_INT("hw.acpi.fan.priority", &acpi_fan_priority);
+
+/*
+ * Obstruction detection.  A clogged filter means a higher temperature
+ * rise per unit of load at the same fan speed.
+ */
+static int acpi_fan_ambient = 2982;	/* 25 C */
+TUNABLE_INT("hw.acpi.fan.ambient", &acpi_fan_ambient);
+static int acpi_fan_obstruct_pct = 20;
+TUNABLE_INT("hw.acpi.fan.obstruct_threshold", &acpi_fan_obstruct_pct);
+static int acpi_fan_obstruct_sweeps = 600;
+TUNABLE_INT("hw.acpi.fan.obstruct_sweeps", &acpi_fan_obstruct_sweeps);
+
+/* platform name for telemetry, smbios.system.product */
+static char		acpi_fan_model[32];
+
+/* coordinator demand offset, see acpi_fanio.h */
+static int		acpi_fan_off;
+static sbintime_t	acpi_fan_off_until;
+static int acpi_fan_off_min = -20;
+TUNABLE_INT("hw.acpi.fan.offset_min", &acpi_fan_off_min);
+
+/*
+ * _TMP cache shared by all fans.  Fans cooling the same zone reuse one
+ * evaluation for tmp_cache_ms, whichever sweep asks first.  A reading
+ * more than ACPI_FAN_SKEW_MS older than its sample is not paired with
+ * that sample's _FST by the estimators.
+ */
+#define	ACPI_FAN_TMPC	16
+#define	ACPI_FAN_SKEW_MS	100
+struct acpi_fan_tmpc {
+	ACPI_HANDLE	h;
+	int		temp;		/* tenths of Kelvin, -1 failed */
+	sbintime_t	time;		/* of the evaluation */
+};
+static struct acpi_fan_tmpc	acpi_fan_tmpc[ACPI_FAN_TMPC];
+static uint64_t			acpi_fan_tmpc_hits, acpi_fan_tmpc_misses;
+static int acpi_fan_tmpc_ms = 500;
+TUNABLE_INT("hw.acpi.fan.tmp_cache_ms", &acpi_fan_tmpc_ms);
+
+static int acpi_fan_contest = ACPI_FAN_CONTEST_BACKOFF;
+TUNABLE_INT("hw.acpi.fan.contested_policy", &acpi_fan_contest);
+#define	ACPI_FAN_BACKOFF_MAX	6	/* at most every 64 sweeps */
+
+/*
+ * Power cap on all fans together, in mW; 0 disables it.  A fan's power
+ * at a level comes from the power column of _FPS, or else from the
+ * cube law P = max_power * (level / 100)^3 with hint.fan.N.max_power;
+ * fans with neither are not counted.  The cap never takes a fan below
+ * power_cap_min, nor below its demand while a zone it cools is past
+ * its trip point.
+ */
+static int acpi_fan_power_cap;
+TUNABLE_INT("hw.acpi.fan.power_cap", &acpi_fan_power_cap);
+static int acpi_fan_cap_min = 20;
+TUNABLE_INT("hw.acpi.fan.power_cap_min", &acpi_fan_cap_min);
+static int acpi_fan_power_total;	/* estimate after the last sweep */
+
+static int acpi_fan_stall_samples = 3;
+TUNABLE_INT("hw.acpi.fan.stall_samples", &acpi_fan_stall_samples);
+static int acpi_fan_crit_margin = 50;
+TUNABLE_INT("hw.acpi.fan.crit_margin", &acpi_fan_crit_margin);
+
+/* thermal zones watched for critical temperature, see acpi_fan_tz_notify */
+#define	ACPI_FAN_MAXTZ	8
+static ACPI_HANDLE	acpi_fan_tz[ACPI_FAN_MAXTZ];
+static int		acpi_fan_ntz;
+static u_int		acpi_fan_tz_pending;
+static u_int		acpi_fan_tz_retrip;	/* trip points changed */
+
+/* event trace, see acpi_fanio.h */
+static struct mtx		acpi_fan_trace_mtx;
+MTX_SYSINIT(acpi_fan_trace, &acpi_fan_trace_mtx, "ACPI fan trace", MTX_DEF);
+static struct acpi_fan_trace	*acpi_fan_trace_buf;
+static uint64_t			acpi_fan_trace_next;	/* records written */
+static int			acpi_fan_trace_on;
+
+static int acpi_fan_trace_size = 4096;
+TUNABLE_INT("hw.acpi.fan.trace_size", &acpi_fan_trace_size);
+
+/* AML cost, see acpi_fanio.h */
+static struct mtx		acpi_fan_aml_mtx;
+MTX_SYSINIT(acpi_fan_aml, &acpi_fan_aml_mtx, "ACPI fan AML stats", MTX_DEF);
+static struct acpi_fan_aml_hdr	acpi_fan_aml_hdr;
+static struct acpi_fan_aml_stat	acpi_fan_aml_stat[ACPI_FAN_M_MAX];
+
+/*
+ * AML budget.  The ACPICA interpreter and the EC are shared with the
+ * battery, thermal and button drivers, so evaluations the driver issues
+ * on its own are admitted by a token bucket of aml_rate per second.
+ * Raising cooling is always admitted; lowering it waits for a token;
+ * monitoring reads, including those from sysctl, also leave a quarter
+ * of the bucket to control and otherwise fall back to cached values.
+ * The flight recorder reads far more often than the sampler, so it
+ * draws from a bucket of its own at aml_recorder_rate and can never
+ * starve the sampler.  Writes from userland and attach are not limited.
+ * Protected by acpi_fan_aml_mtx.
+ */
+#define	ACPI_FAN_AML_CRIT	0	/* power on, raise level */
+#define	ACPI_FAN_AML_CTL	1	/* lower level */
+#define	ACPI_FAN_AML_MON	2	/* _FST, _TMP, _STA reads */
+#define	ACPI_FAN_AML_REC	3	/* flight recorder reads */
+#define	ACPI_FAN_AML_NCLASS	4
+#define	ACPI_FAN_TOKEN		1000000	/* fixed-point scale of a token */
+
+struct acpi_fan_bucket {
+	int64_t		tokens;
+	sbintime_t	time;		/* last refill, 0 never */
+};
+
+static int acpi_fan_aml_rate = 50;
+TUNABLE_INT("hw.acpi.fan.aml_rate", &acpi_fan_aml_rate);
+static int acpi_fan_aml_burst = 20;
+TUNABLE_INT("hw.acpi.fan.aml_burst", &acpi_fan_aml_burst);
+static int acpi_fan_aml_rec_rate = 50;
+TUNABLE_INT("hw.acpi.fan.aml_recorder_rate", &acpi_fan_aml_rec_rate);
+static struct acpi_fan_bucket	acpi_fan_bucket;	/* everything else */
+static struct acpi_fan_bucket	acpi_fan_rec_bucket;	/* ACPI_FAN_AML_REC */
+static uint64_t		acpi_fan_aml_deferred[ACPI_FAN_AML_NCLASS];
+
+/*
+ * Cooling profiles.  A loaded profile is compiled into per-fan lookup
+ * tables from temperature to level; selecting one is a single pointer
+ * store that the control path picks up on its next sweep.
+ */
+#define	ACPI_FAN_LUT_SIZE	128	/* degrees Celsius, 0-127 */
+
+static int acpi_fan_mpc_horizon = 10;
+TUNABLE_INT("hw.acpi.fan.mpc_horizon", &acpi_fan_mpc_horizon);
+static int acpi_fan_mpc_limit = 3432;	/* 70 C */
+TUNABLE_INT("hw.acpi.fan.mpc_limit", &acpi_fan_mpc_limit);
+
+static int acpi_fan_fc_window = 16;
+TUNABLE_INT("hw.acpi.fan.forecast_window", &acpi_fan_fc_window);
+static int acpi_fan_fc_horizon = 60;
+TUNABLE_INT("hw.acpi.fan.forecast_horizon", &acpi_fan_fc_horizon);
+static int acpi_fan_fc_threshold;
+TUNABLE_INT("hw.acpi.fan.forecast_threshold", &acpi_fan_fc_threshold);
+
+/* devctl event limits, see acpi_fanio.h; protected by ACPI_SERIAL(fan) */
+static int acpi_fan_ev_window = 1000;
+TUNABLE_INT("hw.acpi.fan.event_window", &acpi_fan_ev_window);
+static int acpi_fan_ev_max = 64;
+TUNABLE_INT("hw.acpi.fan.event_max", &acpi_fan_ev_max);
+static sbintime_t	acpi_fan_ev_start;	/* global window */
+static int		acpi_fan_ev_sent;	/* events sent in it */
+static uint64_t		acpi_fan_ev_dropped;	/* held back by event_max */
+
+struct acpi_fan_prof_lut {
+	int		min_level;
+	int		max_level;
+	int		ramp;
+	uint8_t		level[ACPI_FAN_LUT_SIZE];
+};
+
+struct acpi_fan_profile {
+	char			name[ACPI_FAN_PROF_NAMELEN];
+	uint16_t		slot[ACPI_FAN_CONF_MAXFANS];	/* unit -> lut + 1 */
+	int			nlut;
+	struct acpi_fan_prof_lut	lut[];
+};
+
+static struct acpi_fan_profile	*acpi_fan_profiles[ACPI_FAN_PROF_MAX];
+static struct acpi_fan_profile	*acpi_fan_profile_active;
+
+#define	ACPI_FAN_NOTIFY_LOWSPEED	0x80	/* _FIF low fan speed */
+#define	ACPI_FAN_TZ_NOTIFY_TEMP		0x80	/* thermal zone temperature */
+#define	ACPI_FAN_TZ_NOTIFY_TRIPS	0x81	/* trip points changed */
+
+CTASSERT(sizeof(struct acpi_fan_log_blk) % sizeof(uint64_t) == 0);
+
+/* (dynamic) sysctls */
+static struct sysctl_ctx_list	acpi_fan_sysctl_ctx;
+static struct sysctl_oid	*acpi_fan_sysctl_tree;
+
+
+/* ---------------- *
+ * helper functions *
+ * ---------------- */
+static int acpi_fan_get_fif(device_t dev);
+static int acpi_fan_get_fst(device_t dev);
+static int acpi_fan_get_fps(device_t dev);
+static int acpi_fan_level_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_powered_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_rpm_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_set_power(device_t dev, int new_state);
+static int acpi_fan_get_power_state(device_t dev);
+static void acpi_fan_bump_gen(struct acpi_fan_softc *sc);
+static int acpi_fan_snapshot_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_epoch_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_summary_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_offset_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_offset(struct acpi_fan_softc *sc, int level);
+static void acpi_fan_sample_tick(void *arg);
+static void acpi_fan_sample_sweep(void *context, int pending);
+static void acpi_fan_sample(struct acpi_fan_softc *sc,
+    struct acpi_fan_sample *s, int class);
+static void acpi_fan_record(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static void acpi_fan_log_append(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static void acpi_fan_log_close(struct acpi_fan_softc *sc);
+static int acpi_fan_interval_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_history_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_log_sysctl(SYSCTL_HANDLER_ARGS);
+static void acpi_fan_arm(void);
+static void acpi_fan_buf_reap(struct acpi_fan_softc *sc);
+static int acpi_fan_order(struct acpi_fan_softc ***vp);
+static int acpi_fan_power(struct acpi_fan_softc *sc, int level);
+static int acpi_fan_cur_level(struct acpi_fan_softc *sc);
+static int acpi_fan_cap(struct acpi_fan_softc *sc, int level);
+static int acpi_fan_cap_floor(struct acpi_fan_softc *sc, int level);
+static void acpi_fan_resist(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static void acpi_fan_owner(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static int acpi_fan_owner_defer(struct acpi_fan_softc *sc);
+static void acpi_fan_owner_wrote(struct acpi_fan_softc *sc);
+static int acpi_fan_level_match(struct acpi_fan_softc *sc, int level,
+    int control);
+static int acpi_fan_resist_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_obstructed_sysctl(SYSCTL_HANDLER_ARGS);
+static void acpi_fan_rec_tick(void *arg);
+static void acpi_fan_rec_sweep(void *context, int pending);
+static void acpi_fan_rec_trigger(struct acpi_fan_softc *sc, int reason,
+    uint64_t now);
+static void acpi_fan_check_stall(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static int acpi_fan_tz_critical(struct acpi_fan_softc **v, int n);
+static ACPI_STATUS acpi_fan_tz_found(ACPI_HANDLE h, UINT32 level,
+    void *context, void **status);
+static void acpi_fan_tz_notify(ACPI_HANDLE h, UINT32 notify, void *context);
+static void acpi_fan_notify(ACPI_HANDLE h, UINT32 notify, void *context);
+static int acpi_fan_freeze_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_recorder_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_set_level(struct acpi_fan_softc *sc, int level);
+static void acpi_fan_trace(int unit, int type, int what, int32_t arg);
+static void acpi_fan_serial_begin(void);
+static sbintime_t acpi_fan_aml_begin(int unit, int method);
+static void acpi_fan_aml_end(int unit, int method, sbintime_t start,
+    ACPI_STATUS status);
+static int acpi_fan_trace_enable_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_trace_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_aml_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_aml_admit(int class);
+static int acpi_fan_conf_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_conf_check(const struct acpi_fan_conf_hdr *hdr,
+    const struct acpi_fan_conf *conf);
+static int acpi_fan_conf_apply(const struct acpi_fan_conf_hdr *hdr,
+    const struct acpi_fan_conf *conf);
+static struct acpi_fan_softc *acpi_fan_find(int unit);
+static void acpi_fan_tz_bind(struct acpi_fan_softc *sc);
+static void acpi_fan_tz_trips(struct acpi_fan_softc *sc);
+static void acpi_fan_zone_temp(struct acpi_fan_softc *sc, int i, int class,
+    sbintime_t now);
+static void acpi_fan_read_temp(struct acpi_fan_softc *sc, int class);
+static void acpi_fan_control(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static int acpi_fan_demand(struct acpi_fan_softc *sc);
+static int acpi_fan_profile_demand(struct acpi_fan_softc *sc);
+static struct acpi_fan_profile *acpi_fan_profile_compile(
+    const struct acpi_fan_prof_hdr *hdr, const struct acpi_fan_prof_fan *pf);
+static int acpi_fan_profile_load_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_profile_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_profiles_sysctl(SYSCTL_HANDLER_ARGS);
+static int acpi_fan_ctl_mode_sysctl(SYSCTL_HANDLER_ARGS);
+static void acpi_fan_mpc_reset(struct acpi_fan_mpc *m);
+static void acpi_fan_mpc_update(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static int acpi_fan_mpc_demand(struct acpi_fan_softc *sc);
+static int acpi_fan_mpc_sysctl(SYSCTL_HANDLER_ARGS);
+static void acpi_fan_forecast(struct acpi_fan_softc *sc);
+static int acpi_fan_max_speed(struct acpi_fan_softc *sc);
+static int acpi_fan_pol_verify(const struct acpi_fan_insn *prog, int len);
+static int acpi_fan_pol_demand(struct acpi_fan_softc *sc);
+static int acpi_fan_pol_sysctl(SYSCTL_HANDLER_ARGS);
+static void acpi_fan_health(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s);
+static int acpi_fan_expected_speed(struct acpi_fan_softc *sc, int control);
+static int acpi_fan_bounded_sysctl(SYSCTL_HANDLER_ARGS);
+static void acpi_fan_event(struct acpi_fan_softc *sc, int type,
+    const char *fmt, ...) __printflike(3, 4);
+static int acpi_fan_event_send(struct acpi_fan_softc *sc, int type,
+    const char *data, u_int suppressed, sbintime_t now);
+static void acpi_fan_event_flush(struct acpi_fan_softc *sc);
+
+
+/*-------------- * 
+ *Device methods *
+ * ------------- */
+static int acpi_fan_probe(device_t dev);
+static int acpi_fan_attach(device_t dev);
+static int acpi_fan_detach(device_t dev);
+static int acpi_fan_suspend(device_t dev);
+static int acpi_fan_resume(device_t dev);
+
+static device_method_t acpi_fan_methods[] = {
+    
+	/* Device interface */
+    DEVMETHOD(device_probe,		acpi_fan_probe),
+    DEVMETHOD(device_attach,	acpi_fan_attach),
+    DEVMETHOD(device_detach,	acpi_fan_detach),
+	DEVMETHOD(device_suspend,	acpi_fan_suspend),
+	DEVMETHOD(device_resume,	acpi_fan_resume),
+	
+    DEVMETHOD_END
+};
+
+
+/* probe the fan */
+static int
+acpi_fan_probe(device_t dev)
+{
+    static char *fan_ids[] = { \
+	"PNP0C0B", 		/* Generic Fan */ \
+	"INT3404",		/* Fan */ \
+	"INTC1044",		/* Fan for Tiger Lake generation */ \
+	"INTC1048", 	/* Fan for Alder Lake generation */ \
+	"INTC1063", 	/* Fan for Meteor Lake generation */ \
+	"INTC10A2", 	/* Fan for Raptor Lake generation */ \
+	NULL };
+    int rv;
+    
+    if (acpi_disabled("fan"))
+	return (ENXIO);
+    rv = ACPI_ID_PROBE(device_get_parent(dev), dev, fan_ids, NULL);
+    if (rv <= 0)
+	device_set_desc(dev, "ACPI FAN");
+	/* XXX: we can do strncmp and then set a more precise description. */
+	/* For now, this will do. */
+
+    return (rv);
+}
+
+
+static int
+acpi_fan_attach(device_t dev)
+{
+//	int	error;
+	ACPI_HANDLE	handle;
+	ACPI_HANDLE tmp;
+	struct acpi_fan_softc *sc;
+	struct acpi_softc *acpi_sc;
+	cpuset_t mask;
+	char *env;
+
+	
+    sc = device_get_softc(dev);
+    handle = acpi_get_handle(dev);
+    sc->dev = dev;
+	sc->level = -1;
+	sc->temp = -1;
+	sc->forecast = -1;
+	sc->prev_control = -1;
+	sc->ev_speed = -1;
+	sc->cap_demand = -1;
+	sc->mpc_limit = acpi_fan_mpc_limit;
+	if (resource_int_value(device_get_name(dev), device_get_unit(dev),
+	    "priority", &sc->priority) != 0)
+		sc->priority = acpi_fan_priority;
+	sc->priority = MIN(MAX(sc->priority, 0), ACPI_FAN_PRIO_MAX);
+	if (resource_int_value(device_get_name(dev), device_get_unit(dev),
+	    "max_power", &sc->max_power) != 0 || sc->max_power < 0)
+		sc->max_power = 0;
+	acpi_fan_mpc_reset(&sc->mpc);
+
+	/* acpi subsystem powers on all new devices, right? No need to check. XXX: btw this is not a check. */
+	sc->fan_powered=1;
+
+	/* create sysctls for 3 scenarios: 
+	fan control via percentage (1)
+	fan control via fan levels (2)
+	fan control via acpi version 1.0 (3) */
+
+	/* sysctl context XXX: Delete? */
+	struct sysctl_oid *fan_oid = device_get_sysctl_tree(dev);
+
+
+	/* fans are either acpi 1.0 or 4.0 compatible, so check now. */
+	if (acpi_fan_get_fif(dev) &&
+		acpi_fan_get_fst(dev) &&
+		ACPI_SUCCESS(acpi_GetHandleInScope(handle, "_FSL", &tmp))) {
+		
+		sc->acpi4=1;	/* acpi 4.0 compatible */
+		acpi_fan_get_fps(dev);	/* optional with fine grain control */
+		SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(fan_oid), OID_AUTO,
+		    sc->fif.fine_grain_ctrl ? "fan_speed" : "current_fan_level",
+		    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, sc, 0,
+		    acpi_fan_level_sysctl, "I", sc->fif.fine_grain_ctrl ?
+		    "fan speed in %" : "fan level, a _FPS control value");
+		if (sc->fif.fine_grain_ctrl)
+			SYSCTL_ADD_INT(device_get_sysctl_ctx(dev),
+			    SYSCTL_CHILDREN(fan_oid), OID_AUTO, "step_size",
+			    CTLFLAG_RD, &sc->fif.stepsize, 0,
+			    "speed step in %");
+		SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(fan_oid), OID_AUTO, "rpm",
+		    CTLTYPE_INT | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+		    acpi_fan_rpm_sysctl, "I", "current revolutions per minute");
+	}
+	else {	/* acpi 1.0 */
+		sc->acpi4 = 0;
+		
+		SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(fan_oid), OID_AUTO, "powered",
+		    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, sc, 0,
+		    acpi_fan_powered_sysctl, "I", "Fan OFF=0 ON=1 UNKNOWN=2");
+	}	
+	
+	// XXX: Add a debug sysctl for testing!
+
+	/* Sample history, log and recorder, allocated on first use. */
+	sc->hist_size = MAX(acpi_fan_history_size, 1);
+	sc->log_nblk = MAX(acpi_fan_log_blocks, 1);
+	sc->rec_size = MAX(acpi_fan_rec_size, 1);
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "history", CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_history_sysctl, "S,acpi_fan_sample",
+	    "recent samples, oldest first");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "log", CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_log_sysctl, "S,acpi_fan_log_blk",
+	    "completed binary log blocks, or those after a sequence number");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "recorder", CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_recorder_sysctl, "S,acpi_fan_rec_hdr",
+	    "flight recorder contents, oldest first");
+
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "temperature", CTLFLAG_RD, &sc->temp, 0,
+	    "hottest thermal zone cooled by this fan, -1 unknown");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "control", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_ctl_mode_sysctl, "I",
+	    "control mode: 0 manual, 1 active profile, 2 model-predictive, "
+	    "3 policy program");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "policy", CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_pol_sysctl, "S,acpi_fan_insn",
+	    "control policy program for control mode 3");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "policy_faults", CTLFLAG_RD, &sc->pol_faults, 0,
+	    "policy runs aborted by a division by zero");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "mpc_limit", CTLFLAG_RW, &sc->mpc_limit, 0,
+	    "temperature limit of the predictive controller, tenths of Kelvin");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "forecast", CTLFLAG_RD, &sc->forecast, 0,
+	    "temperature forecast at hw.acpi.fan.forecast_horizon, -1 unknown");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "headroom", CTLFLAG_RD, &sc->headroom, 0,
+	    "cooling headroom, percent of the maximum speed left");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "priority", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+	    &sc->priority, ACPI_FAN_PRIO_MAX, acpi_fan_bounded_sysctl, "I",
+	    "sweep priority, 0 highest");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "resistance", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_resist_sysctl, "A",
+	    "thermal resistance current/baseline per speed band, Q8");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "obstructed", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_obstructed_sysctl, "I",
+	    "airflow obstructed; write 0 after cleaning to rebaseline");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "owner", CTLFLAG_RD, &sc->owner, 0,
+	    "0 driver, 1 contested with firmware, 2 firmware");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "owner_skipped", CTLFLAG_RD, &sc->own_skipped, 0,
+	    "level writes not issued because firmware overrides them");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "power_capped", CTLFLAG_RD, &sc->capped, 0,
+	    "level held below demand by hw.acpi.fan.power_cap");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "health", CTLFLAG_RD, &sc->health, 0,
+	    "0 unknown, 1 ok, 2 degraded, 3 failing");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "health_score", CTLFLAG_RD, &sc->health_score, 0,
+	    "health score, 0-100");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "health_reasons", CTLFLAG_RD, &sc->health_reasons, 0,
+	    "ACPI_FAN_HR_* bits lowering the score");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev), SYSCTL_CHILDREN(fan_oid),
+	    OID_AUTO, "mpc_model", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, acpi_fan_mpc_sysctl, "A",
+	    "identified model a b c d (x1000) and number of updates");
+
+	AcpiInstallNotifyHandler(handle, ACPI_DEVICE_NOTIFY, acpi_fan_notify, sc);
+
+	/* Publish the fan and create the hw.acpi.fan tree with the first one. */
+	acpi_sc = acpi_device_get_parent_softc(dev);
+	ACPI_SERIAL_BEGIN(fan);
+	if (acpi_fan_sysctl_tree == NULL) {
+		sysctl_ctx_init(&acpi_fan_sysctl_ctx);
+		acpi_fan_sysctl_tree = SYSCTL_ADD_NODE(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_sc->acpi_sysctl_tree), OID_AUTO, "fan",
+		    CTLFLAG_RD | CTLFLAG_MPSAFE, 0, "fan status");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "generation",
+		    CTLFLAG_RD, &acpi_fan_gen, 0, "global state generation");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "snapshot",
+		    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_snapshot_sysctl, "S,acpi_fan_snap",
+		    "state of all fans, or of fans changed since a generation");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "epoch",
+		    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_epoch_sysctl, "S,acpi_fan_epoch_rec",
+		    "samples of all fans from the latest complete sweep");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "summary",
+		    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_summary_sysctl, "S,acpi_fan_summary",
+		    "node summary of the latest sweep");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "offset",
+		    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_offset_sysctl, "S,acpi_fan_offset",
+		    "demand offset and lease from a coordinator");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "offset_min", CTLFLAG_RW, &acpi_fan_off_min, 0,
+		    "lowest demand offset accepted from a coordinator");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "sample_interval", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    &acpi_fan_sample_ms, 0, acpi_fan_interval_sysctl, "I",
+		    "sampling interval in ms, 0 disables");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "recorder_interval", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    &acpi_fan_rec_ms, 0, acpi_fan_interval_sysctl, "I",
+		    "flight recorder interval in ms, 0 disables");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "recorder_freeze", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    NULL, 0, acpi_fan_freeze_sysctl, "I",
+		    "1 freezes all flight recorders, 0 rearms them");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "trace_enable", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    NULL, 0, acpi_fan_trace_enable_sysctl, "I",
+		    "record AML, control and power events");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "trace",
+		    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_trace_sysctl, "S,acpi_fan_trace",
+		    "recorded events, or those after a record number");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "aml_rate", CTLFLAG_RW, &acpi_fan_aml_rate, 0,
+		    "AML evaluations per second issued on the driver's own, "
+		    "0 unlimited");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "aml_burst", CTLFLAG_RW, &acpi_fan_aml_burst, 0,
+		    "AML evaluations allowed in a burst");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "aml_recorder_rate", CTLFLAG_RW, &acpi_fan_aml_rec_rate, 0,
+		    "AML evaluations per second of the flight recorder, "
+		    "0 unlimited");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "aml_deferred_control", CTLFLAG_RD,
+		    &acpi_fan_aml_deferred[ACPI_FAN_AML_CTL], 0,
+		    "level reductions postponed by the AML budget");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "aml_deferred_monitor", CTLFLAG_RD,
+		    &acpi_fan_aml_deferred[ACPI_FAN_AML_MON], 0,
+		    "reads answered from cached values by the AML budget");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "aml_deferred_recorder", CTLFLAG_RD,
+		    &acpi_fan_aml_deferred[ACPI_FAN_AML_REC], 0,
+		    "recorder reads answered from cached values");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "aml",
+		    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_aml_sysctl, "S,acpi_fan_aml_stat",
+		    "AML call count and latency per method, a write resets");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "config",
+		    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_conf_sysctl, "S,acpi_fan_conf",
+		    "configuration of all fans, applied as a whole");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "profile_load", CTLTYPE_OPAQUE | CTLFLAG_WR | CTLFLAG_MPSAFE,
+		    NULL, 0, acpi_fan_profile_load_sysctl, "S,acpi_fan_prof_hdr",
+		    "load or replace a named cooling profile");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "profile",
+		    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_profile_sysctl, "A",
+		    "active cooling profile, empty for none");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "profiles",
+		    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+		    acpi_fan_profiles_sysctl, "A", "loaded cooling profiles");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "forecast_threshold", CTLFLAG_RW, &acpi_fan_fc_threshold, 0,
+		    "forecast temperature that raises an event, 0 disables");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "ambient", CTLFLAG_RW, &acpi_fan_ambient, 0,
+		    "assumed inlet temperature, tenths of Kelvin");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "obstruct_threshold", CTLFLAG_RW, &acpi_fan_obstruct_pct, 0,
+		    "percent rise of thermal resistance flagged as obstruction");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "obstruct_sweeps", CTLFLAG_RW, &acpi_fan_obstruct_sweeps, 0,
+		    "sweeps the rise must last");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "tmp_cache_ms", CTLFLAG_RW, &acpi_fan_tmpc_ms, 0,
+		    "ms a zone's _TMP is shared between fans, 0 disables");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "tmp_cache_hits", CTLFLAG_RD, &acpi_fan_tmpc_hits, 0,
+		    "_TMP reads answered from the cache");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "tmp_cache_misses", CTLFLAG_RD, &acpi_fan_tmpc_misses, 0,
+		    "_TMP evaluations");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "contested_policy", CTLFLAG_RW, &acpi_fan_contest, 0,
+		    "fans firmware overrides: 0 keep writing, 1 back off, "
+		    "2 stop writing");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "power_cap", CTLFLAG_RW, &acpi_fan_power_cap, 0,
+		    "cap on the power of all fans in mW, 0 disables");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "power_cap_min", CTLFLAG_RW, &acpi_fan_cap_min, 0,
+		    "lowest level the power cap lowers a fan to");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "power", CTLFLAG_RD, &acpi_fan_power_total, 0,
+		    "estimated power of all fans in mW");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "buffer_idle", CTLFLAG_RW, &acpi_fan_buf_idle, 0,
+		    "seconds without readers before history, log and recorder "
+		    "rings are freed, 0 never");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "event_window", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    &acpi_fan_ev_window, INT_MAX, acpi_fan_bounded_sysctl, "I",
+		    "ms per event of a type and fan, 0 disables coalescing");
+		SYSCTL_ADD_PROC(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "event_max", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    &acpi_fan_ev_max, INT_MAX, acpi_fan_bounded_sysctl, "I",
+		    "events of all fans per window (per second if the window "
+		    "is 0), 0 unlimited");
+		SYSCTL_ADD_U64(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO,
+		    "event_dropped", CTLFLAG_RD, &acpi_fan_ev_dropped, 0,
+		    "events held back by event_max");
+
+		if ((env = kern_getenv("smbios.system.product")) != NULL) {
+			strlcpy(acpi_fan_model, env, sizeof(acpi_fan_model));
+			freeenv(env);
+		}
+		SYSCTL_ADD_STRING(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "model",
+		    CTLFLAG_RD, acpi_fan_model, 0,
+		    "platform name recorded in log headers");
+
+		/* Watch thermal zones to freeze the recorders near _CRT. */
+		acpi_fan_ntz = 0;
+		AcpiWalkNamespace(ACPI_TYPE_THERMAL, ACPI_ROOT_OBJECT,
+		    ACPI_UINT32_MAX, acpi_fan_tz_found, NULL, NULL, NULL);
+
+		if (acpi_fan_cpu >= 0 && (acpi_fan_cpu > (int)mp_maxid ||
+		    CPU_ABSENT(acpi_fan_cpu))) {
+			device_printf(dev, "no CPU %d, not binding\n",
+			    acpi_fan_cpu);
+			acpi_fan_cpu = -1;
+		}
+		acpi_fan_tq = taskqueue_create("acpi_fan", M_WAITOK,
+		    taskqueue_thread_enqueue, &acpi_fan_tq);
+		if (acpi_fan_cpu >= 0) {
+			CPU_SETOF(acpi_fan_cpu, &mask);
+			taskqueue_start_threads_cpuset(&acpi_fan_tq, 1, PWAIT,
+			    &mask, "acpi_fan");
+		} else
+			taskqueue_start_threads(&acpi_fan_tq, 1, PWAIT,
+			    "acpi_fan");
+		SYSCTL_ADD_INT(&acpi_fan_sysctl_ctx,
+		    SYSCTL_CHILDREN(acpi_fan_sysctl_tree), OID_AUTO, "cpu",
+		    CTLFLAG_RD, &acpi_fan_cpu, 0,
+		    "CPU running the sweeps, -1 unbound");
+
+		callout_init(&acpi_fan_sample_callout, 1);
+		TASK_INIT(&acpi_fan_sample_task, 0, acpi_fan_sample_sweep, NULL);
+		callout_init(&acpi_fan_rec_callout, 1);
+		TASK_INIT(&acpi_fan_rec_task, 0, acpi_fan_rec_sweep, NULL);
+		acpi_fan_sampling = 1;
+		acpi_fan_arm();
+	}
+	sc->ctl_mode = sc->acpi4 ? ACPI_FAN_CTL_PROFILE : ACPI_FAN_CTL_MANUAL;
+	acpi_fan_tz_bind(sc);
+	acpi_fan_bump_gen(sc);
+	TAILQ_INSERT_TAIL(&acpi_fan_list, sc, link);
+	acpi_fan_count++;
+	ACPI_SERIAL_END(fan);
+	
+	return 0;
+}
+
+static int
+acpi_fan_detach(device_t dev) {
+	
+	struct acpi_fan_softc *sc;
+	struct acpi_fan_trace *trace;
+	int i, last;
+    sc = device_get_softc(dev);
+
+	ACPI_SERIAL_BEGIN(fan);
+	TAILQ_REMOVE(&acpi_fan_list, sc, link);
+	acpi_fan_count--;
+	sc->detached = 1;
+	/* Delta readers notice the removal through hdr.total. */
+	atomic_add_64(&acpi_fan_gen, 1);
+	last = TAILQ_EMPTY(&acpi_fan_list);
+	if (last) {
+		acpi_fan_sampling = 0;
+		acpi_fan_sysctl_tree = NULL;
+		atomic_store_rel_ptr(&acpi_fan_profile_active, NULL);
+		for (i = 0; i < ACPI_FAN_PROF_MAX; i++) {
+			free(acpi_fan_profiles[i], M_ACPIFAN);
+			acpi_fan_profiles[i] = NULL;
+		}
+		bzero(acpi_fan_tmpc, sizeof(acpi_fan_tmpc));
+	}
+	ACPI_SERIAL_END(fan);
+
+	/*
+	 * Unlinked but still reachable through its sysctls and notify
+	 * handler; return(ms) widens the window for stress runs.
+	 */
+	KFAIL_POINT_CODE(DEBUG_FP, acpi_fan_detach, 0,
+	    pause_sbt("fandet", RETURN_VALUE * SBT_1MS, 0, 0));
+
+	AcpiRemoveNotifyHandler(acpi_get_handle(dev), ACPI_DEVICE_NOTIFY,
+	    acpi_fan_notify);
+
+	/*
+	 * sysctl_ctx_free() waits for running handlers, which may be
+	 * waiting for the lock, so free the hw.acpi.fan tree only now.
+	 */
+	if (last)
+		sysctl_ctx_free(&acpi_fan_sysctl_ctx);
+
+	/* The sweeps hold the lock, so they no longer see this fan. */
+	if (last) {
+		for (i = 0; i < acpi_fan_ntz; i++)
+			AcpiRemoveNotifyHandler(acpi_fan_tz[i],
+			    ACPI_DEVICE_NOTIFY, acpi_fan_tz_notify);
+		callout_drain(&acpi_fan_sample_callout);
+		taskqueue_drain(acpi_fan_tq, &acpi_fan_sample_task);
+		callout_drain(&acpi_fan_rec_callout);
+		taskqueue_drain(acpi_fan_tq, &acpi_fan_rec_task);
+		taskqueue_free(acpi_fan_tq);
+		acpi_fan_tq = NULL;
+		/* Only the sweeps read the zones, and they are drained. */
+		acpi_fan_ntz = 0;
+
+		mtx_lock(&acpi_fan_trace_mtx);
+		trace = acpi_fan_trace_buf;
+		acpi_fan_trace_buf = NULL;
+		acpi_fan_trace_on = 0;
+		mtx_unlock(&acpi_fan_trace_mtx);
+		free(trace, M_ACPIFAN);
+	}
+	/*
+	 * newbus only removes our sysctl nodes after we return, so a
+	 * handler may still be running; it checks sc->detached.
+	 */
+	ACPI_SERIAL_BEGIN(fan);
+	free(sc->hist, M_ACPIFAN);
+	free(sc->log_ring, M_ACPIFAN);
+	free(sc->rec, M_ACPIFAN);
+	free(sc->fps, M_ACPIFAN);	/* dont change fan settings and leave. */
+	free(sc->pol, M_ACPIFAN);
+	sc->hist = NULL;
+	sc->log_ring = sc->log_cur = NULL;
+	sc->rec = NULL;
+	sc->fps = NULL;
+	sc->pol = NULL;
+	sc->pol_len = 0;
+	ACPI_SERIAL_END(fan);
+	return 0;
+}
+
+static int
+acpi_fan_suspend(device_t dev) {
+	//acpi_fan_set_power(dev, 0);				/* fan should be off in suspend mode, right? */
+	return 0;
+}
+
+static int
+acpi_fan_resume(device_t dev) {
+	//acpi_fan_set_power(dev, 1);				/* turn fan on on resume. XXX: Do we need to check anything? */
+	return 0;
+}
+
+
+/* Userland requestet fan level sysctl */
+static int
+acpi_fan_level_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    struct acpi_fan_softc *sc;
+    device_t dev;
+	int requested_speed;
+	int error, unit;
+
+    sc = (struct acpi_fan_softc *) oidp->oid_arg1;
+    dev = sc->dev;
+    unit = device_get_unit(dev);
+
+	/* Copy in before taking the lock, SYSCTL_IN may fault and sleep. */
+	if (req->newptr) {
+		error = SYSCTL_IN(req, &requested_speed, sizeof(requested_speed));
+		if (error)
+			return (error);
+		/* XXX: what is max fan level according to the spec? */
+		if (requested_speed > 100 || requested_speed < 0)
+			return (EINVAL);
+	}
+
+	acpi_fan_serial_begin();
+	if (sc->detached) {
+		ACPI_SERIAL_END(fan);
+		return (ENXIO);
+	}
+	acpi_fan_trace(unit, ACPI_FAN_TR_SYSCTL_BEGIN, ACPI_FAN_S_LEVEL,
+	    req->newptr != NULL);
+	
+    if(req->newptr) {	/* Write request */
+		error = 0;
+		if (!sc->fan_powered)
+			error = acpi_fan_set_power(dev, 1);
+
+		/*
+		 * fine_grain_ctrl: 0-100 %, otherwise a level.  Both
+		 * are range checked above.
+		 */
+		if (error == 0)
+			error = acpi_fan_set_level(sc, requested_speed);
+	}
+
+    else /* read request */ {		
+		if (acpi_fan_aml_admit(ACPI_FAN_AML_MON))
+			acpi_fan_get_fst(dev); /* XXX: does it matter, whether it is fan level control or percentage level? */
+		requested_speed = sc->fst.control;
+	}
+	
+	acpi_fan_trace(unit, ACPI_FAN_TR_SYSCTL_END, ACPI_FAN_S_LEVEL, 0);
+	ACPI_SERIAL_END(fan);
+
+	if (!req->newptr)
+		error = SYSCTL_OUT(req, &requested_speed,
+		    sizeof(requested_speed));
+    return (error);
+}
+
+/* This sysctl controls if the fan is on or off. */
+static int
+acpi_fan_powered_sysctl(SYSCTL_HANDLER_ARGS) {
+	
+	struct acpi_fan_softc *sc;
+	int error;
+	int powered, state;
+	
+	sc = (struct acpi_fan_softc *) oidp->oid_arg1;
+
+	ACPI_SERIAL_BEGIN(fan);
+	powered = sc->fan_powered;
+	ACPI_SERIAL_END(fan);
+
+	error = sysctl_handle_int(oidp, &powered, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	/* Correct bogus writes to either 0 or 1. */
+	if (powered != 0)
+		powered = 1;
+
+	acpi_fan_serial_begin();
+	if (sc->detached) {
+		ACPI_SERIAL_END(fan);
+		return (ENXIO);
+	}
+		
+	/* Attempt to set the power state. */
+	acpi_fan_trace(device_get_unit(sc->dev), ACPI_FAN_TR_SYSCTL_BEGIN,
+	    ACPI_FAN_S_POWERED, 1);
+	if (acpi_DeviceIsPresent(sc->dev)) {
+		state = acpi_fan_get_power_state(sc->dev);
+		if (state == ACPI_FAN_POWER_UNKNOWN) {
+			/*XXX: My 1.0 compatible mainboard ends up here... */
+		}
+		else if (state != powered)
+			error = acpi_fan_set_power(sc->dev, powered);
+	}
+	/* Without a usable _STA the write is taken at its word. */
+	if (error == 0 && sc->fan_powered != powered) {
+		sc->fan_powered = powered;
+		acpi_fan_bump_gen(sc);
+	}
+	acpi_fan_trace(device_get_unit(sc->dev), ACPI_FAN_TR_SYSCTL_END,
+	    ACPI_FAN_S_POWERED, 0);
+	ACPI_SERIAL_END(fan);
+	return (error);
+}
+
+
+/* This sysctl returns revolutions per minute */
+static int acpi_fan_rpm_sysctl(SYSCTL_HANDLER_ARGS) {
+	
+    struct acpi_fan_softc *sc;
+	int speed;
+
+    sc = (struct acpi_fan_softc *) oidp->oid_arg1;
+
+	if (req->newptr)
+		return (EPERM);
+
+	acpi_fan_serial_begin();
+	if (sc->detached || (acpi_fan_aml_admit(ACPI_FAN_AML_MON) &&
+	    !acpi_fan_get_fst(sc->dev))) {
+		ACPI_SERIAL_END(fan);
+		return (ENXIO);
+	}
+	speed = sc->fst.speed;
+	ACPI_SERIAL_END(fan);
+
+	return (SYSCTL_OUT(req, &speed, sizeof(speed)));
+}
+
+
+/* Stamp a fan with a new generation after its published state changed. */
+static void
+acpi_fan_bump_gen(struct acpi_fan_softc *sc)
+{
+
+	sc->gen = atomic_fetchadd_64(&acpi_fan_gen, 1) + 1;
+}
+
+/*
+ * Aggregate snapshot of all fans.  Userland may write a generation
+ * number in the same request to receive only fans changed since then.
+ */
+static int
+acpi_fan_snapshot_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_snap_hdr hdr;
+	struct acpi_fan_snap *snap, *rec;
+	struct acpi_fan_softc *sc;
+	uint64_t since;
+	int error, n;
+
+	since = 0;
+	if (req->newptr) {
+		error = SYSCTL_IN(req, &since, sizeof(since));
+		if (error)
+			return (error);
+	}
+
+	ACPI_SERIAL_BEGIN(fan);
+	n = acpi_fan_count;
+	snap = malloc(MAX(n, 1) * sizeof(*snap), M_ACPIFAN, M_WAITOK | M_ZERO);
+	bzero(&hdr, sizeof(hdr));
+	hdr.version = ACPI_FAN_SNAP_VERSION;
+	hdr.total = n;
+	hdr.gen = atomic_load_64(&acpi_fan_gen);
+	rec = snap;
+	TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+		if (sc->gen <= since)
+			continue;
+		rec->gen = sc->gen;
+		rec->unit = device_get_unit(sc->dev);
+		rec->acpi4 = sc->acpi4;
+		rec->powered = sc->fan_powered;
+		rec->level = sc->level;
+		rec->control = sc->fst.control;
+		rec->speed = sc->fst.speed;
+		rec->health = sc->health;
+		rec->score = sc->health_score;
+		rec->reasons = sc->health_reasons;
+		rec++;
+	}
+	hdr.count = rec - snap;
+	ACPI_SERIAL_END(fan);
+
+	error = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+	if (error == 0)
+		error = SYSCTL_OUT(req, snap, hdr.count * sizeof(*snap));
+	free(snap, M_ACPIFAN);
+	return (error);
+}
+
+/* Samples of all fans from the latest complete sweep. */
+static int
+acpi_fan_epoch_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_epoch_hdr hdr;
+	struct acpi_fan_epoch_rec *buf, *rec;
+	struct acpi_fan_softc *sc;
+	uint64_t since;
+	int error;
+
+	since = 0;
+	if (req->newptr) {
+		error = SYSCTL_IN(req, &since, sizeof(since));
+		if (error)
+			return (error);
+	}
+
+	ACPI_SERIAL_BEGIN(fan);
+	buf = mallocarray(MAX(acpi_fan_count, 1), sizeof(*buf), M_ACPIFAN,
+	    M_WAITOK | M_ZERO);
+	bzero(&hdr, sizeof(hdr));
+	hdr.total = acpi_fan_count;
+	hdr.epoch = acpi_fan_epoch;
+	hdr.time = acpi_fan_epoch_time;
+	rec = buf;
+	if (acpi_fan_epoch > since) {
+		TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+			if (sc->ep_num != acpi_fan_epoch)
+				continue;
+			rec->unit = device_get_unit(sc->dev);
+			rec->sample = sc->ep_sample;
+			rec++;
+		}
+	}
+	hdr.count = rec - buf;
+	ACPI_SERIAL_END(fan);
+
+	error = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+	if (error == 0)
+		error = SYSCTL_OUT(req, buf, hdr.count * sizeof(*buf));
+	free(buf, M_ACPIFAN);
+	return (error);
+}
+
+/* Node summary of the latest sweep, for a coordinator. */
+static int
+acpi_fan_summary_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_summary sum;
+	struct acpi_fan_softc *sc;
+	int64_t total;
+	int n;
+
+	bzero(&sum, sizeof(sum));
+	sum.version = ACPI_FAN_SUMMARY_VERSION;
+	sum.temp = sum.forecast = sum.level_max = -1;
+	sum.headroom = 100;
+	total = n = 0;
+
+	ACPI_SERIAL_BEGIN(fan);
+	sum.epoch = acpi_fan_epoch;
+	sum.time = acpi_fan_epoch_time;
+	sum.power = acpi_fan_power_total;
+	if (acpi_fan_off != 0 && sbinuptime() < acpi_fan_off_until)
+		sum.offset = acpi_fan_off;
+	TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+		if (sc->ep_num != acpi_fan_epoch)
+			continue;
+		sum.count++;
+		sum.temp = MAX(sum.temp, sc->temp);
+		sum.forecast = MAX(sum.forecast, sc->forecast);
+		sum.headroom = MIN(sum.headroom, sc->headroom);
+		sum.health = MAX(sum.health, (uint32_t)sc->health);
+		if (sc->level >= 0) {
+			sum.level_max = MAX(sum.level_max, sc->level);
+			total += sc->level;
+			n++;
+		}
+	}
+	ACPI_SERIAL_END(fan);
+	sum.level_mean = n > 0 ? total / n : -1;
+
+	return (SYSCTL_OUT(req, &sum, sizeof(sum)));
+}
+
+/* Demand offset from a coordinator, with a lease. */
+static int
+acpi_fan_offset_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_offset off;
+	sbintime_t now;
+	int error;
+
+	now = sbinuptime();
+	ACPI_SERIAL_BEGIN(fan);
+	bzero(&off, sizeof(off));
+	if (acpi_fan_off != 0 && now < acpi_fan_off_until) {
+		off.offset = acpi_fan_off;
+		off.lease = (acpi_fan_off_until - now) / SBT_1S;
+	}
+	ACPI_SERIAL_END(fan);
+
+	error = SYSCTL_OUT(req, &off, sizeof(off));
+	if (error || req->newptr == NULL)
+		return (error);
+	error = SYSCTL_IN(req, &off, sizeof(off));
+	if (error)
+		return (error);
+	if (off.offset < -100 || off.offset > 100 || off.lease > 3600)
+		return (EINVAL);
+
+	ACPI_SERIAL_BEGIN(fan);
+	acpi_fan_off = MAX(off.offset, acpi_fan_off_min);
+	acpi_fan_off_until = now + off.lease * SBT_1S;
+	ACPI_SERIAL_END(fan);
+	return (0);
+}
+
+/* Sampler callout: evaluating AML may sleep, so sweep from a task. */
+static void
+acpi_fan_sample_tick(void *arg)
+{
+
+	taskqueue_enqueue(acpi_fan_tq, &acpi_fan_sample_task);
+}
+
+/* Sample every fan once and rearm the callout. */
+static void
+acpi_fan_sample_sweep(void *context, int pending)
+{
+	struct acpi_fan_softc *sc, **v;
+	struct acpi_fan_sample s;
+	struct timeval tv;
+	uint64_t epoch;
+	int i, j, n;
+
+	acpi_fan_serial_begin();
+	/* Readers hold the lock too, so they only see complete sweeps. */
+	microtime(&tv);
+	epoch = acpi_fan_epoch + 1;
+	if (atomic_readandclear_int(&acpi_fan_tz_retrip))
+		TAILQ_FOREACH(sc, &acpi_fan_list, link)
+			acpi_fan_tz_trips(sc);
+	/*
+	 * Control only depends on the fan's own sample, so each fan is
+	 * driven right after it is read and a high priority fan never
+	 * waits for the reads of the others.
+	 */
+	n = acpi_fan_order(&v);
+	for (i = 0; i < n; i++)
+		v[i]->cap_rank = i;
+	for (i = 0; i < n; i++) {
+		sc = v[i];
+		acpi_fan_sample(sc, &s, ACPI_FAN_AML_MON);
+		sc->ep_sample = s;
+		sc->ep_num = epoch;
+		if (s.flags & ACPI_FAN_SAMPLE_CACHED)
+			sc->prio_age++;
+		else
+			sc->prio_age = 0;
+		/* return(n) replays a burst of n notifications per fan. */
+		KFAIL_POINT_CODE(DEBUG_FP, acpi_fan_sci, 0,
+		    for (j = 0; j < RETURN_VALUE; j++)
+			acpi_fan_notify(NULL, ACPI_FAN_NOTIFY_LOWSPEED, sc));
+		acpi_fan_check_stall(sc, &s);
+		acpi_fan_health(sc, &s);
+		acpi_fan_resist(sc, &s);
+		acpi_fan_owner(sc, &s);
+		acpi_fan_record(sc, &s);
+		acpi_fan_buf_reap(sc);
+		acpi_fan_forecast(sc);
+		acpi_fan_event_flush(sc);
+		acpi_fan_control(sc, &s);
+	}
+	free(v, M_ACPIFAN);
+	acpi_fan_power_total = 0;
+	TAILQ_FOREACH(sc, &acpi_fan_list, link)
+		acpi_fan_power_total += acpi_fan_power(sc,
+		    acpi_fan_cur_level(sc));
+	acpi_fan_epoch = epoch;
+	acpi_fan_epoch_time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	if (acpi_fan_sampling && acpi_fan_sample_ms > 0)
+		callout_reset_sbt_on(&acpi_fan_sample_callout,
+		    acpi_fan_sample_ms * SBT_1MS, 0, acpi_fan_sample_tick, NULL,
+		    acpi_fan_cpu, 0);
+	ACPI_SERIAL_END(fan);
+}
+
+/*
+ * Return the attached fans in sweep order: by priority less age, ties
+ * in attach order.  The caller frees *vp.
+ */
+static int
+acpi_fan_order(struct acpi_fan_softc ***vp)
+{
+	struct acpi_fan_softc *sc, **v;
+	int i, n;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	v = mallocarray(MAX(acpi_fan_count, 1), sizeof(*v), M_ACPIFAN,
+	    M_WAITOK);
+	n = 0;
+	TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+		for (i = n; i > 0 && v[i - 1]->priority - v[i - 1]->prio_age >
+		    sc->priority - sc->prio_age; i--)
+			v[i] = v[i - 1];
+		v[i] = sc;
+		n++;
+	}
+	*vp = v;
+	return (n);
+}
+
+static void
+acpi_fan_sample(struct acpi_fan_softc *sc, struct acpi_fan_sample *s,
+    int class)
+{
+	struct timeval tv;
+	int i;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	bzero(s, sizeof(*s));
+	/* Temperatures and _FST back to back, stamped once. */
+	acpi_fan_read_temp(sc, class);
+	if (sc->acpi4 && !acpi_fan_aml_admit(class))
+		s->flags |= ACPI_FAN_SAMPLE_CACHED;
+	else if (sc->acpi4 && acpi_fan_get_fst(sc->dev))
+		s->flags |= ACPI_FAN_SAMPLE_FST;
+	microtime(&tv);
+	s->time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	s->control = sc->fst.control;
+	s->speed = sc->fst.speed;
+	s->level = sc->level;
+	s->powered = sc->fan_powered;
+	for (i = 0; i < ACPI_FAN_SAMPLE_NTZ; i++)
+		s->temp[i] = i < sc->ntz ? sc->tz_temp[i] : -1;
+	if (sc->temp >= 0)
+		s->flags |= ACPI_FAN_SAMPLE_TEMP;
+	if (sc->temp_reused)
+		s->flags |= ACPI_FAN_SAMPLE_TCACHED;
+	s->temp_age = MIN(sbttoms(sbinuptime() - sc->temp_time), UINT16_MAX);
+}
+
+/* Store a sample in the history and feed it to the log encoder. */
+static void
+acpi_fan_record(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (sc->hist != NULL) {
+		sc->hist[sc->hist_head] = *s;
+		sc->hist_head = (sc->hist_head + 1) % sc->hist_size;
+		if (sc->hist_len < sc->hist_size)
+			sc->hist_len++;
+	}
+	if (sc->log_ring != NULL)
+		acpi_fan_log_append(sc, s);
+}
+
+/*
+ * Free history, log and recorder rings nobody read for buffer_idle
+ * seconds.  A frozen recorder is kept until it is read and rearmed.
+ */
+static void
+acpi_fan_buf_reap(struct acpi_fan_softc *sc)
+{
+	sbintime_t old;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (acpi_fan_buf_idle <= 0)
+		return;
+	old = sbinuptime() - acpi_fan_buf_idle * SBT_1S;
+	if (sc->hist != NULL && sc->hist_used < old) {
+		free(sc->hist, M_ACPIFAN);
+		sc->hist = NULL;
+	}
+	if (sc->log_ring != NULL && sc->log_used < old) {
+		free(sc->log_ring, M_ACPIFAN);
+		sc->log_ring = sc->log_cur = NULL;
+	}
+	if (sc->rec != NULL && sc->rec_used < old &&
+	    sc->rec_reason == ACPI_FAN_REC_NONE) {
+		free(sc->rec, M_ACPIFAN);
+		sc->rec = NULL;
+		sc->rec_head = sc->rec_len = 0;
+	}
+}
+
+#define	ACPI_FAN_FITS16(x)	((x) >= INT16_MIN && (x) <= INT16_MAX)
+
+/*
+ * Append a sample to the current log block as a delta to the previous
+ * one.  A block is closed when it is full, and early when time went
+ * backwards or a delta does not fit its field.
+ */
+static void
+acpi_fan_log_append(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+	struct acpi_fan_log_blk *b;
+	struct acpi_fan_log_delta *d;
+	struct acpi_fan_sample *p;
+	int64_t dc, ds, dl, dt[ACPI_FAN_SAMPLE_NTZ];
+	int i, fits;
+
+	b = sc->log_cur;
+	p = &sc->log_prev;
+	if (b->count > 0) {
+		dc = (int64_t)s->control - p->control;
+		ds = (int64_t)s->speed - p->speed;
+		dl = (int64_t)s->level - p->level;
+		fits = ACPI_FAN_FITS16(dc) && ACPI_FAN_FITS16(ds) &&
+		    ACPI_FAN_FITS16(dl);
+		for (i = 0; i < ACPI_FAN_SAMPLE_NTZ; i++) {
+			dt[i] = (int64_t)s->temp[i] - p->temp[i];
+			fits = fits && ACPI_FAN_FITS16(dt[i]);
+		}
+		if (s->time >= p->time && s->time - p->time <= UINT32_MAX &&
+		    fits) {
+			d = &b->delta[b->count - 1];
+			d->dt = s->time - p->time;
+			d->control = dc;
+			d->speed = ds;
+			d->level = dl;
+			d->powered = s->powered;
+			d->flags = s->flags;
+			for (i = 0; i < ACPI_FAN_SAMPLE_NTZ; i++)
+				d->temp[i] = dt[i];
+			b->count++;
+			b->t_last = s->time;
+			*p = *s;
+			if (b->count == ACPI_FAN_LOG_BLKRECS)
+				acpi_fan_log_close(sc);
+			return;
+		}
+		acpi_fan_log_close(sc);
+	}
+
+	bzero(b, sizeof(*b));
+	b->unit = device_get_unit(sc->dev);
+	b->count = 1;
+	b->t_first = b->t_last = s->time;
+	b->base = *s;
+	*p = *s;
+}
+
+/* Move the current block into the ring of completed blocks. */
+static void
+acpi_fan_log_close(struct acpi_fan_softc *sc)
+{
+	struct acpi_fan_log_blk *b;
+
+	b = sc->log_cur;
+	b->seq = ++sc->log_seq;
+	sc->log_ring[(b->seq - 1) % sc->log_nblk] = *b;
+	b->count = 0;
+}
+
+/* Interval of the sampler or the recorder, arg1 points to it. */
+static int
+acpi_fan_interval_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	int *interval;
+	int error, val;
+
+	interval = (int *)arg1;
+	ACPI_SERIAL_BEGIN(fan);
+	val = *interval;
+	ACPI_SERIAL_END(fan);
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0)
+		return (EINVAL);
+
+	ACPI_SERIAL_BEGIN(fan);
+	*interval = val;
+	acpi_fan_arm();
+	ACPI_SERIAL_END(fan);
+	return (0);
+}
+
+/*
+ * (Re)arm the sampler and recorder callouts for the current intervals
+ * and free the recorder rings if it was disabled.
+ */
+static void
+acpi_fan_arm(void)
+{
+	struct acpi_fan_softc *sc;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (!acpi_fan_sampling)
+		return;
+	if (acpi_fan_rec_ms == 0) {
+		/* Recorder disabled, give its rings back. */
+		TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+			free(sc->rec, M_ACPIFAN);
+			sc->rec = NULL;
+			sc->rec_head = sc->rec_len = 0;
+		}
+	}
+	if (acpi_fan_sample_ms > 0)
+		callout_reset_sbt_on(&acpi_fan_sample_callout,
+		    acpi_fan_sample_ms * SBT_1MS, 0, acpi_fan_sample_tick, NULL,
+		    acpi_fan_cpu, 0);
+	if (acpi_fan_rec_ms > 0)
+		callout_reset_sbt_on(&acpi_fan_rec_callout,
+		    acpi_fan_rec_ms * SBT_1MS, 0, acpi_fan_rec_tick, NULL,
+		    acpi_fan_cpu, 0);
+}
+
+static void
+acpi_fan_rec_tick(void *arg)
+{
+
+	taskqueue_enqueue(acpi_fan_tq, &acpi_fan_rec_task);
+}
+
+/*
+ * Flight recorder sweep.  Fans whose recorder is frozen are skipped so
+ * the preserved history stays intact until it is rearmed.
+ */
+static void
+acpi_fan_rec_sweep(void *context, int pending)
+{
+	struct acpi_fan_softc *sc, **v;
+	struct acpi_fan_sample s;
+	int crit, i, n;
+
+	acpi_fan_serial_begin();
+	n = acpi_fan_order(&v);
+	crit = atomic_readandclear_int(&acpi_fan_tz_pending) &&
+	    acpi_fan_tz_critical(v, n);
+	for (i = 0; i < n; i++) {
+		sc = v[i];
+		if (sc->rec == NULL) {
+			/* Nobody subscribed, nothing to record. */
+			atomic_store_int(&sc->rec_pending, 0);
+			continue;
+		}
+		if (sc->rec_reason != ACPI_FAN_REC_NONE && sc->rec_post == 0)
+			continue;
+		acpi_fan_sample(sc, &s, ACPI_FAN_AML_REC);
+		if (crit)
+			acpi_fan_rec_trigger(sc, ACPI_FAN_REC_THERMAL, s.time);
+		if (atomic_readandclear_int(&sc->rec_pending))
+			acpi_fan_rec_trigger(sc, ACPI_FAN_REC_NOTIFY, s.time);
+		if (sc->rec_reason != ACPI_FAN_REC_NONE && sc->rec_post == 0)
+			continue;
+
+		sc->rec[sc->rec_head] = s;
+		sc->rec_head = (sc->rec_head + 1) % sc->rec_size;
+		if (sc->rec_len < sc->rec_size)
+			sc->rec_len++;
+		if (sc->rec_reason != ACPI_FAN_REC_NONE)
+			sc->rec_post--;
+	}
+	free(v, M_ACPIFAN);
+	if (acpi_fan_sampling && acpi_fan_rec_ms > 0)
+		callout_reset_sbt_on(&acpi_fan_rec_callout,
+		    acpi_fan_rec_ms * SBT_1MS, 0, acpi_fan_rec_tick, NULL,
+		    acpi_fan_cpu, 0);
+	ACPI_SERIAL_END(fan);
+}
+
+/*
+ * Trigger the recorder of a fan.  It keeps recording for
+ * hw.acpi.fan.recorder_post samples and then freezes.  Only the first
+ * trigger counts until the recorder is rearmed.
+ */
+static void
+acpi_fan_rec_trigger(struct acpi_fan_softc *sc, int reason, uint64_t now)
+{
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (sc->rec == NULL || sc->rec_reason != ACPI_FAN_REC_NONE)
+		return;
+	sc->rec_reason = reason;
+	sc->rec_time = now;
+	sc->rec_post = MAX(acpi_fan_rec_post, 0);
+	device_printf(sc->dev, "flight recorder triggered, reason %d\n",
+	    reason);
+}
+
+/* A fan is stalled when it is on and commanded to turn but reports 0 rpm. */
+static void
+acpi_fan_check_stall(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if ((s->flags & ACPI_FAN_SAMPLE_FST) == 0)
+		return;
+	if (s->powered && s->control > 0 && s->speed == 0) {
+		if (++sc->stall_count == acpi_fan_stall_samples) {
+			acpi_fan_rec_trigger(sc, ACPI_FAN_REC_STALL, s->time);
+			acpi_fan_event(sc, ACPI_FAN_EV_STALL, "control=%d",
+			    s->control);
+		}
+	} else
+		sc->stall_count = 0;
+
+	/* The first reading is the reference, not a change. */
+	if (sc->ev_speed < 0)
+		sc->ev_speed = s->speed;
+	else if (abs(s->speed - sc->ev_speed) > MAX(sc->ev_speed / 10, 100)) {
+		sc->ev_speed = s->speed;
+		acpi_fan_event(sc, ACPI_FAN_EV_SPEED, "speed=%d control=%d",
+		    s->speed, s->control);
+	}
+}
+
+/*
+ * Is a zone of a fan whose recorder can still trigger within crit_margin
+ * of its _CRT?  Zones are read through the _TMP cache on the recorder's
+ * AML budget, and _CRT is the value bound to the fan.
+ */
+static int
+acpi_fan_tz_critical(struct acpi_fan_softc **v, int n)
+{
+	struct acpi_fan_softc *sc;
+	sbintime_t now;
+	int i, j;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	now = sbinuptime();
+	for (i = 0; i < n; i++) {
+		sc = v[i];
+		if (sc->rec == NULL || sc->rec_reason != ACPI_FAN_REC_NONE)
+			continue;
+		for (j = 0; j < sc->ntz; j++) {
+			if (sc->tz_crt[j] <= 0)
+				continue;
+			acpi_fan_zone_temp(sc, j, ACPI_FAN_AML_REC, now);
+			if (sc->tz_temp[j] >= 0 &&
+			    sc->tz_temp[j] >= sc->tz_crt[j] - acpi_fan_crit_margin)
+				return (1);
+		}
+	}
+	return (0);
+}
+
+static ACPI_STATUS
+acpi_fan_tz_found(ACPI_HANDLE h, UINT32 level, void *context, void **status)
+{
+
+	if (acpi_fan_ntz == ACPI_FAN_MAXTZ)
+		return (AE_CTRL_TERMINATE);
+	if (ACPI_SUCCESS(AcpiInstallNotifyHandler(h, ACPI_DEVICE_NOTIFY,
+	    acpi_fan_tz_notify, NULL)))
+		acpi_fan_tz[acpi_fan_ntz++] = h;
+	return (AE_OK);
+}
+
+/*
+ * Notify handlers must not sleep; leave a note for the recorder sweep,
+ * which evaluates _TMP and _CRT with the lock held.
+ */
+static void
+acpi_fan_tz_notify(ACPI_HANDLE h, UINT32 notify, void *context)
+{
+
+	if (notify == ACPI_FAN_TZ_NOTIFY_TEMP)
+		atomic_store_rel_int(&acpi_fan_tz_pending, 1);
+	else if (notify == ACPI_FAN_TZ_NOTIFY_TRIPS)
+		atomic_store_rel_int(&acpi_fan_tz_retrip, 1);
+}
+
+static void
+acpi_fan_notify(ACPI_HANDLE h, UINT32 notify, void *context)
+{
+	struct acpi_fan_softc *sc;
+
+	sc = (struct acpi_fan_softc *)context;
+	atomic_add_int(&sc->notify_count, 1);
+	if (notify == ACPI_FAN_NOTIFY_LOWSPEED)
+		atomic_store_rel_int(&sc->rec_pending, 1);
+}
+
+/* Freeze (1) or rearm (0) the flight recorders of all fans. */
+static int
+acpi_fan_freeze_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	struct timeval tv;
+	int error, frozen;
+
+	frozen = 0;
+	ACPI_SERIAL_BEGIN(fan);
+	TAILQ_FOREACH(sc, &acpi_fan_list, link)
+		if (sc->rec_reason != ACPI_FAN_REC_NONE)
+			frozen = 1;
+	ACPI_SERIAL_END(fan);
+
+	error = sysctl_handle_int(oidp, &frozen, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	microtime(&tv);
+	ACPI_SERIAL_BEGIN(fan);
+	TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+		if (frozen) {
+			acpi_fan_rec_trigger(sc, ACPI_FAN_REC_MANUAL,
+			    (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+			sc->rec_post = 0;
+		} else {
+			sc->rec_reason = ACPI_FAN_REC_NONE;
+			sc->rec_post = 0;
+			sc->rec_len = 0;
+			sc->stall_count = 0;
+		}
+	}
+	ACPI_SERIAL_END(fan);
+	return (0);
+}
+
+/* Flight recorder of one fan: acpi_fan_rec_hdr, then samples oldest first. */
+static int
+acpi_fan_recorder_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	struct acpi_fan_rec_hdr hdr;
+	struct acpi_fan_sample *buf;
+	u_int i, n, first;
+	int error;
+
+	sc = (struct acpi_fan_softc *)arg1;
+
+	ACPI_SERIAL_BEGIN(fan);
+	if (sc->detached) {
+		ACPI_SERIAL_END(fan);
+		return (ENXIO);
+	}
+	sc->rec_used = sbinuptime();
+	if (sc->rec == NULL && acpi_fan_rec_ms > 0) {
+		/* First reader: start recording from now on. */
+		sc->rec = mallocarray(sc->rec_size, sizeof(*sc->rec),
+		    M_ACPIFAN, M_WAITOK | M_ZERO);
+		sc->rec_head = sc->rec_len = 0;
+	}
+	n = sc->rec_len;
+	buf = mallocarray(MAX(n, 1), sizeof(*buf), M_ACPIFAN, M_WAITOK);
+	first = (sc->rec_head + sc->rec_size - n) % sc->rec_size;
+	for (i = 0; i < n; i++)
+		buf[i] = sc->rec[(first + i) % sc->rec_size];
+	bzero(&hdr, sizeof(hdr));
+	hdr.reason = sc->rec_reason;
+	hdr.frozen = sc->rec_reason != ACPI_FAN_REC_NONE && sc->rec_post == 0;
+	hdr.count = n;
+	hdr.time = sc->rec_time;
+	ACPI_SERIAL_END(fan);
+
+	error = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+	if (error == 0)
+		error = SYSCTL_OUT(req, buf, n * sizeof(*buf));
+	free(buf, M_ACPIFAN);
+	return (error);
+}
+
+/* Sample history of one fan, oldest first. */
+static int
+acpi_fan_history_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	struct acpi_fan_sample *buf;
+	u_int i, n, first;
+	int error;
+
+	sc = (struct acpi_fan_softc *)arg1;
+
+	ACPI_SERIAL_BEGIN(fan);
+	if (sc->detached) {
+		ACPI_SERIAL_END(fan);
+		return (ENXIO);
+	}
+	sc->hist_used = sbinuptime();
+	if (sc->hist == NULL) {
+		/* First reader: start keeping history from now on. */
+		sc->hist = mallocarray(sc->hist_size, sizeof(*sc->hist),
+		    M_ACPIFAN, M_WAITOK | M_ZERO);
+		sc->hist_head = sc->hist_len = 0;
+	}
+	n = sc->hist_len;
+	buf = mallocarray(MAX(n, 1), sizeof(*buf), M_ACPIFAN, M_WAITOK);
+	first = (sc->hist_head + sc->hist_size - n) % sc->hist_size;
+	for (i = 0; i < n; i++)
+		buf[i] = sc->hist[(first + i) % sc->hist_size];
+	ACPI_SERIAL_END(fan);
+
+	error = SYSCTL_OUT(req, buf, n * sizeof(*buf));
+	free(buf, M_ACPIFAN);
+	return (error);
+}
+
+/*
+ * Completed log blocks of one fan in sequence order.  A sequence number
+ * written in the same request skips the blocks up to and including it.
+ */
+static int
+acpi_fan_log_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	struct acpi_fan_log_blk *buf;
+	uint64_t since, seq, first;
+	u_int n;
+	int error;
+
+	sc = (struct acpi_fan_softc *)arg1;
+	since = 0;
+	if (req->newptr) {
+		error = SYSCTL_IN(req, &since, sizeof(since));
+		if (error)
+			return (error);
+	}
+
+	ACPI_SERIAL_BEGIN(fan);
+	if (sc->detached) {
+		ACPI_SERIAL_END(fan);
+		return (ENXIO);
+	}
+	sc->log_used = sbinuptime();
+	if (sc->log_ring == NULL) {
+		/*
+		 * First reader: encode from now on.  log_seq keeps counting
+		 * across a free, so a writer sees the gap.  The block being
+		 * filled lives in the slot past the ring.
+		 */
+		sc->log_ring = mallocarray(sc->log_nblk + 1,
+		    sizeof(*sc->log_ring), M_ACPIFAN, M_WAITOK | M_ZERO);
+		sc->log_cur = &sc->log_ring[sc->log_nblk];
+		sc->log_base = sc->log_seq;
+	}
+	first = sc->log_seq > sc->log_nblk ? sc->log_seq - sc->log_nblk + 1 : 1;
+	if (first <= sc->log_base)
+		first = sc->log_base + 1;
+	if (first <= since)
+		first = since + 1;
+	n = first <= sc->log_seq ? sc->log_seq - first + 1 : 0;
+	buf = mallocarray(MAX(n, 1), sizeof(*buf), M_ACPIFAN, M_WAITOK);
+	for (seq = first; seq <= sc->log_seq; seq++)
+		buf[seq - first] = sc->log_ring[(seq - 1) % sc->log_nblk];
+	ACPI_SERIAL_END(fan);
+
+	error = SYSCTL_OUT(req, buf, n * sizeof(*buf));
+	free(buf, M_ACPIFAN);
+	return (error);
+}
+
+/* Write a fan level to _FSL.  Returns 0 on success. */
+static int
+acpi_fan_set_level(struct acpi_fan_softc *sc, int level)
+{
+	ACPI_STATUS status;
+	sbintime_t t;
+	int unit;
+
+	ACPI_SERIAL_ASSERT(fan);
+	unit = device_get_unit(sc->dev);
+	acpi_fan_trace(unit, ACPI_FAN_TR_CONTROL, 0, level);
+
+	t = acpi_fan_aml_begin(unit, ACPI_FAN_M_FSL);
+	status = acpi_SetInteger(acpi_get_handle(sc->dev), "_FSL", level);
+	acpi_fan_aml_end(unit, ACPI_FAN_M_FSL, t, status);
+	if (ACPI_FAILURE(status)) {
+		ACPI_VPRINT(sc->dev, acpi_device_get_parent_softc(sc->dev),
+		    "setting fan level: failed --%s\n",
+		    AcpiFormatException(status));
+		return (EIO);
+	}
+	if (sc->level != level) {
+		sc->level = level;
+		acpi_fan_bump_gen(sc);
+	}
+	return (0);
+}
+
+/* Append one record to the event trace, if tracing is on. */
+static void
+acpi_fan_trace(int unit, int type, int what, int32_t arg)
+{
+	struct acpi_fan_trace *t;
+
+	if (!atomic_load_int(&acpi_fan_trace_on))
+		return;
+
+	mtx_lock(&acpi_fan_trace_mtx);
+	if (acpi_fan_trace_buf != NULL) {
+		t = &acpi_fan_trace_buf[acpi_fan_trace_next %
+		    acpi_fan_trace_size];
+		t->time = sbttons(sbinuptime());
+		t->unit = unit;
+		t->type = type;
+		t->what = what;
+		t->arg = arg;
+		acpi_fan_trace_next++;
+	}
+	mtx_unlock(&acpi_fan_trace_mtx);
+}
+
+/*
+ * ACPI_SERIAL_BEGIN(fan) for the paths that evaluate AML under the lock.
+ * They all run one at a time, so a slow call shows up as time the
+ * others spent here.
+ */
+static void
+acpi_fan_serial_begin(void)
+{
+	uint64_t ns;
+	sbintime_t start;
+
+	start = sbinuptime();
+	ACPI_SERIAL_BEGIN(fan);
+	ns = sbttons(sbinuptime() - start);
+	mtx_lock(&acpi_fan_aml_mtx);
+	acpi_fan_aml_hdr.lock_count++;
+	acpi_fan_aml_hdr.lock_wait += ns;
+	if (ns > acpi_fan_aml_hdr.lock_wait_max)
+		acpi_fan_aml_hdr.lock_wait_max = ns;
+	mtx_unlock(&acpi_fan_aml_mtx);
+}
+
+/*
+ * Bracket an AML evaluation; unit is -1 for objects that are not fans.
+ *
+ * The debug.fail_point.acpi_fan_aml fail point stands in for a slow
+ * embedded controller: return(us) adds that much latency to the call,
+ * counted in the stats like real EC time.  Probabilities give the
+ * occasional long stall, e.g. '1%return(300000)->return(2000)'.  The
+ * pause only delays this driver; other ACPI consumers keep using the EC
+ * at full speed, so it cannot model contention with them.
+ */
+static sbintime_t
+acpi_fan_aml_begin(int unit, int method)
+{
+	sbintime_t start;
+
+	acpi_fan_trace(unit, ACPI_FAN_TR_AML_BEGIN, method, 0);
+	start = sbinuptime();
+	KFAIL_POINT_CODE(DEBUG_FP, acpi_fan_aml, 0,
+	    pause_sbt("fanaml", RETURN_VALUE * SBT_1US, 0, 0));
+	return (start);
+}
+
+static void
+acpi_fan_aml_end(int unit, int method, sbintime_t start, ACPI_STATUS status)
+{
+	struct acpi_fan_aml_stat *st;
+	uint64_t ns;
+	int b;
+
+	ns = sbttons(sbinuptime() - start);
+	b = MIN(flsll(ns / 1000), ACPI_FAN_AML_BUCKETS - 1);
+	acpi_fan_trace(unit, ACPI_FAN_TR_AML_END, method, status);
+
+	st = &acpi_fan_aml_stat[method];
+	mtx_lock(&acpi_fan_aml_mtx);
+	st->count++;
+	if (ACPI_FAILURE(status))
+		st->errors++;
+	st->total += ns;
+	if (ns > st->max)
+		st->max = ns;
+	st->hist[b]++;
+	mtx_unlock(&acpi_fan_aml_mtx);
+}
+
+/* Take a token for an evaluation of the given class; 0 if deferred. */
+static int
+acpi_fan_aml_admit(int class)
+{
+	struct acpi_fan_bucket *b;
+	sbintime_t now;
+	int64_t burst, need;
+	int ok, rate;
+
+	if (class == ACPI_FAN_AML_REC) {
+		b = &acpi_fan_rec_bucket;
+		rate = acpi_fan_aml_rec_rate;
+	} else {
+		b = &acpi_fan_bucket;
+		rate = acpi_fan_aml_rate;
+	}
+	if (rate <= 0)
+		return (1);
+
+	now = sbinuptime();
+	burst = (int64_t)MAX(acpi_fan_aml_burst, 1) * ACPI_FAN_TOKEN;
+	need = ACPI_FAN_TOKEN;
+	if (class == ACPI_FAN_AML_MON)
+		need += burst / 4;
+
+	mtx_lock(&acpi_fan_aml_mtx);
+	if (b->time == 0)
+		b->tokens = burst;
+	else
+		b->tokens += sbttous(now - b->time) * rate;
+	b->tokens = MIN(b->tokens, burst);
+	b->time = now;
+	ok = class == ACPI_FAN_AML_CRIT || b->tokens >= need;
+	if (ok)
+		b->tokens = MAX(b->tokens - ACPI_FAN_TOKEN, 0);
+	else
+		acpi_fan_aml_deferred[class]++;
+	mtx_unlock(&acpi_fan_aml_mtx);
+	return (ok);
+}
+
+static int
+acpi_fan_trace_enable_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_trace *buf;
+	int error, val;
+
+	val = atomic_load_int(&acpi_fan_trace_on);
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	/* Allocate before taking the mutex; the spare is freed below. */
+	buf = NULL;
+	if (val && acpi_fan_trace_size > 0)
+		buf = mallocarray(acpi_fan_trace_size, sizeof(*buf), M_ACPIFAN,
+		    M_WAITOK | M_ZERO);
+	mtx_lock(&acpi_fan_trace_mtx);
+	if (buf != NULL && acpi_fan_trace_buf == NULL) {
+		acpi_fan_trace_buf = buf;
+		acpi_fan_trace_next = 0;
+		buf = NULL;
+	}
+	atomic_store_int(&acpi_fan_trace_on, val && acpi_fan_trace_buf != NULL);
+	mtx_unlock(&acpi_fan_trace_mtx);
+	free(buf, M_ACPIFAN);
+	return (0);
+}
+
+/*
+ * Recorded events: acpi_fan_trace_hdr, then the records.  A record
+ * number written in the same request skips the records before it.
+ */
+static int
+acpi_fan_trace_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_trace_hdr hdr;
+	struct acpi_fan_trace *buf;
+	uint64_t since, first, i;
+	int error;
+
+	since = 0;
+	if (req->newptr) {
+		error = SYSCTL_IN(req, &since, sizeof(since));
+		if (error)
+			return (error);
+	}
+
+	buf = mallocarray(MAX(acpi_fan_trace_size, 1), sizeof(*buf),
+	    M_ACPIFAN, M_WAITOK);
+	bzero(&hdr, sizeof(hdr));
+	mtx_lock(&acpi_fan_trace_mtx);
+	hdr.next = acpi_fan_trace_next;
+	first = MAX(since, hdr.next > (uint64_t)acpi_fan_trace_size ?
+	    hdr.next - acpi_fan_trace_size : 0);
+	if (acpi_fan_trace_buf != NULL && first < hdr.next) {
+		hdr.lost = first - MIN(since, first);
+		for (i = first; i < hdr.next; i++)
+			buf[i - first] = acpi_fan_trace_buf[i %
+			    acpi_fan_trace_size];
+		hdr.count = hdr.next - first;
+	}
+	mtx_unlock(&acpi_fan_trace_mtx);
+
+	error = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+	if (error == 0)
+		error = SYSCTL_OUT(req, buf, hdr.count * sizeof(*buf));
+	free(buf, M_ACPIFAN);
+	return (error);
+}
+
+/* Per-method AML cost; any write resets it. */
+static int
+acpi_fan_aml_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_aml_hdr hdr;
+	struct acpi_fan_aml_stat *buf;
+	int error;
+
+	buf = mallocarray(ACPI_FAN_M_MAX, sizeof(*buf), M_ACPIFAN, M_WAITOK);
+	mtx_lock(&acpi_fan_aml_mtx);
+	hdr = acpi_fan_aml_hdr;
+	memcpy(buf, acpi_fan_aml_stat, sizeof(acpi_fan_aml_stat));
+	mtx_unlock(&acpi_fan_aml_mtx);
+
+	error = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+	if (error == 0)
+		error = SYSCTL_OUT(req, buf, ACPI_FAN_M_MAX * sizeof(*buf));
+	free(buf, M_ACPIFAN);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	mtx_lock(&acpi_fan_aml_mtx);
+	bzero(&acpi_fan_aml_hdr, sizeof(acpi_fan_aml_hdr));
+	bzero(acpi_fan_aml_stat, sizeof(acpi_fan_aml_stat));
+	mtx_unlock(&acpi_fan_aml_mtx);
+	return (0);
+}
+
+/*
+ * Configuration of all fans as one blob.  A read returns the current
+ * configuration; a write validates the whole blob first and then applies
+ * it in one pass with the lock held, touching AML only where a setting
+ * differs from the current one.
+ */
+static int
+acpi_fan_conf_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_conf_hdr hdr;
+	struct acpi_fan_conf *conf;
+	struct acpi_fan_softc *sc;
+	size_t len;
+	int error, i;
+
+	if (req->newptr == NULL) {
+		ACPI_SERIAL_BEGIN(fan);
+		bzero(&hdr, sizeof(hdr));
+		hdr.magic = ACPI_FAN_CONF_MAGIC;
+		hdr.version = ACPI_FAN_CONF_VERSION;
+		hdr.count = acpi_fan_count;
+		hdr.flags = ACPI_FAN_CONF_G_ALL;
+		hdr.sample_interval = acpi_fan_sample_ms;
+		hdr.recorder_interval = acpi_fan_rec_ms;
+		hdr.stall_samples = acpi_fan_stall_samples;
+		hdr.crit_margin = acpi_fan_crit_margin;
+		conf = mallocarray(MAX(hdr.count, 1), sizeof(*conf), M_ACPIFAN,
+		    M_WAITOK | M_ZERO);
+		i = 0;
+		TAILQ_FOREACH(sc, &acpi_fan_list, link) {
+			conf[i].unit = device_get_unit(sc->dev);
+			conf[i].flags = ACPI_FAN_CONF_POWERED;
+			conf[i].powered = sc->fan_powered;
+			/* An unpowered fan keeps its level; it is not in force. */
+			if (sc->acpi4 && sc->fan_powered && sc->level >= 0) {
+				conf[i].flags |= ACPI_FAN_CONF_LEVEL;
+				conf[i].level = sc->level;
+			}
+			i++;
+		}
+		ACPI_SERIAL_END(fan);
+
+		error = SYSCTL_OUT(req, &hdr, sizeof(hdr));
+		if (error == 0)
+			error = SYSCTL_OUT(req, conf, hdr.count * sizeof(*conf));
+		free(conf, M_ACPIFAN);
+		return (error);
+	}
+
+	error = SYSCTL_IN(req, &hdr, sizeof(hdr));
+	if (error)
+		return (error);
+	if (hdr.magic != ACPI_FAN_CONF_MAGIC ||
+	    hdr.version != ACPI_FAN_CONF_VERSION ||
+	    hdr.count > ACPI_FAN_CONF_MAXFANS)
+		return (EINVAL);
+	len = hdr.count * sizeof(*conf);
+	if (req->newlen - req->newidx != len)
+		return (EINVAL);
+	conf = mallocarray(MAX(hdr.count, 1), sizeof(*conf), M_ACPIFAN,
+	    M_WAITOK);
+	error = SYSCTL_IN(req, conf, len);
+	if (error == 0) {
+		acpi_fan_serial_begin();
+		error = acpi_fan_conf_check(&hdr, conf);
+		if (error == 0)
+			error = acpi_fan_conf_apply(&hdr, conf);
+		ACPI_SERIAL_END(fan);
+	}
+	free(conf, M_ACPIFAN);
+	return (error);
+}
+
+/* Reject the whole blob if any part of it is invalid. */
+static int
+acpi_fan_conf_check(const struct acpi_fan_conf_hdr *hdr,
+    const struct acpi_fan_conf *conf)
+{
+	struct acpi_fan_softc *sc;
+	u_int i, j;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if ((hdr->flags & ~ACPI_FAN_CONF_G_ALL) != 0)
+		return (EINVAL);
+	if (((hdr->flags & ACPI_FAN_CONF_G_SAMPLE) && hdr->sample_interval < 0) ||
+	    ((hdr->flags & ACPI_FAN_CONF_G_RECORDER) &&
+	    hdr->recorder_interval < 0) ||
+	    ((hdr->flags & ACPI_FAN_CONF_G_STALL) && hdr->stall_samples < 1))
+		return (EINVAL);
+
+	for (i = 0; i < hdr->count; i++) {
+		if ((conf[i].flags & ~ACPI_FAN_CONF_ALL) != 0)
+			return (EINVAL);
+		for (j = 0; j < i; j++)
+			if (conf[j].unit == conf[i].unit)
+				return (EINVAL);
+		sc = acpi_fan_find(conf[i].unit);
+		if (sc == NULL)
+			return (ENOENT);
+		if ((conf[i].flags & ACPI_FAN_CONF_POWERED) &&
+		    conf[i].powered != 0 && conf[i].powered != 1)
+			return (EINVAL);
+		if ((conf[i].flags & ACPI_FAN_CONF_LEVEL) &&
+		    (!sc->acpi4 || conf[i].level < 0 || conf[i].level > 100))
+			return (EINVAL);
+		if ((conf[i].flags & ACPI_FAN_CONF_ALL) == ACPI_FAN_CONF_ALL &&
+		    conf[i].powered == 0 && conf[i].level > 0)
+			return (EINVAL);
+	}
+	return (0);
+}
+
+/*
+ * Apply a checked blob.  Only settings that differ cause AML writes.
+ * A failing write does not stop the others; the first error is returned.
+ */
+static int
+acpi_fan_conf_apply(const struct acpi_fan_conf_hdr *hdr,
+    const struct acpi_fan_conf *conf)
+{
+	struct acpi_fan_softc *sc;
+	int error, powered;
+	u_int i;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (hdr->flags & ACPI_FAN_CONF_G_SAMPLE)
+		acpi_fan_sample_ms = hdr->sample_interval;
+	if (hdr->flags & ACPI_FAN_CONF_G_RECORDER)
+		acpi_fan_rec_ms = hdr->recorder_interval;
+	if (hdr->flags & ACPI_FAN_CONF_G_STALL)
+		acpi_fan_stall_samples = hdr->stall_samples;
+	if (hdr->flags & ACPI_FAN_CONF_G_CRIT)
+		acpi_fan_crit_margin = hdr->crit_margin;
+	if (hdr->flags & (ACPI_FAN_CONF_G_SAMPLE | ACPI_FAN_CONF_G_RECORDER))
+		acpi_fan_arm();
+
+	error = 0;
+	for (i = 0; i < hdr->count; i++) {
+		sc = acpi_fan_find(conf[i].unit);
+		powered = sc->fan_powered;
+		if (conf[i].flags & ACPI_FAN_CONF_POWERED)
+			powered = conf[i].powered;
+		/* Like the level sysctl, a level implies power. */
+		if ((conf[i].flags & ACPI_FAN_CONF_LEVEL) && conf[i].level > 0)
+			powered = 1;
+		if (powered != sc->fan_powered &&
+		    acpi_fan_set_power(sc->dev, powered) != 0 && error == 0)
+			error = EIO;
+		if ((conf[i].flags & ACPI_FAN_CONF_LEVEL) &&
+		    conf[i].level != sc->level &&
+		    acpi_fan_set_level(sc, conf[i].level) != 0 && error == 0)
+			error = EIO;
+	}
+	return (error);
+}
+
+static struct acpi_fan_softc *
+acpi_fan_find(int unit)
+{
+	struct acpi_fan_softc *sc;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	TAILQ_FOREACH(sc, &acpi_fan_list, link)
+		if (device_get_unit(sc->dev) == unit)
+			return (sc);
+	return (NULL);
+}
+
+/*
+ * Bind a fan to the thermal zones that list it in one of their _ALx
+ * packages.  hint.fan.N.tz names a single zone instead.
+ */
+static void
+acpi_fan_tz_bind(struct acpi_fan_softc *sc)
+{
+	ACPI_BUFFER buffer;
+	ACPI_OBJECT *pkg;
+	ACPI_STATUS status;
+	ACPI_HANDLE fan, h;
+	const char *path;
+	char name[5];
+	sbintime_t t;
+	u_int k;
+	int found, i, j, unit;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	unit = device_get_unit(sc->dev);
+	sc->ntz = 0;
+	if (resource_string_value(device_get_name(sc->dev), unit, "tz",
+	    &path) == 0) {
+		if (ACPI_SUCCESS(AcpiGetHandle(NULL, __DECONST(char *, path), &h))) {
+			sc->tz_ac[sc->ntz] = -1;
+			sc->tz[sc->ntz++] = h;
+		} else
+			device_printf(sc->dev, "no thermal zone %s\n", path);
+		acpi_fan_tz_trips(sc);
+		return;
+	}
+
+	/*
+	 * _AC0 is the hottest trip, so the fan is due from the highest
+	 * _ALx that lists it.
+	 */
+	fan = acpi_get_handle(sc->dev);
+	for (i = 0; i < acpi_fan_ntz && sc->ntz < ACPI_FAN_FANTZ; i++) {
+		found = -1;
+		for (j = 0; j < 10; j++) {
+			snprintf(name, sizeof(name), "_AL%d", j);
+			buffer.Length = ACPI_ALLOCATE_BUFFER;
+			buffer.Pointer = NULL;
+			t = acpi_fan_aml_begin(unit, ACPI_FAN_M_ALX);
+			status = AcpiEvaluateObject(acpi_fan_tz[i], name, NULL,
+			    &buffer);
+			acpi_fan_aml_end(unit, ACPI_FAN_M_ALX, t, status);
+			if (ACPI_FAILURE(status))
+				continue;
+			pkg = buffer.Pointer;
+			if (ACPI_PKG_VALID(pkg, 1))
+				for (k = 0; k < pkg->Package.Count; k++)
+					if (acpi_GetReference(NULL,
+					    &pkg->Package.Elements[k]) == fan)
+						found = j;
+			AcpiOsFree(buffer.Pointer);
+		}
+		if (found >= 0) {
+			sc->tz_ac[sc->ntz] = found;
+			sc->tz[sc->ntz++] = acpi_fan_tz[i];
+		}
+	}
+	acpi_fan_tz_trips(sc);
+}
+
+/* Read the active trip point of the fan and _CRT of each of its zones. */
+static void
+acpi_fan_tz_trips(struct acpi_fan_softc *sc)
+{
+	ACPI_STATUS status;
+	sbintime_t t;
+	UINT32 val;
+	char name[5];
+	int i, unit;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	unit = device_get_unit(sc->dev);
+	for (i = 0; i < sc->ntz; i++) {
+		sc->tz_trip[i] = -1;
+		if (sc->tz_ac[i] >= 0) {
+			snprintf(name, sizeof(name), "_AC%d", sc->tz_ac[i]);
+			t = acpi_fan_aml_begin(unit, ACPI_FAN_M_ACX);
+			status = acpi_GetInteger(sc->tz[i], name, &val);
+			acpi_fan_aml_end(unit, ACPI_FAN_M_ACX, t, status);
+			if (ACPI_SUCCESS(status))
+				sc->tz_trip[i] = val;
+		}
+		t = acpi_fan_aml_begin(unit, ACPI_FAN_M_CRT);
+		status = acpi_GetInteger(sc->tz[i], "_CRT", &val);
+		acpi_fan_aml_end(unit, ACPI_FAN_M_CRT, t, status);
+		sc->tz_crt[i] = ACPI_SUCCESS(status) ? (int)val : -1;
+	}
+}
+
+/*
+ * Refresh tz_temp[i] and tz_time[i] of a fan from the _TMP cache, or by
+ * evaluating _TMP if the budget of the class allows.  Out of budget the
+ * last reading of the zone stays.
+ */
+static void
+acpi_fan_zone_temp(struct acpi_fan_softc *sc, int i, int class,
+    sbintime_t now)
+{
+	struct acpi_fan_tmpc *c;
+	ACPI_STATUS status;
+	sbintime_t t;
+	UINT32 tmp;
+	int j, unit;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	/* Look for the zone in the cache, else pick the oldest slot. */
+	c = &acpi_fan_tmpc[0];
+	for (j = 0; j < ACPI_FAN_TMPC; j++) {
+		if (acpi_fan_tmpc[j].h == sc->tz[i]) {
+			c = &acpi_fan_tmpc[j];
+			break;
+		}
+		if (acpi_fan_tmpc[j].time < c->time)
+			c = &acpi_fan_tmpc[j];
+	}
+	if (c->h == sc->tz[i] && now - c->time < acpi_fan_tmpc_ms * SBT_1MS) {
+		acpi_fan_tmpc_hits++;
+		sc->tz_temp[i] = c->temp;
+		sc->tz_time[i] = c->time;
+	} else if (acpi_fan_aml_admit(class)) {
+		acpi_fan_tmpc_misses++;
+		unit = device_get_unit(sc->dev);
+		t = acpi_fan_aml_begin(unit, ACPI_FAN_M_TMP);
+		status = acpi_GetInteger(sc->tz[i], "_TMP", &tmp);
+		acpi_fan_aml_end(unit, ACPI_FAN_M_TMP, t, status);
+		sc->tz_temp[i] = ACPI_SUCCESS(status) ? (int)tmp : -1;
+		sc->tz_time[i] = now;
+		c->h = sc->tz[i];
+		c->temp = sc->tz_temp[i];
+		c->time = now;
+	}
+}
+
+/* Read the temperature of the hottest zone cooled by a fan. */
+static void
+acpi_fan_read_temp(struct acpi_fan_softc *sc, int class)
+{
+	sbintime_t now;
+	int hot, i, temp;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	temp = -1;
+	hot = 0;
+	now = sbinuptime();
+	sc->temp_time = now;
+	sc->temp_reused = 0;
+	for (i = 0; i < sc->ntz; i++) {
+		acpi_fan_zone_temp(sc, i, class, now);
+		if (sc->tz_time[i] != now) {
+			sc->temp_reused = 1;
+			sc->temp_time = MIN(sc->temp_time, sc->tz_time[i]);
+		}
+		if (sc->tz_temp[i] > temp)
+			temp = sc->tz_temp[i];
+		if (sc->tz_temp[i] >= 0 &&
+		    ((sc->tz_trip[i] > 0 && sc->tz_temp[i] >= sc->tz_trip[i]) ||
+		    (sc->tz_crt[i] > 0 &&
+		    sc->tz_temp[i] >= sc->tz_crt[i] - acpi_fan_crit_margin)))
+			hot = 1;
+	}
+	sc->temp = temp;
+	sc->hot = hot;
+}
+
+/* Estimated power of a fan at a level, in mW; 0 if unknown. */
+static int
+acpi_fan_power(struct acpi_fan_softc *sc, int level)
+{
+	int best, i, power;
+
+	if (level <= 0)
+		return (0);
+
+	/* The cheapest _FPS state at or above the level. */
+	best = -1;
+	power = 0;
+	for (i = 0; i < sc->max_fps; i++) {
+		if (sc->fps[i].power < 0 || sc->fps[i].control < level)
+			continue;
+		if (best < 0 || sc->fps[i].control < best) {
+			best = sc->fps[i].control;
+			power = sc->fps[i].power;
+		}
+	}
+	if (best >= 0)
+		return (power);
+
+	level = MIN(level, 100);
+	return ((int64_t)sc->max_power * level * level * level / 1000000);
+}
+
+/* The level a fan runs at now, as far as the driver knows; 0 if off. */
+static int
+acpi_fan_cur_level(struct acpi_fan_softc *sc)
+{
+
+	if (!sc->fan_powered)
+		return (0);
+	return (sc->level >= 0 ? sc->level : MAX(sc->fst.control, 0));
+}
+
+/* Apply the coordinator's demand offset while its lease lasts. */
+static int
+acpi_fan_offset(struct acpi_fan_softc *sc, int level)
+{
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (acpi_fan_off == 0 || sbinuptime() >= acpi_fan_off_until)
+		return (level);
+	/* Never take cooling away from a hot zone. */
+	if (acpi_fan_off < 0 && (sc->hot || sc->fc_above))
+		return (level);
+	return (MIN(MAX(level + acpi_fan_off, 0), 100));
+}
+
+/* Lowest level the power cap may hold a fan at for a demand. */
+static int
+acpi_fan_cap_floor(struct acpi_fan_softc *sc, int level)
+{
+
+	if (sc->hot)
+		return (level);
+	return (MIN(level, MAX(acpi_fan_cap_min, 0)));
+}
+
+/*
+ * Lower a demanded level until it fits the power cap.  The cap is
+ * shared out by demand in sweep order, which is priority order: a fan
+ * gets the cap less what the fans before it were granted this sweep
+ * and less the floors of the fans after it, so a fan ramping up takes
+ * budget from lower priority fans rather than the other way round.
+ * Fans without a demand keep what they draw now.  Floors are always
+ * granted, even past the cap.  Between the write of one fan and the
+ * cut of a later one in the same sweep the sum can briefly be above
+ * the cap.
+ */
+static int
+acpi_fan_cap(struct acpi_fan_softc *sc, int level)
+{
+	struct acpi_fan_softc *o;
+	int budget, capped, low, want;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	sc->cap_demand = sc->cap_grant = level;
+	if (acpi_fan_power_cap <= 0) {
+		sc->capped = 0;
+		return (level);
+	}
+
+	budget = acpi_fan_power_cap;
+	TAILQ_FOREACH(o, &acpi_fan_list, link) {
+		if (o == sc)
+			continue;
+		if (o->cap_demand < 0)
+			budget -= acpi_fan_power(o, acpi_fan_cur_level(o));
+		else if (o->cap_rank < sc->cap_rank)
+			budget -= acpi_fan_power(o, o->cap_grant);
+		else
+			budget -= acpi_fan_power(o,
+			    acpi_fan_cap_floor(o, o->cap_demand));
+	}
+
+	want = level;
+	low = acpi_fan_cap_floor(sc, level);
+	while (level > low && acpi_fan_power(sc, level) > MAX(budget, 0))
+		level--;
+	sc->cap_grant = level;
+
+	capped = level < want;
+	if (capped != sc->capped) {
+		sc->capped = capped;
+		acpi_fan_event(sc, ACPI_FAN_EV_POWERCAP,
+		    "capped=%d demand=%d level=%d budget=%d", capped, want,
+		    level, budget);
+	}
+	return (level);
+}
+
+/* Drive a fan towards the level its control mode asks for. */
+static void
+acpi_fan_control(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+	int level;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (sc->ctl_mode == ACPI_FAN_CTL_MPC)
+		acpi_fan_mpc_update(sc, s);
+	level = acpi_fan_demand(sc);
+	if (level >= 0) {
+		level = acpi_fan_offset(sc, level);
+		level = acpi_fan_cap(sc, level);
+	} else
+		sc->cap_demand = -1;
+	/* Back off before taking a token, so a deferred write costs none. */
+	if (level >= 0 && level != sc->level && !acpi_fan_owner_defer(sc) &&
+	    acpi_fan_aml_admit(level > sc->level ? ACPI_FAN_AML_CRIT :
+	    ACPI_FAN_AML_CTL)) {
+		acpi_fan_owner_wrote(sc);
+		if (level == 0 || sc->fan_powered ||
+		    acpi_fan_set_power(sc->dev, 1) == 0)
+			acpi_fan_set_level(sc, level);
+	}
+
+	/* Remember the regressor for the next model update. */
+	if (sc->ctl_mode == ACPI_FAN_CTL_MPC && sc->temp >= 0) {
+		sc->mpc.phi[0] = (int64_t)(sc->temp - 2732) * ACPI_FAN_QONE /
+		    1280;
+		sc->mpc.phi[1] = (int64_t)MAX(sc->level, 0) * ACPI_FAN_QONE /
+		    128;
+		sc->mpc.phi[2] = (int64_t)averunnable.ldavg[0] * ACPI_FAN_QONE /
+		    (16 * averunnable.fscale);
+		sc->mpc.phi[3] = ACPI_FAN_QONE;
+		sc->mpc.have_phi = 1;
+	} else
+		sc->mpc.have_phi = 0;
+}
+
+/* Level wanted by the control mode of a fan, -1 for no opinion. */
+static int
+acpi_fan_demand(struct acpi_fan_softc *sc)
+{
+
+	switch (sc->ctl_mode) {
+	case ACPI_FAN_CTL_PROFILE:
+		return (acpi_fan_profile_demand(sc));
+	case ACPI_FAN_CTL_MPC:
+		return (acpi_fan_mpc_demand(sc));
+	case ACPI_FAN_CTL_POLICY:
+		return (acpi_fan_pol_demand(sc));
+	default:
+		return (-1);
+	}
+}
+
+static int
+acpi_fan_profile_demand(struct acpi_fan_softc *sc)
+{
+	struct acpi_fan_profile *p;
+	struct acpi_fan_prof_lut *lut;
+	int level, unit, deg;
+
+	p = atomic_load_acq_ptr(&acpi_fan_profile_active);
+	unit = device_get_unit(sc->dev);
+	if (p == NULL || sc->temp < 0 || unit >= ACPI_FAN_CONF_MAXFANS ||
+	    p->slot[unit] == 0)
+		return (-1);
+	lut = &p->lut[p->slot[unit] - 1];
+
+	deg = (sc->temp - 2732) / 10;
+	level = lut->level[MIN(MAX(deg, 0), ACPI_FAN_LUT_SIZE - 1)];
+	level = MIN(MAX(level, lut->min_level), lut->max_level);
+	if (lut->ramp > 0 && sc->level >= 0)
+		level = MIN(MAX(level, sc->level - lut->ramp),
+		    sc->level + lut->ramp);
+	return (level);
+}
+
+/*
+ * Compile a profile blob into lookup tables, interpolating linearly
+ * between the curve points.  Returns NULL if the blob is invalid.
+ */
+static struct acpi_fan_profile *
+acpi_fan_profile_compile(const struct acpi_fan_prof_hdr *hdr,
+    const struct acpi_fan_prof_fan *pf)
+{
+	struct acpi_fan_profile *p;
+	struct acpi_fan_prof_lut *lut;
+	const struct acpi_fan_prof_point *a, *b;
+	int deg, i, j;
+
+	for (i = 0; i < hdr->count; i++) {
+		if (pf[i].unit < 0 || pf[i].unit >= ACPI_FAN_CONF_MAXFANS ||
+		    pf[i].npoints < 1 || pf[i].npoints > ACPI_FAN_PROF_MAXPTS ||
+		    pf[i].min_level < 0 || pf[i].max_level > 100 ||
+		    pf[i].min_level > pf[i].max_level || pf[i].ramp < 0)
+			return (NULL);
+		/* Points outside the table would overflow the interpolation. */
+		for (j = 0; j < pf[i].npoints; j++)
+			if (pf[i].point[j].level < 0 ||
+			    pf[i].point[j].level > 100 ||
+			    pf[i].point[j].temp < 0 ||
+			    pf[i].point[j].temp >= ACPI_FAN_LUT_SIZE ||
+			    (j > 0 && pf[i].point[j].temp <=
+			    pf[i].point[j - 1].temp))
+				return (NULL);
+	}
+
+	p = malloc(sizeof(*p) + hdr->count * sizeof(p->lut[0]), M_ACPIFAN,
+	    M_WAITOK | M_ZERO);
+	strlcpy(p->name, hdr->name, sizeof(p->name));
+	p->nlut = hdr->count;
+	for (i = 0; i < hdr->count; i++) {
+		if (p->slot[pf[i].unit] != 0) {
+			free(p, M_ACPIFAN);
+			return (NULL);
+		}
+		p->slot[pf[i].unit] = i + 1;
+		lut = &p->lut[i];
+		lut->min_level = pf[i].min_level;
+		lut->max_level = pf[i].max_level;
+		lut->ramp = pf[i].ramp;
+		for (deg = 0, j = 0; deg < ACPI_FAN_LUT_SIZE; deg++) {
+			while (j < pf[i].npoints - 1 &&
+			    pf[i].point[j + 1].temp <= deg)
+				j++;
+			a = &pf[i].point[j];
+			b = j < pf[i].npoints - 1 ? &pf[i].point[j + 1] : a;
+			if (deg <= a->temp || a == b)
+				lut->level[deg] = a->level;
+			else
+				lut->level[deg] = a->level +
+				    (b->level - a->level) * (deg - a->temp) /
+				    (b->temp - a->temp);
+		}
+	}
+	return (p);
+}
+
+/* Load a profile; one with the same name is replaced unless active. */
+static int
+acpi_fan_profile_load_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_prof_hdr hdr;
+	struct acpi_fan_prof_fan *pf;
+	struct acpi_fan_profile *p, *old;
+	size_t len;
+	int error, i, slot;
+
+	if (req->newptr == NULL)
+		return (0);
+	error = SYSCTL_IN(req, &hdr, sizeof(hdr));
+	if (error)
+		return (error);
+	hdr.name[sizeof(hdr.name) - 1] = '\0';
+	if (hdr.magic != ACPI_FAN_PROF_MAGIC ||
+	    hdr.version != ACPI_FAN_PROF_VERSION || hdr.name[0] == '\0' ||
+	    hdr.count > ACPI_FAN_CONF_MAXFANS)
+		return (EINVAL);
+	len = hdr.count * sizeof(*pf);
+	if (req->newlen - req->newidx != len)
+		return (EINVAL);
+	pf = mallocarray(MAX(hdr.count, 1), sizeof(*pf), M_ACPIFAN, M_WAITOK);
+	error = SYSCTL_IN(req, pf, len);
+	p = NULL;
+	if (error == 0 && (p = acpi_fan_profile_compile(&hdr, pf)) == NULL)
+		error = EINVAL;
+	free(pf, M_ACPIFAN);
+	if (error)
+		return (error);
+
+	old = NULL;
+	ACPI_SERIAL_BEGIN(fan);
+	slot = -1;
+	for (i = 0; i < ACPI_FAN_PROF_MAX; i++) {
+		if (acpi_fan_profiles[i] == NULL) {
+			if (slot < 0)
+				slot = i;
+		} else if (strcmp(acpi_fan_profiles[i]->name, p->name) == 0) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot < 0)
+		error = ENOSPC;
+	else if (acpi_fan_profiles[slot] != NULL &&
+	    acpi_fan_profiles[slot] == acpi_fan_profile_active)
+		error = EBUSY;
+	else {
+		old = acpi_fan_profiles[slot];
+		acpi_fan_profiles[slot] = p;
+		p = NULL;
+	}
+	ACPI_SERIAL_END(fan);
+	free(old, M_ACPIFAN);
+	free(p, M_ACPIFAN);
+	return (error);
+}
+
+/* Select the active profile by name. */
+static int
+acpi_fan_profile_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_profile *p;
+	char name[ACPI_FAN_PROF_NAMELEN];
+	int error, i;
+
+	ACPI_SERIAL_BEGIN(fan);
+	p = acpi_fan_profile_active;
+	strlcpy(name, p != NULL ? p->name : "", sizeof(name));
+	ACPI_SERIAL_END(fan);
+
+	error = sysctl_handle_string(oidp, name, sizeof(name), req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	ACPI_SERIAL_BEGIN(fan);
+	p = NULL;
+	error = name[0] == '\0' ? 0 : ENOENT;
+	for (i = 0; i < ACPI_FAN_PROF_MAX && error != 0; i++)
+		if (acpi_fan_profiles[i] != NULL &&
+		    strcmp(acpi_fan_profiles[i]->name, name) == 0) {
+			p = acpi_fan_profiles[i];
+			error = 0;
+		}
+	if (error == 0)
+		atomic_store_rel_ptr(&acpi_fan_profile_active, p);
+	ACPI_SERIAL_END(fan);
+	return (error);
+}
+
+static int
+acpi_fan_profiles_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct sbuf sb;
+	int error, i;
+
+	sbuf_new_for_sysctl(&sb, NULL, 64, req);
+	ACPI_SERIAL_BEGIN(fan);
+	for (i = 0; i < ACPI_FAN_PROF_MAX; i++)
+		if (acpi_fan_profiles[i] != NULL)
+			sbuf_printf(&sb, "%s%s", sbuf_len(&sb) ? " " : "",
+			    acpi_fan_profiles[i]->name);
+	ACPI_SERIAL_END(fan);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+static int
+acpi_fan_ctl_mode_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	int error, val;
+
+	sc = (struct acpi_fan_softc *)arg1;
+	ACPI_SERIAL_BEGIN(fan);
+	val = sc->ctl_mode;
+	ACPI_SERIAL_END(fan);
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val >= ACPI_FAN_CTL_MAX ||
+	    (val != ACPI_FAN_CTL_MANUAL && !sc->acpi4))
+		return (EINVAL);
+
+	ACPI_SERIAL_BEGIN(fan);
+	if (val == ACPI_FAN_CTL_MPC && sc->ctl_mode != val)
+		acpi_fan_mpc_reset(&sc->mpc);
+	sc->ctl_mode = val;
+	/* Take the fan back from firmware, see acpi_fan_owner. */
+	sc->own_miss = 0;
+	sc->owner = ACPI_FAN_OWNER_OS;
+	sc->own_backoff = sc->own_skip = 0;
+	ACPI_SERIAL_END(fan);
+	return (0);
+}
+
+static void
+acpi_fan_mpc_reset(struct acpi_fan_mpc *m)
+{
+	int i;
+
+	bzero(m, sizeof(*m));
+	for (i = 0; i < ACPI_FAN_MPC_N; i++)
+		m->p[i][i] = ACPI_FAN_MPC_P0;
+	/* Start from "temperature stays where it is". */
+	m->theta[0] = ACPI_FAN_QONE;
+}
+
+/*
+ * One recursive least squares step with the sample just taken, skipped
+ * like acpi_fan_resist when its temperature is older than the sample.
+ */
+static void
+acpi_fan_mpc_update(struct acpi_fan_softc *sc,
+    const struct acpi_fan_sample *s)
+{
+	struct acpi_fan_mpc *m;
+	int64_t pphi[ACPI_FAN_MPC_N], k[ACPI_FAN_MPC_N];
+	int64_t denom, err, y, trace;
+	int i, j;
+
+	m = &sc->mpc;
+	if (!m->have_phi || sc->temp < 0 || s->temp_age > ACPI_FAN_SKEW_MS)
+		return;
+
+	y = (int64_t)(sc->temp - 2732) * ACPI_FAN_QONE / 1280;
+	err = y;
+	for (i = 0; i < ACPI_FAN_MPC_N; i++)
+		err -= (m->theta[i] * m->phi[i]) >> ACPI_FAN_Q;
+
+	denom = ACPI_FAN_MPC_LAMBDA;
+	for (i = 0; i < ACPI_FAN_MPC_N; i++) {
+		pphi[i] = 0;
+		for (j = 0; j < ACPI_FAN_MPC_N; j++)
+			pphi[i] += (m->p[i][j] * m->phi[j]) >> ACPI_FAN_Q;
+		denom += (m->phi[i] * pphi[i]) >> ACPI_FAN_Q;
+	}
+	if (denom <= 0)
+		return;
+
+	for (i = 0; i < ACPI_FAN_MPC_N; i++) {
+		k[i] = pphi[i] * ACPI_FAN_QONE / denom;
+		m->theta[i] += (k[i] * err) >> ACPI_FAN_Q;
+	}
+	trace = 0;
+	for (i = 0; i < ACPI_FAN_MPC_N; i++) {
+		for (j = 0; j < ACPI_FAN_MPC_N; j++) {
+			m->p[i][j] -= (k[i] * pphi[j]) >> ACPI_FAN_Q;
+			m->p[i][j] = m->p[i][j] * ACPI_FAN_QONE /
+			    ACPI_FAN_MPC_LAMBDA;
+		}
+		trace += m->p[i][i];
+	}
+
+	/* Without excitation P grows without bound; start over. */
+	if (trace > ACPI_FAN_MPC_N * ACPI_FAN_MPC_PMAX || trace <= 0) {
+		for (i = 0; i < ACPI_FAN_MPC_N; i++)
+			for (j = 0; j < ACPI_FAN_MPC_N; j++)
+				m->p[i][j] = i == j ? ACPI_FAN_MPC_P0 : 0;
+	}
+	m->updates++;
+}
+
+/*
+ * Lowest level whose predicted temperature stays under the limit for
+ * hw.acpi.fan.mpc_horizon samples.  Until the model has seen enough
+ * samples, or if it claims more airflow heats the zone, the active
+ * profile decides.
+ */
+static int
+acpi_fan_mpc_demand(struct acpi_fan_softc *sc)
+{
+	struct acpi_fan_mpc *m;
+	int64_t limit, load, t, u;
+	int h, level, step;
+
+	m = &sc->mpc;
+	if (sc->temp < 0 || m->updates < ACPI_FAN_MPC_MINUPD ||
+	    m->theta[1] >= 0)
+		return (acpi_fan_profile_demand(sc));
+
+	limit = (int64_t)(sc->mpc_limit - 2732) * ACPI_FAN_QONE / 1280;
+	load = (int64_t)averunnable.ldavg[0] * ACPI_FAN_QONE /
+	    (16 * averunnable.fscale);
+	step = sc->fif.stepsize > 0 ? sc->fif.stepsize : 5;
+	for (level = 0; level < 100; level += step) {
+		u = (int64_t)level * ACPI_FAN_QONE / 128;
+		t = (int64_t)(sc->temp - 2732) * ACPI_FAN_QONE / 1280;
+		for (h = 0; h < acpi_fan_mpc_horizon; h++) {
+			t = ((m->theta[0] * t + m->theta[1] * u +
+			    m->theta[2] * load) >> ACPI_FAN_Q) + m->theta[3];
+			if (t > limit)
+				break;
+		}
+		if (h == acpi_fan_mpc_horizon)
+			return (level);
+	}
+	return (100);
+}
+
+static int
+acpi_fan_mpc_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	char buf[80];
+	int64_t th[ACPI_FAN_MPC_N];
+	u_int updates;
+	int i;
+
+	sc = (struct acpi_fan_softc *)arg1;
+	ACPI_SERIAL_BEGIN(fan);
+	for (i = 0; i < ACPI_FAN_MPC_N; i++)
+		th[i] = sc->mpc.theta[i] * 1000 / ACPI_FAN_QONE;
+	updates = sc->mpc.updates;
+	ACPI_SERIAL_END(fan);
+
+	snprintf(buf, sizeof(buf), "%jd %jd %jd %jd %u", (intmax_t)th[0],
+	    (intmax_t)th[1], (intmax_t)th[2], (intmax_t)th[3], updates);
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+
+/*
+ * Short-horizon forecast: the least-squares trend of the last
+ * forecast_window temperatures, extrapolated forecast_horizon seconds.
+ * Also updates the cooling headroom and raises ACPI_FAN_EV_FORECAST when
+ * the forecast crosses forecast_threshold.
+ */
+static void
+acpi_fan_forecast(struct acpi_fan_softc *sc)
+{
+	int64_t mt, mx, sxx, sxy, dt;
+	u_int i, n, first, k, window;
+	int max;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	max = acpi_fan_max_speed(sc);
+	if (max > 0)
+		sc->headroom = MAX(max - sc->fst.speed, 0) * 100 / max;
+	else
+		sc->headroom = 100 - MIN(MAX(sc->fst.control, 0), 100);
+
+	if (sc->temp < 0) {
+		sc->fc_len = 0;
+		sc->forecast = -1;
+		return;
+	}
+	/* Fit against when _TMP was read; a reading is used only once. */
+	window = MIN(MAX(acpi_fan_fc_window, 2), ACPI_FAN_FC_MAX);
+	if (sc->fc_len == 0 || sc->fc_time[(sc->fc_head + ACPI_FAN_FC_MAX - 1) %
+	    ACPI_FAN_FC_MAX] != (uint64_t)sbttoms(sc->temp_time)) {
+		sc->fc_temp[sc->fc_head] = sc->temp;
+		sc->fc_time[sc->fc_head] = sbttoms(sc->temp_time);
+		sc->fc_head = (sc->fc_head + 1) % ACPI_FAN_FC_MAX;
+		if (sc->fc_len < ACPI_FAN_FC_MAX)
+			sc->fc_len++;
+	}
+
+	n = MIN(sc->fc_len, window);
+	if (n < 2) {
+		sc->forecast = sc->temp;
+		return;
+	}
+	first = (sc->fc_head + ACPI_FAN_FC_MAX - n) % ACPI_FAN_FC_MAX;
+	mt = mx = 0;
+	for (i = 0; i < n; i++) {
+		k = (first + i) % ACPI_FAN_FC_MAX;
+		mt += sc->fc_time[k] - sc->fc_time[first];
+		mx += sc->fc_temp[k];
+	}
+	mt /= n;
+	mx /= n;
+	sxx = sxy = 0;
+	for (i = 0; i < n; i++) {
+		k = (first + i) % ACPI_FAN_FC_MAX;
+		dt = sc->fc_time[k] - sc->fc_time[first] - mt;
+		sxx += dt * dt;
+		sxy += dt * (sc->fc_temp[k] - mx);
+	}
+	if (sxx == 0)
+		sc->forecast = sc->temp;
+	else
+		sc->forecast = MAX(sc->temp + sxy *
+		    (int64_t)acpi_fan_fc_horizon * 1000 / sxx, 0);
+
+	if (acpi_fan_fc_threshold > 0 &&
+	    (sc->forecast >= acpi_fan_fc_threshold) != sc->fc_above) {
+		sc->fc_above = !sc->fc_above;
+		acpi_fan_event(sc, ACPI_FAN_EV_FORECAST, "forecast=%d headroom=%d",
+		    sc->forecast, sc->headroom);
+	}
+}
+
+/*
+ * Health of a fan from its latest sample.  Speed is only compared with
+ * _FPS once the control value has held for a sample, so a fan still
+ * spinning up is not reported slow.
+ */
+static void
+acpi_fan_health(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+	ACPI_STATUS status;
+	sbintime_t t;
+	UINT32 sta;
+	u_int n, reasons;
+	int expect, r, score, state, unit;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	/* A fan rarely goes away, so _STA is only checked now and then. */
+	reasons = 0;
+	if (sc->sta_wait > 0)
+		sc->sta_wait--;
+	else if (acpi_fan_aml_admit(ACPI_FAN_AML_MON)) {
+		sc->sta_wait = ACPI_FAN_STA_SWEEPS - 1;
+		unit = device_get_unit(sc->dev);
+		t = acpi_fan_aml_begin(unit, ACPI_FAN_M_STA);
+		status = acpi_GetInteger(acpi_get_handle(sc->dev), "_STA", &sta);
+		acpi_fan_aml_end(unit, ACPI_FAN_M_STA, t, status);
+		/*
+		 * As acpi_DeviceIsPresent(), without _STA a device is
+		 * present; a failed call keeps the last answer.
+		 */
+		if (status == AE_NOT_FOUND)
+			sc->absent = 0;
+		else if (ACPI_SUCCESS(status))
+			sc->absent = !ACPI_DEVICE_PRESENT(sta);
+	}
+	if (sc->absent)
+		reasons |= ACPI_FAN_HR_ABSENT;
+	if (sc->stall_count >= acpi_fan_stall_samples)
+		reasons |= ACPI_FAN_HR_STALL;
+
+	if (sc->acpi4) {
+		sc->fst_fails = sc->fst_fails << 1 |
+		    ((s->flags & (ACPI_FAN_SAMPLE_FST |
+		    ACPI_FAN_SAMPLE_CACHED)) == 0);
+		if (bitcount32(sc->fst_fails) >= 4)
+			reasons |= ACPI_FAN_HR_AML;
+	}
+
+	n = atomic_load_int(&sc->notify_count);
+	if (sc->notify_seen != n) {
+		sc->notify_seen = n;
+		sc->notify_hold = 60;
+		acpi_fan_event(sc, ACPI_FAN_EV_NOTIFY, "count=%u",
+		    sc->notify_seen);
+	}
+	if (sc->notify_hold > 0) {
+		sc->notify_hold--;
+		reasons |= ACPI_FAN_HR_NOTIFY;
+	}
+
+	expect = 0;
+	if ((s->flags & ACPI_FAN_SAMPLE_FST) && s->powered && s->control > 0 &&
+	    s->control == sc->prev_control)
+		expect = acpi_fan_expected_speed(sc, s->control);
+	sc->prev_control = (s->flags & ACPI_FAN_SAMPLE_FST) ? s->control : -1;
+	if (expect > 0) {
+		if (s->speed < expect * 3 / 4)
+			reasons |= ACPI_FAN_HR_SLOW;
+		/*
+		 * Q16, so that steps of 1/64 of a small difference do not
+		 * truncate to nothing.
+		 */
+		r = MIN(((int64_t)s->speed << ACPI_FAN_Q) / expect,
+		    2 * ACPI_FAN_QONE);
+		if (sc->eff_n == 0)
+			sc->eff = r;
+		else
+			sc->eff += (r - sc->eff) / 64;
+		if (sc->eff_n < 256 && ++sc->eff_n == 256 &&
+		    sc->eff_base == 0)
+			sc->eff_base = MAX(sc->eff, 1);
+		if (sc->eff_base > 0 &&
+		    (int64_t)sc->eff * 100 < (int64_t)sc->eff_base * 85)
+			reasons |= ACPI_FAN_HR_WEAR;
+	}
+
+	score = 100;
+	if (reasons & ACPI_FAN_HR_ABSENT)
+		score = 0;
+	if (reasons & ACPI_FAN_HR_STALL)
+		score -= 60;
+	if (reasons & ACPI_FAN_HR_SLOW)
+		score -= 25;
+	if (reasons & ACPI_FAN_HR_AML)
+		score -= 20;
+	if (reasons & ACPI_FAN_HR_NOTIFY)
+		score -= 15;
+	if (reasons & ACPI_FAN_HR_WEAR)
+		score -= 15;
+	score = MAX(score, 0);
+	if (score >= 80)
+		state = ACPI_FAN_HEALTH_OK;
+	else if (score >= 40)
+		state = ACPI_FAN_HEALTH_DEGRADED;
+	else
+		state = ACPI_FAN_HEALTH_FAILING;
+
+	if (state != sc->health || reasons != sc->health_reasons)
+		acpi_fan_bump_gen(sc);
+	sc->health_score = score;
+	sc->health_reasons = reasons;
+	if (state != sc->health) {
+		sc->health = state;
+		acpi_fan_event(sc, ACPI_FAN_EV_HEALTH,
+		    "health=%d score=%d reasons=0x%x", state, score, reasons);
+	}
+}
+
+/* Speed _FPS lists for the entry closest to control, 0 if none. */
+static int
+acpi_fan_expected_speed(struct acpi_fan_softc *sc, int control)
+{
+	int best, d, i, speed;
+
+	best = INT_MAX;
+	speed = 0;
+	for (i = 0; i < sc->max_fps; i++) {
+		d = abs(sc->fps[i].control - control);
+		if (d < best) {
+			best = d;
+			speed = sc->fps[i].speed;
+		}
+	}
+	return (speed);
+}
+
+/*
+ * Long-term effective thermal resistance: the rise of the hottest zone
+ * over hw.acpi.fan.ambient per unit of load, R = dT / (1 + load).  It is
+ * kept per band of fan speed, since R naturally falls as the fan speeds
+ * up.  A band's baseline is fixed after its first 1024 samples; a fan
+ * whose current R stays obstruct_threshold percent above the baseline
+ * for obstruct_sweeps sweeps is flagged as obstructed.
+ */
+static void
+acpi_fan_resist(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+	int b, dt, max, over, r;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if ((s->flags & ACPI_FAN_SAMPLE_FST) == 0 || sc->temp < 0 ||
+	    s->speed <= 0 || s->temp_age > ACPI_FAN_SKEW_MS)
+		return;
+	max = acpi_fan_max_speed(sc);
+	if (max > 0)
+		b = MIN(s->speed * ACPI_FAN_RBANDS / max, ACPI_FAN_RBANDS - 1);
+	else
+		b = MIN(MAX(s->control, 0) * ACPI_FAN_RBANDS / 101,
+		    ACPI_FAN_RBANDS - 1);
+
+	dt = MAX(sc->temp - acpi_fan_ambient, 0);
+	r = (int64_t)dt * 256 * averunnable.fscale /
+	    (averunnable.fscale + averunnable.ldavg[0]);
+	if (sc->r_n[b] == 0)
+		sc->r_cur[b] = r;
+	else
+		sc->r_cur[b] += (r - sc->r_cur[b]) / 256;
+	if (sc->r_n[b] < 1024 && ++sc->r_n[b] == 1024)
+		sc->r_base[b] = MAX(sc->r_cur[b], 1);
+	if (sc->r_base[b] == 0)
+		return;
+
+	if ((int64_t)sc->r_cur[b] * 100 >
+	    (int64_t)sc->r_base[b] * (100 + acpi_fan_obstruct_pct))
+		sc->r_over++;
+	else
+		sc->r_over = 0;
+	over = sc->r_over >= acpi_fan_obstruct_sweeps;
+	if (over != sc->obstructed) {
+		sc->obstructed = over;
+		acpi_fan_event(sc, ACPI_FAN_EV_OBSTRUCT,
+		    "obstructed=%d band=%d resistance=%d baseline=%d", over, b,
+		    sc->r_cur[b], sc->r_base[b]);
+	}
+}
+
+/* Current and baseline resistance of each speed band. */
+static int
+acpi_fan_resist_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	struct sbuf sb;
+	int error, i;
+
+	sc = (struct acpi_fan_softc *)arg1;
+	sbuf_new_for_sysctl(&sb, NULL, 64, req);
+	ACPI_SERIAL_BEGIN(fan);
+	for (i = 0; i < ACPI_FAN_RBANDS; i++)
+		sbuf_printf(&sb, "%s%d/%d", i > 0 ? " " : "", sc->r_cur[i],
+		    sc->r_base[i]);
+	ACPI_SERIAL_END(fan);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+/* Obstruction flag; writing 0 after maintenance takes new baselines. */
+static int
+acpi_fan_obstructed_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	int error, val;
+
+	sc = (struct acpi_fan_softc *)arg1;
+	ACPI_SERIAL_BEGIN(fan);
+	val = sc->obstructed;
+	ACPI_SERIAL_END(fan);
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val != 0)
+		return (EINVAL);
+
+	ACPI_SERIAL_BEGIN(fan);
+	bzero(sc->r_base, sizeof(sc->r_base));
+	bzero(sc->r_n, sizeof(sc->r_n));
+	sc->r_over = 0;
+	sc->obstructed = 0;
+	ACPI_SERIAL_END(fan);
+	return (0);
+}
+
+/*
+ * Classify who drives the fan from the samples where _FST control is
+ * off the last level written by more than one step, see
+ * acpi_fan_level_match.
+ */
+static void
+acpi_fan_owner(struct acpi_fan_softc *sc, const struct acpi_fan_sample *s)
+{
+	int miss, owner;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if ((s->flags & ACPI_FAN_SAMPLE_FST) == 0 || sc->level < 0)
+		return;
+	sc->own_miss = sc->own_miss << 1 |
+	    !acpi_fan_level_match(sc, sc->level, s->control);
+	miss = bitcount32(sc->own_miss);
+	if (miss >= 14)
+		owner = ACPI_FAN_OWNER_FIRMWARE;
+	else if (miss > 2)
+		owner = ACPI_FAN_OWNER_CONTESTED;
+	else
+		owner = ACPI_FAN_OWNER_OS;
+	if (owner == ACPI_FAN_OWNER_OS)
+		sc->own_backoff = sc->own_skip = 0;
+	if (owner != sc->owner) {
+		sc->owner = owner;
+		acpi_fan_event(sc, ACPI_FAN_EV_OWNER, "owner=%d misses=%d",
+		    owner, miss);
+	}
+}
+
+/*
+ * Could _FST report control after we wrote level?  With fine grain
+ * control the fan rounds to its _FIF step size, otherwise to one of the
+ * _FPS states around the level.
+ */
+static int
+acpi_fan_level_match(struct acpi_fan_softc *sc, int level, int control)
+{
+	int above, below, c, i;
+
+	if (sc->fif.fine_grain_ctrl)
+		return (abs(control - level) <= MAX(sc->fif.stepsize, 1));
+	below = above = -1;
+	for (i = 0; i < sc->max_fps; i++) {
+		c = sc->fps[i].control;
+		if (c <= level && (below < 0 || c > below))
+			below = c;
+		if (c >= level && (above < 0 || c < above))
+			above = c;
+	}
+	if (below < 0 && above < 0)
+		return (abs(control - level) <= 1);
+	return (control >= (below < 0 ? level : below) &&
+	    control <= (above < 0 ? level : above));
+}
+
+/* Return 1 if an automatic write should not be issued this sweep. */
+static int
+acpi_fan_owner_defer(struct acpi_fan_softc *sc)
+{
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (sc->owner == ACPI_FAN_OWNER_OS ||
+	    acpi_fan_contest == ACPI_FAN_CONTEST_IGNORE)
+		return (0);
+	if (acpi_fan_contest == ACPI_FAN_CONTEST_BACKOFF) {
+		if (sc->own_skip == 0)
+			return (0);
+		sc->own_skip--;
+	}
+	sc->own_skipped++;
+	return (1);
+}
+
+/* An automatic write was admitted; wait twice as long before the next. */
+static void
+acpi_fan_owner_wrote(struct acpi_fan_softc *sc)
+{
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	if (sc->owner == ACPI_FAN_OWNER_OS ||
+	    acpi_fan_contest != ACPI_FAN_CONTEST_BACKOFF)
+		return;
+	sc->own_skip = (1 << sc->own_backoff) - 1;
+	if (sc->own_backoff < ACPI_FAN_BACKOFF_MAX)
+		sc->own_backoff++;
+}
+
+/* Highest speed in the _FPS table, 0 if unknown. */
+static int
+acpi_fan_max_speed(struct acpi_fan_softc *sc)
+{
+	int i, max;
+
+	max = 0;
+	for (i = 0; i < sc->max_fps; i++)
+		max = MAX(max, sc->fps[i].speed);
+	return (max);
+}
+
+/*
+ * Check a policy program before it is accepted: known opcodes, valid
+ * registers and inputs, forward jumps that stay inside the program and
+ * a final RET.  Every instruction then runs at most once, so a run
+ * takes at most len steps and always returns.
+ */
+static int
+acpi_fan_pol_verify(const struct acpi_fan_insn *prog, int len)
+{
+	const struct acpi_fan_insn *in;
+	int pc;
+
+	if (len < 1 || len > ACPI_FAN_POL_MAXINSN ||
+	    prog[len - 1].op != ACPI_FAN_OP_RET)
+		return (EINVAL);
+	for (pc = 0; pc < len; pc++) {
+		in = &prog[pc];
+		if (in->op > ACPI_FAN_OP_LAST || in->dst >= ACPI_FAN_POL_NREG)
+			return (EINVAL);
+		if (in->src >= ACPI_FAN_POL_NREG && in->src != ACPI_FAN_REG_IMM)
+			return (EINVAL);
+		if (in->op == ACPI_FAN_OP_LDX &&
+		    (in->imm < 0 || in->imm >= ACPI_FAN_IN_MAX))
+			return (EINVAL);
+		if (in->op >= ACPI_FAN_OP_JA && in->op <= ACPI_FAN_OP_JGE &&
+		    pc + 1 + in->jt >= len)
+			return (EINVAL);
+	}
+	return (0);
+}
+
+/* Run the policy program of a fan, -1 for no opinion. */
+static int
+acpi_fan_pol_demand(struct acpi_fan_softc *sc)
+{
+	const struct acpi_fan_insn *in;
+	int32_t in_val[ACPI_FAN_IN_MAX];
+	int32_t r[ACPI_FAN_POL_NREG];
+	int64_t a, b;
+	int pc;
+
+	if (sc->pol == NULL)
+		return (-1);
+
+	in_val[ACPI_FAN_IN_TEMP] = sc->temp;
+	in_val[ACPI_FAN_IN_FORECAST] = sc->forecast;
+	in_val[ACPI_FAN_IN_SPEED] = sc->fst.speed;
+	in_val[ACPI_FAN_IN_CONTROL] = sc->fst.control;
+	in_val[ACPI_FAN_IN_LEVEL] = sc->level;
+	in_val[ACPI_FAN_IN_LOAD] = averunnable.ldavg[0] * 100 /
+	    averunnable.fscale;
+	in_val[ACPI_FAN_IN_HEADROOM] = sc->headroom;
+	in_val[ACPI_FAN_IN_MAXSPEED] = acpi_fan_max_speed(sc);
+	bzero(r, sizeof(r));
+
+	for (pc = 0; pc < sc->pol_len; pc++) {
+		in = &sc->pol[pc];
+		a = r[in->dst];
+		b = in->src == ACPI_FAN_REG_IMM ? in->imm : r[in->src];
+		switch (in->op) {
+		case ACPI_FAN_OP_LDX:
+			a = in_val[in->imm];
+			break;
+		case ACPI_FAN_OP_MOV:
+			a = b;
+			break;
+		case ACPI_FAN_OP_ADD:
+			a += b;
+			break;
+		case ACPI_FAN_OP_SUB:
+			a -= b;
+			break;
+		case ACPI_FAN_OP_MUL:
+			a *= b;
+			break;
+		case ACPI_FAN_OP_DIV:
+			if (b == 0) {
+				sc->pol_faults++;
+				return (-1);
+			}
+			a /= b;
+			break;
+		case ACPI_FAN_OP_MIN:
+			a = MIN(a, b);
+			break;
+		case ACPI_FAN_OP_MAX:
+			a = MAX(a, b);
+			break;
+		case ACPI_FAN_OP_JA:
+			pc += in->jt;
+			continue;
+		case ACPI_FAN_OP_JEQ:
+			if (a == b)
+				pc += in->jt;
+			continue;
+		case ACPI_FAN_OP_JGT:
+			if (a > b)
+				pc += in->jt;
+			continue;
+		case ACPI_FAN_OP_JGE:
+			if (a >= b)
+				pc += in->jt;
+			continue;
+		case ACPI_FAN_OP_RET:
+			return (a < 0 ? -1 : MIN(a, 100));
+		}
+		r[in->dst] = MIN(MAX(a, INT32_MIN), INT32_MAX);
+	}
+	return (-1);	/* not reached, the verifier demands a final RET */
+}
+
+/* Load (write) or fetch (read) the policy program of a fan. */
+static int
+acpi_fan_pol_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct acpi_fan_softc *sc;
+	struct acpi_fan_insn *prog, *old;
+	size_t len;
+	int error, n;
+
+	sc = (struct acpi_fan_softc *)arg1;
+	if (req->newptr == NULL) {
+		prog = mallocarray(ACPI_FAN_POL_MAXINSN, sizeof(*prog),
+		    M_ACPIFAN, M_WAITOK);
+		ACPI_SERIAL_BEGIN(fan);
+		n = sc->detached ? 0 : sc->pol_len;
+		if (n > 0)
+			memcpy(prog, sc->pol, n * sizeof(*prog));
+		ACPI_SERIAL_END(fan);
+		error = SYSCTL_OUT(req, prog, n * sizeof(*prog));
+		free(prog, M_ACPIFAN);
+		return (error);
+	}
+
+	len = req->newlen - req->newidx;
+	if (len % sizeof(*prog) != 0 ||
+	    len > ACPI_FAN_POL_MAXINSN * sizeof(*prog))
+		return (EINVAL);
+	n = len / sizeof(*prog);
+	prog = NULL;
+	if (n > 0) {
+		prog = mallocarray(n, sizeof(*prog), M_ACPIFAN, M_WAITOK);
+		error = SYSCTL_IN(req, prog, len);
+		if (error == 0)
+			error = acpi_fan_pol_verify(prog, n);
+		if (error) {
+			free(prog, M_ACPIFAN);
+			return (error);
+		}
+	}
+
+	ACPI_SERIAL_BEGIN(fan);
+	if (sc->detached) {
+		ACPI_SERIAL_END(fan);
+		free(prog, M_ACPIFAN);
+		return (ENXIO);
+	}
+	old = sc->pol;
+	sc->pol = prog;
+	sc->pol_len = n;
+	ACPI_SERIAL_END(fan);
+	free(old, M_ACPIFAN);
+	return (0);
+}
+
+/* An int in [0, arg2]; the sweeps read it under the lock. */
+static int
+acpi_fan_bounded_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	int *p;
+	int error, val;
+
+	p = (int *)arg1;
+	ACPI_SERIAL_BEGIN(fan);
+	val = *p;
+	ACPI_SERIAL_END(fan);
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val > arg2)
+		return (EINVAL);
+
+	ACPI_SERIAL_BEGIN(fan);
+	*p = val;
+	ACPI_SERIAL_END(fan);
+	return (0);
+}
+
+/*
+ * Emit a devctl(4) event: system=ACPI subsystem=FAN type=<fan path>,
+ * rate limited and coalesced as described in acpi_fanio.h.
+ */
+static void
+acpi_fan_event(struct acpi_fan_softc *sc, int type, const char *fmt, ...)
+{
+	struct acpi_fan_evstate *e;
+	char data[sizeof(e->data)];
+	sbintime_t now, window;
+	va_list ap;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	va_start(ap, fmt);
+	vsnprintf(data, sizeof(data), fmt, ap);
+	va_end(ap);
+
+	e = &sc->ev[type - 1];
+	now = sbinuptime();
+	window = acpi_fan_ev_window * SBT_1MS;
+	if (e->start == 0 || now - e->start >= window) {
+		/* The new event supersedes anything still coalesced. */
+		if (acpi_fan_event_send(sc, type, data, e->suppressed, now)) {
+			e->start = now;
+			e->suppressed = 0;
+			return;
+		}
+	}
+	strlcpy(e->data, data, sizeof(e->data));
+	e->suppressed++;
+}
+
+/*
+ * Send one event unless the global cap for this window is reached.
+ * Returns 0 if the event was held back.
+ */
+static int
+acpi_fan_event_send(struct acpi_fan_softc *sc, int type, const char *data,
+    u_int suppressed, sbintime_t now)
+{
+	char buf[160];
+	sbintime_t window;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	/* Without coalescing the cap still needs a window to count in. */
+	window = acpi_fan_ev_window > 0 ? acpi_fan_ev_window * SBT_1MS :
+	    SBT_1S;
+	if (now - acpi_fan_ev_start >= window) {
+		acpi_fan_ev_start = now;
+		acpi_fan_ev_sent = 0;
+	}
+	if (acpi_fan_ev_max > 0 && acpi_fan_ev_sent >= acpi_fan_ev_max) {
+		acpi_fan_ev_dropped++;
+		return (0);
+	}
+	acpi_fan_ev_sent++;
+
+	if (suppressed > 0)
+		snprintf(buf, sizeof(buf), "notify=0x%02x %s suppressed=%u",
+		    type, data, suppressed);
+	else
+		snprintf(buf, sizeof(buf), "notify=0x%02x %s", type, data);
+	devctl_notify("ACPI", "FAN", acpi_name(acpi_get_handle(sc->dev)), buf);
+	return (1);
+}
+
+/* Send coalesced events whose window has ended. */
+static void
+acpi_fan_event_flush(struct acpi_fan_softc *sc)
+{
+	struct acpi_fan_evstate *e;
+	sbintime_t now;
+	int type;
+
+	ACPI_SERIAL_ASSERT(fan);
+
+	now = sbinuptime();
+	for (type = 1; type <= ACPI_FAN_EV_MAX; type++) {
+		e = &sc->ev[type - 1];
+		if (e->suppressed == 0 ||
+		    now - e->start < acpi_fan_ev_window * SBT_1MS)
+			continue;
+		if (!acpi_fan_event_send(sc, type, e->data, e->suppressed, now))
+			break;
+		e->start = now;
+		e->suppressed = 0;
+	}
+}
+
+static int acpi_fan_get_power_state(device_t dev) {
+
+	ACPI_STATUS status;
+	ACPI_HANDLE h;
+	UINT32 state;
+	sbintime_t t;
+	
+
+	h = acpi_get_handle(dev);
+
+	/*
+	* If no _STA method or if it failed, then assume that
+	* it is ... Unknown (state=2)? Running (state=1)? 
+	*/
+	ACPI_SERIAL_ASSERT(fan);
+	
+	t = acpi_fan_aml_begin(device_get_unit(dev), ACPI_FAN_M_STA);
+	status = acpi_GetInteger(h, "_STA",  &state);
+	acpi_fan_aml_end(device_get_unit(dev), ACPI_FAN_M_STA, t, status);
+	if(ACPI_FAILURE(status)) {
+		ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev), 
+		"Getting power status: failed --%s\n", AcpiFormatException(status));
+		state = ACPI_FAN_POWER_UNKNOWN;
+	}
+	
+	return state;
+}
+
+
+/*
+ * This function turns the fan on and off.  The new state is recorded
+ * only once _ON or _OFF succeeded.  Returns 0 on success.
+ */
+static int
+acpi_fan_set_power(device_t dev, int new_state) {
+
+	struct acpi_fan_softc *sc;
+	ACPI_HANDLE h;
+	ACPI_STATUS status;
+	sbintime_t t;
+
+	ACPI_SERIAL_ASSERT(fan);
+	sc = device_get_softc(dev);
+	h = acpi_get_handle(dev);
+	status = AE_BAD_PARAMETER;
+	acpi_fan_trace(device_get_unit(dev), ACPI_FAN_TR_POWER, 0, new_state);
+
+		if(new_state == 1) {
+			// set fan to  D3 (On)
+			//XXX: which one?
+			//status = acpi_set_powerstate(dev, ACPI_STATE_D3); 
+			//	status = acpi_pwr_switch_consumer(acpi_get_handle(dev), ACPI_STATE_D3);
+			//status = AcpiEvaluateObject(h, "_PS3", NULL, NULL);
+			t = acpi_fan_aml_begin(device_get_unit(dev), ACPI_FAN_M_ON);
+			status = AcpiEvaluateObject(h, "_ON", NULL, NULL);
+			acpi_fan_aml_end(device_get_unit(dev), ACPI_FAN_M_ON, t, status);
+			
+						
+			//status = AcpiEvaluateObject(h, "_PS3", NULL, NULL);
+			if(ACPI_FAILURE(status)) 
+				ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev), 
+				"turning fan on: failed --%s\n", AcpiFormatException(status));
+		}
+	
+		else if (new_state == 0) {
+		//set fan to  D0 (Off)
+			t = acpi_fan_aml_begin(device_get_unit(dev), ACPI_FAN_M_OFF);
+			status = AcpiEvaluateObject(h, "_OFF", NULL, NULL);
+			acpi_fan_aml_end(device_get_unit(dev), ACPI_FAN_M_OFF, t, status);
+			
+			if(ACPI_FAILURE(status))
+				ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+				"turning fan off: failed --%s\n", AcpiFormatException(status));
+		}
+		if (ACPI_FAILURE(status))
+			return (EIO);
+		if (sc->fan_powered != new_state) {
+			sc->fan_powered = new_state;
+			acpi_fan_bump_gen(sc);
+		}
+		return (0);
+}
+
+/* Read _FIF; fine grain control and its step size matter to _FSL. */
+static int acpi_fan_get_fif(device_t dev) {
+
+	struct acpi_fan_softc *sc;
+	ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+	ACPI_OBJECT *obj;
+	ACPI_STATUS status;
+	UINT32 v[4];
+	sbintime_t t;
+	int i;
+
+	sc = device_get_softc(dev);
+
+	t = acpi_fan_aml_begin(device_get_unit(dev), ACPI_FAN_M_FIF);
+	status = AcpiEvaluateObject(acpi_get_handle(dev), "_FIF", NULL, &buffer);
+	acpi_fan_aml_end(device_get_unit(dev), ACPI_FAN_M_FIF, t, status);
+	if (ACPI_FAILURE(status)) {
+		if (status != AE_NOT_FOUND)
+			ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+			    "error fetching: _FIF -- %s\n",
+			    AcpiFormatException(status));
+		return 0;
+	}
+
+	obj = buffer.Pointer;
+	for (i = 0; i < 4; i++)
+		if (!ACPI_PKG_VALID(obj, 4) ||
+		    ACPI_FAILURE(acpi_PkgInt32(obj, i, &v[i]))) {
+			ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+			    "error: invalid _FIF package\n");
+			AcpiOsFree(buffer.Pointer);
+			return 0;
+		}
+	AcpiOsFree(buffer.Pointer);
+
+	sc->fif.rev = v[0];
+	sc->fif.fine_grain_ctrl = v[1] != 0;
+	sc->fif.stepsize = MIN(MAX((int)v[2], 1), 9);
+	sc->fif.low_fanspeed = v[3] != 0;
+	return 1;
+}
+
+
+static int acpi_fan_get_fst(device_t dev) {
+
+	struct acpi_fan_softc *sc;
+	ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+	ACPI_OBJECT *obj;
+	ACPI_STATUS status;
+	ACPI_HANDLE h;
+	UINT32 revision, control, speed;
+	sbintime_t t;
+
+	sc = device_get_softc(dev);
+	h = acpi_get_handle(dev);
+
+	t = acpi_fan_aml_begin(device_get_unit(dev), ACPI_FAN_M_FST);
+	status = AcpiEvaluateObject(h, "_FST", NULL, &buffer);
+	acpi_fan_aml_end(device_get_unit(dev), ACPI_FAN_M_FST, t, status);
+	if (ACPI_FAILURE(status)) {
+		if (status != AE_NOT_FOUND)
+			ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+			    "error fetching: _FST -- %s\n",
+			    AcpiFormatException(status));
+		return 0;
+	}
+
+	obj = buffer.Pointer;
+	if (!ACPI_PKG_VALID(obj, 3) ||
+	    ACPI_FAILURE(acpi_PkgInt32(obj, 0, &revision)) ||
+	    ACPI_FAILURE(acpi_PkgInt32(obj, 1, &control)) ||
+	    ACPI_FAILURE(acpi_PkgInt32(obj, 2, &speed))) {
+		ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+		    "error: invalid _FST package\n");
+		AcpiOsFree(buffer.Pointer);
+		return 0;
+	}
+	AcpiOsFree(buffer.Pointer);
+
+	sc->fst.revision = revision;
+	if (sc->fst.control != (int)control || sc->fst.speed != (int)speed) {
+		sc->fst.control = control;
+		sc->fst.speed = speed;
+		acpi_fan_bump_gen(sc);
+	}
+	return 1;
+}
+
+/* Read the _FPS table.  Unknown values (0xFFFFFFFF) become -1. */
+static int acpi_fan_get_fps(device_t dev) {
+
+	struct acpi_fan_softc *sc;
+	struct acpi_fan_fps *fps;
+	ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+	ACPI_OBJECT *obj, *e;
+	ACPI_STATUS status;
+	UINT32 v[5];
+	sbintime_t t;
+	int i, j, n;
+
+	sc = device_get_softc(dev);
+
+	t = acpi_fan_aml_begin(device_get_unit(dev), ACPI_FAN_M_FPS);
+	status = AcpiEvaluateObject(acpi_get_handle(dev), "_FPS", NULL, &buffer);
+	acpi_fan_aml_end(device_get_unit(dev), ACPI_FAN_M_FPS, t, status);
+	if (ACPI_FAILURE(status))
+		return 0;
+
+	obj = buffer.Pointer;
+	if (!ACPI_PKG_VALID(obj, 2)) {
+		ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+		    "error: invalid _FPS package\n");
+		AcpiOsFree(buffer.Pointer);
+		return 0;
+	}
+
+	n = obj->Package.Count - 1;	/* minus revision field */
+	fps = mallocarray(n, sizeof(*fps), M_ACPIFAN, M_WAITOK | M_ZERO);
+	for (i = 0; i < n; i++) {
+		e = &obj->Package.Elements[i + 1];
+		for (j = 0; j < 5; j++)
+			if (!ACPI_PKG_VALID(e, 5) ||
+			    ACPI_FAILURE(acpi_PkgInt32(e, j, &v[j]))) {
+				ACPI_VPRINT(dev, acpi_device_get_parent_softc(dev),
+				    "error: invalid _FPS entry %d\n", i);
+				free(fps, M_ACPIFAN);
+				AcpiOsFree(buffer.Pointer);
+				return 0;
+			}
+		fps[i].control = v[0];
+		fps[i].trip_point = v[1] == ACPI_UINT32_MAX ? -1 : (int)v[1];
+		fps[i].speed = v[2] == ACPI_UINT32_MAX ? -1 : (int)v[2];
+		fps[i].noise_level = v[3] == ACPI_UINT32_MAX ? -1 : (int)v[3];
+		fps[i].power = v[4] == ACPI_UINT32_MAX ? -1 : (int)v[4];
+	}
+	AcpiOsFree(buffer.Pointer);
+
+	free(sc->fps, M_ACPIFAN);
+	sc->fps = fps;
+	sc->max_fps = n;
+	return 1;
+}
+
+/* ------------------- */
+/* Register the driver */
+/* ------------------- */
+static driver_t acpi_fan_driver = {
+    "fan",
+    acpi_fan_methods,
+    sizeof(struct acpi_fan_softc),
+};
+
+DRIVER_MODULE(acpi_fan, acpi, acpi_fan_driver, 0, 0);
 MODULE_DEPEND(acpi_fan, acpi, 1, 1, 1);
\ No newline at end of file
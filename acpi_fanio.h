@@ -0,0 +1,656 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Georg Lindenberg
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* ------------------------------------	*/
+/* Records exported by the acpi fan driver	*/
+/* Shared between kernel and userland.		*/
+/* ------------------------------------	*/
+
+#ifndef _ACPI_FANIO_H_
+#define _ACPI_FANIO_H_
+
+#include <sys/types.h>
+
+/*
+ * hw.acpi.fan.snapshot
+ *
+ * A read returns one acpi_fan_snap_hdr followed by hdr.count records.
+ * If a generation number (uint64_t) is written in the same request,
+ * only fans whose state changed after that generation are returned.
+ * Pass hdr.gen of the previous read to get the next delta; a change
+ * of hdr.total means fans came or went and a full read is needed.
+ */
+#define	ACPI_FAN_SNAP_VERSION	2
+
+struct acpi_fan_snap_hdr {
+	uint32_t	version;	/* ACPI_FAN_SNAP_VERSION */
+	uint32_t	count;		/* number of records following */
+	uint32_t	total;		/* number of attached fans */
+	uint32_t	reserved;
+	uint64_t	gen;		/* global generation at snapshot time */
+};
+
+struct acpi_fan_snap {
+	uint64_t	gen;		/* generation of last change */
+	int32_t		unit;		/* fan unit number */
+	int32_t		acpi4;		/* ACPI 4.0 fan control available */
+	int32_t		powered;	/* OFF=0 ON=1 */
+	int32_t		level;		/* last level written to _FSL, -1 none */
+	int32_t		control;	/* _FST control */
+	int32_t		speed;		/* _FST speed (rpm) */
+	uint16_t	health;		/* ACPI_FAN_HEALTH_* */
+	uint16_t	score;		/* health score, 0-100 */
+	uint32_t	reasons;	/* ACPI_FAN_HR_* */
+};
+
+/*
+ * Fan health, dev.fan.N.health, health_score and health_reasons.
+ *
+ * Re-evaluated on every sampler sweep.  The score starts at 100 and
+ * each reason present takes a fixed amount off it; the state follows
+ * from the score.
+ */
+#define	ACPI_FAN_HEALTH_UNKNOWN	0	/* not sampled yet */
+#define	ACPI_FAN_HEALTH_OK	1	/* score 80 or more */
+#define	ACPI_FAN_HEALTH_DEGRADED 2	/* score 40 or more */
+#define	ACPI_FAN_HEALTH_FAILING	3
+
+#define	ACPI_FAN_HR_ABSENT	0x01	/* _STA: not present or not working */
+#define	ACPI_FAN_HR_STALL	0x02	/* stopped while commanded on */
+#define	ACPI_FAN_HR_SLOW	0x04	/* well below the _FPS speed */
+#define	ACPI_FAN_HR_AML		0x08	/* recent _FST calls failing */
+#define	ACPI_FAN_HR_NOTIFY	0x10	/* recent low speed notification */
+#define	ACPI_FAN_HR_WEAR	0x20	/* long-term speed down from baseline */
+
+/*
+ * One sample taken by the driver's sampler.  Samples are kept in a
+ * per-fan history (dev.fan.N.history) and fed to the log encoder.
+ * The thermal zones cooled by the fan are read in the same pass as
+ * _FST, so temp[] and speed describe the same instant, unless
+ * ACPI_FAN_SAMPLE_TCACHED says a temperature was reused from an earlier
+ * _TMP; temp_age then tells how much older it is.
+ */
+#define	ACPI_FAN_SAMPLE_NTZ	4	/* thermal zones per sample */
+
+struct acpi_fan_sample {
+	uint64_t	time;		/* microseconds since the Epoch */
+	int32_t		control;	/* _FST control */
+	int32_t		speed;		/* _FST speed (rpm) */
+	int32_t		level;		/* last level written to _FSL, -1 none */
+	uint8_t		powered;	/* OFF=0 ON=1 */
+	uint8_t		flags;		/* ACPI_FAN_SAMPLE_* */
+	uint16_t	temp_age;	/* ms since the oldest temp was read */
+	int16_t		temp[ACPI_FAN_SAMPLE_NTZ]; /* tenths of Kelvin, -1 none */
+};
+
+#define	ACPI_FAN_SAMPLE_FST	0x01	/* control and speed are valid */
+#define	ACPI_FAN_SAMPLE_TEMP	0x02	/* at least one temp is valid */
+#define	ACPI_FAN_SAMPLE_CACHED	0x04	/* AML budget spent, values reused */
+#define	ACPI_FAN_SAMPLE_TCACHED	0x08	/* a temp reused from an earlier _TMP */
+
+/*
+ * Epoch snapshot, hw.acpi.fan.epoch.
+ *
+ * Every sampler sweep visits all fans in one pass and is numbered.
+ * A read returns the samples of the latest complete sweep: one
+ * acpi_fan_epoch_hdr followed by hdr.count records, all taken in the
+ * same sweep.  Fans attached after it are left out.  If an epoch
+ * number (uint64_t) is written in the same request and no newer sweep
+ * has completed, hdr.count is 0.
+ */
+struct acpi_fan_epoch_hdr {
+	uint32_t	count;		/* number of records following */
+	uint32_t	total;		/* number of attached fans */
+	uint64_t	epoch;		/* sweep number, 0 before the first */
+	uint64_t	time;		/* sweep start, microseconds since Epoch */
+};
+
+struct acpi_fan_epoch_rec {
+	int32_t		unit;		/* fan unit number */
+	uint32_t	reserved;
+	struct acpi_fan_sample	sample;
+};
+
+/*
+ * Flight recorder, dev.fan.N.recorder.
+ *
+ * Each fan records samples at hw.acpi.fan.recorder_interval into a ring.
+ * When a trigger fires it records hw.acpi.fan.recorder_post more samples
+ * and then freezes until hw.acpi.fan.recorder_freeze is set to 0.
+ * A read returns one acpi_fan_rec_hdr followed by hdr.count samples.
+ */
+#define	ACPI_FAN_REC_NONE	0	/* armed, not triggered */
+#define	ACPI_FAN_REC_STALL	1	/* fan stopped while commanded on */
+#define	ACPI_FAN_REC_THERMAL	2	/* thermal zone close to _CRT */
+#define	ACPI_FAN_REC_MANUAL	3	/* hw.acpi.fan.recorder_freeze */
+#define	ACPI_FAN_REC_NOTIFY	4	/* low fan speed notification */
+
+struct acpi_fan_rec_hdr {
+	uint32_t	reason;		/* ACPI_FAN_REC_* */
+	uint32_t	frozen;		/* no longer recording */
+	uint32_t	count;		/* number of samples following */
+	uint32_t	reserved;
+	uint64_t	time;		/* time of the trigger */
+};
+
+/*
+ * Event trace, hw.acpi.fan.trace.
+ *
+ * With hw.acpi.fan.trace_enable set the driver records AML method
+ * begin/end, control decisions, power transitions and sysctl requests
+ * into a ring of hw.acpi.fan.trace_size records.  A read returns one
+ * acpi_fan_trace_hdr followed by hdr.count records; writing a record
+ * number (hdr.next of the previous read) returns only newer records.
+ *
+ * The records map directly onto Chrome trace events: *_BEGIN and *_END
+ * become "B"/"E" phases on thread "unit" (-1 for thermal zones), CONTROL
+ * and POWER become instant ("i") events carrying arg.
+ */
+#define	ACPI_FAN_TR_AML_BEGIN		1	/* what: ACPI_FAN_M_* */
+#define	ACPI_FAN_TR_AML_END		2	/* what: ACPI_FAN_M_*, arg: status */
+#define	ACPI_FAN_TR_CONTROL		3	/* arg: level written to _FSL */
+#define	ACPI_FAN_TR_POWER		4	/* arg: new power state */
+#define	ACPI_FAN_TR_SYSCTL_BEGIN	5	/* what: ACPI_FAN_S_*, arg: write */
+#define	ACPI_FAN_TR_SYSCTL_END		6	/* what: ACPI_FAN_S_* */
+
+#define	ACPI_FAN_M_FST		1
+#define	ACPI_FAN_M_FSL		2
+#define	ACPI_FAN_M_STA		3
+#define	ACPI_FAN_M_ON		4
+#define	ACPI_FAN_M_OFF		5
+#define	ACPI_FAN_M_FPS		6
+#define	ACPI_FAN_M_FIF		7
+#define	ACPI_FAN_M_TMP		8
+#define	ACPI_FAN_M_CRT		9
+#define	ACPI_FAN_M_ALX		10
+#define	ACPI_FAN_M_ACX		11
+#define	ACPI_FAN_M_MAX		12
+
+#define	ACPI_FAN_S_LEVEL	1
+#define	ACPI_FAN_S_POWERED	2
+
+struct acpi_fan_trace_hdr {
+	uint64_t	next;		/* number of records ever written */
+	uint32_t	count;		/* number of records following */
+	uint32_t	lost;		/* records overwritten before this read */
+};
+
+struct acpi_fan_trace {
+	uint64_t	time;		/* nanoseconds of uptime */
+	int16_t		unit;		/* fan unit, -1 if not a fan */
+	uint8_t		type;		/* ACPI_FAN_TR_* */
+	uint8_t		what;
+	int32_t		arg;
+};
+
+/*
+ * AML cost, hw.acpi.fan.aml.
+ *
+ * Almost every fan method ends in embedded controller transactions,
+ * which are slow, serialized across the machine and occasionally stall
+ * for a long time.  The driver keeps the wall time of every call it
+ * makes.  Its sweeps and sysctls make those calls one at a time under a
+ * single lock, so when the EC is slow they queue on that lock; the header
+ * gives the time those paths waited for it.  A read returns one
+ * acpi_fan_aml_hdr followed by ACPI_FAN_M_MAX acpi_fan_aml_stat records
+ * indexed by ACPI_FAN_M_* (entry 0 is unused).  Writing any value resets
+ * the counters.
+ */
+#define	ACPI_FAN_AML_BUCKETS	16
+
+struct acpi_fan_aml_hdr {
+	uint64_t	lock_count;	/* lock acquisitions by AML paths */
+	uint64_t	lock_wait;	/* nanoseconds spent waiting */
+	uint64_t	lock_wait_max;	/* nanoseconds, longest wait */
+};
+
+struct acpi_fan_aml_stat {
+	uint64_t	count;
+	uint64_t	errors;		/* calls that returned a failure */
+	uint64_t	total;		/* nanoseconds */
+	uint64_t	max;		/* nanoseconds */
+	/* bucket i: calls shorter than 2^i microseconds, the last: the rest */
+	uint32_t	hist[ACPI_FAN_AML_BUCKETS];
+};
+
+/*
+ * Configuration blob, hw.acpi.fan.config.
+ *
+ * One acpi_fan_conf_hdr followed by hdr.count acpi_fan_conf entries.
+ * Only fields whose flag is set are changed.  A write is validated as a
+ * whole and rejected without side effects if any part is invalid; then
+ * the driver applies it to all fans at once, issuing AML only for the
+ * settings that actually change.  A read returns the current
+ * configuration in the same format; the level of a fan that is off is
+ * left out, so a blob read back can always be written again as is.
+ */
+#define	ACPI_FAN_CONF_MAGIC	0x43464146	/* "AFFC" */
+#define	ACPI_FAN_CONF_VERSION	1
+#define	ACPI_FAN_CONF_MAXFANS	256
+
+#define	ACPI_FAN_CONF_G_SAMPLE		0x0001	/* sample_interval */
+#define	ACPI_FAN_CONF_G_RECORDER	0x0002	/* recorder_interval */
+#define	ACPI_FAN_CONF_G_STALL		0x0004	/* stall_samples */
+#define	ACPI_FAN_CONF_G_CRIT		0x0008	/* crit_margin */
+#define	ACPI_FAN_CONF_G_ALL		0x000f
+
+struct acpi_fan_conf_hdr {
+	uint32_t	magic;		/* ACPI_FAN_CONF_MAGIC */
+	uint16_t	version;	/* ACPI_FAN_CONF_VERSION */
+	uint16_t	count;		/* number of entries following */
+	uint32_t	flags;		/* ACPI_FAN_CONF_G_* */
+	int32_t		sample_interval;	/* ms, 0 disables */
+	int32_t		recorder_interval;	/* ms, 0 disables */
+	int32_t		stall_samples;
+	int32_t		crit_margin;	/* tenths of a degree */
+	uint32_t	reserved;
+};
+
+#define	ACPI_FAN_CONF_POWERED	0x0001	/* powered */
+#define	ACPI_FAN_CONF_LEVEL	0x0002	/* level */
+#define	ACPI_FAN_CONF_ALL	0x0003
+
+struct acpi_fan_conf {
+	int32_t		unit;		/* fan unit number */
+	uint32_t	flags;		/* ACPI_FAN_CONF_* */
+	int32_t		powered;	/* OFF=0 ON=1 */
+	int32_t		level;		/* _FSL level, 0-100 */
+};
+
+/*
+ * devctl(4) events, "notify=" of system=ACPI subsystem=FAN.
+ *
+ * Each fan sends at most one event of a type per
+ * hw.acpi.fan.event_window ms.  Later ones in the window are coalesced:
+ * when the window ends the latest of them is sent with
+ * "suppressed=N" appended, N counting the events it stands for.  All
+ * fans together send at most hw.acpi.fan.event_max events per window;
+ * coalesced events over that cap wait for the next window, new ones
+ * are coalesced.  A window of 0 sends every event as it comes, and
+ * event_max then counts per second.
+ */
+#define	ACPI_FAN_EV_FORECAST	0x01	/* forecast crossed its threshold */
+#define	ACPI_FAN_EV_HEALTH	0x02	/* health state changed */
+#define	ACPI_FAN_EV_STALL	0x03	/* fan stopped while commanded on */
+#define	ACPI_FAN_EV_NOTIFY	0x04	/* device notification received */
+#define	ACPI_FAN_EV_SPEED	0x05	/* speed moved by more than 10% */
+#define	ACPI_FAN_EV_POWERCAP	0x06	/* power cap started/stopped binding */
+#define	ACPI_FAN_EV_OBSTRUCT	0x07	/* thermal resistance rose, or cleared */
+#define	ACPI_FAN_EV_OWNER	0x08	/* dev.fan.N.owner changed */
+#define	ACPI_FAN_EV_MAX		0x08
+
+/*
+ * Who is driving the fan, dev.fan.N.owner, judged from how often the
+ * sampled _FST control differed from the last _FSL write over the last
+ * 16 samples.  What the driver does about a fan that is not its own is
+ * set by hw.acpi.fan.contested_policy.
+ */
+#define	ACPI_FAN_OWNER_OS	0	/* _FST follows our writes */
+#define	ACPI_FAN_OWNER_CONTESTED 1	/* firmware overrides some writes */
+#define	ACPI_FAN_OWNER_FIRMWARE	2	/* firmware overrides nearly all */
+
+#define	ACPI_FAN_CONTEST_IGNORE	0	/* keep writing */
+#define	ACPI_FAN_CONTEST_BACKOFF 1	/* double the write interval */
+#define	ACPI_FAN_CONTEST_YIELD	2	/* stop automatic writes until
+					   dev.fan.N.control is written */
+
+/*
+ * Multi-node coordination.
+ *
+ * hw.acpi.fan.summary returns one acpi_fan_summary describing all fans
+ * of the node as of the latest sampler sweep, small enough to publish
+ * to a coordinator every sweep.  The coordinator answers with a demand
+ * offset written to hw.acpi.fan.offset as an acpi_fan_offset: it is
+ * added to the level every automatically controlled fan asks for, as
+ * the lowest priority input, and lapses when the lease runs out, so a
+ * dead coordinator cannot leave a node undercooled.  A negative offset
+ * is never applied to a fan while a zone it cools is past its active
+ * trip point or near _CRT, or its forecast is above the threshold.
+ */
+#define	ACPI_FAN_SUMMARY_VERSION 1
+
+struct acpi_fan_summary {
+	uint32_t	version;	/* ACPI_FAN_SUMMARY_VERSION */
+	uint32_t	count;		/* fans in the sweep */
+	uint64_t	epoch;		/* sweep number */
+	uint64_t	time;		/* sweep start, microseconds since Epoch */
+	int32_t		temp;		/* hottest zone, tenths of Kelvin, -1 */
+	int32_t		forecast;	/* highest forecast, -1 unknown */
+	int32_t		level_max;	/* highest level written, -1 none */
+	int32_t		level_mean;	/* mean level of fans with one */
+	int32_t		headroom;	/* least headroom, percent */
+	int32_t		power;		/* estimated fan power, mW */
+	uint32_t	health;		/* worst ACPI_FAN_HEALTH_* */
+	int32_t		offset;		/* demand offset in force */
+};
+
+struct acpi_fan_offset {
+	int32_t		offset;		/* added to demanded levels */
+	uint32_t	lease;		/* seconds it stays in force */
+};
+
+/*
+ * Per-fan control modes, dev.fan.N.control.
+ */
+#define	ACPI_FAN_CTL_MANUAL	0	/* levels only set from userland */
+#define	ACPI_FAN_CTL_PROFILE	1	/* curve of the active profile */
+#define	ACPI_FAN_CTL_MPC	2	/* model-predictive control */
+#define	ACPI_FAN_CTL_POLICY	3	/* policy program, dev.fan.N.policy */
+#define	ACPI_FAN_CTL_MAX	4
+
+/*
+ * Control policy program, dev.fan.N.policy.
+ *
+ * A program is an array of at most ACPI_FAN_POL_MAXINSN instructions
+ * run on every sample of a fan in control mode ACPI_FAN_CTL_POLICY.
+ * There are ACPI_FAN_POL_NREG 32-bit registers, all zero at start.
+ * ALU ops compute dst = dst op src, where src ACPI_FAN_REG_IMM means
+ * imm; results saturate to 32 bits.  LDX loads input imm into dst.
+ * Jumps compare dst with src the same way and skip jt instructions
+ * forward.  RET returns dst as the level (clamped to 100; negative
+ * means no opinion).  Programs are verified on load: jumps only go
+ * forward and the last instruction is RET, so every run ends within
+ * the program length.  A division by zero aborts the run.
+ */
+#define	ACPI_FAN_POL_MAXINSN	64
+#define	ACPI_FAN_POL_NREG	8
+#define	ACPI_FAN_REG_IMM	0xff
+
+#define	ACPI_FAN_OP_LDX		0	/* dst = input[imm] */
+#define	ACPI_FAN_OP_MOV		1
+#define	ACPI_FAN_OP_ADD		2
+#define	ACPI_FAN_OP_SUB		3
+#define	ACPI_FAN_OP_MUL		4
+#define	ACPI_FAN_OP_DIV		5
+#define	ACPI_FAN_OP_MIN		6
+#define	ACPI_FAN_OP_MAX		7
+#define	ACPI_FAN_OP_JA		8	/* skip jt */
+#define	ACPI_FAN_OP_JEQ		9	/* skip jt if dst == src */
+#define	ACPI_FAN_OP_JGT		10	/* skip jt if dst > src */
+#define	ACPI_FAN_OP_JGE		11	/* skip jt if dst >= src */
+#define	ACPI_FAN_OP_RET		12	/* level = dst */
+#define	ACPI_FAN_OP_LAST	ACPI_FAN_OP_RET
+
+#define	ACPI_FAN_IN_TEMP	0	/* tenths of Kelvin, -1 unknown */
+#define	ACPI_FAN_IN_FORECAST	1	/* tenths of Kelvin, -1 unknown */
+#define	ACPI_FAN_IN_SPEED	2	/* rpm */
+#define	ACPI_FAN_IN_CONTROL	3	/* _FST control */
+#define	ACPI_FAN_IN_LEVEL	4	/* last level written, -1 none */
+#define	ACPI_FAN_IN_LOAD	5	/* load average x 100 */
+#define	ACPI_FAN_IN_HEADROOM	6	/* percent */
+#define	ACPI_FAN_IN_MAXSPEED	7	/* rpm, 0 unknown */
+#define	ACPI_FAN_IN_MAX		8
+
+struct acpi_fan_insn {
+	uint8_t		op;		/* ACPI_FAN_OP_* */
+	uint8_t		dst;		/* register */
+	uint8_t		src;		/* register or ACPI_FAN_REG_IMM */
+	uint8_t		jt;		/* jump distance */
+	int32_t		imm;
+};
+
+/*
+ * Cooling profile, written to hw.acpi.fan.profile_load.
+ *
+ * One acpi_fan_prof_hdr followed by hdr.count acpi_fan_prof_fan entries.
+ * Each entry maps the hottest thermal zone of a fan (degrees Celsius)
+ * to a level by linear interpolation between its curve points, clamps
+ * it to [min_level, max_level] and limits the change per sample to ramp
+ * (0 for no limit).  Fans without an entry are left alone.  Writing the
+ * name to hw.acpi.fan.profile makes a loaded profile active.
+ */
+#define	ACPI_FAN_PROF_MAGIC	0x50464146	/* "AFFP" */
+#define	ACPI_FAN_PROF_VERSION	1
+#define	ACPI_FAN_PROF_NAMELEN	16
+#define	ACPI_FAN_PROF_MAXPTS	8
+#define	ACPI_FAN_PROF_MAX	8	/* loaded profiles */
+
+struct acpi_fan_prof_hdr {
+	uint32_t	magic;		/* ACPI_FAN_PROF_MAGIC */
+	uint16_t	version;	/* ACPI_FAN_PROF_VERSION */
+	uint16_t	count;		/* number of entries following */
+	char		name[ACPI_FAN_PROF_NAMELEN];
+};
+
+struct acpi_fan_prof_point {
+	int32_t		temp;		/* 0-127 degrees Celsius, ascending */
+	int32_t		level;		/* 0-100 */
+};
+
+struct acpi_fan_prof_fan {
+	int32_t		unit;		/* fan unit number */
+	int32_t		min_level;
+	int32_t		max_level;
+	int32_t		ramp;		/* max level change per sample */
+	int32_t		npoints;
+	int32_t		reserved;
+	struct acpi_fan_prof_point	point[ACPI_FAN_PROF_MAXPTS];
+};
+
+/*
+ * Binary telemetry log, one file per fan.
+ *
+ * A file is an acpi_fan_log_hdr followed by fixed-size blocks in time
+ * order.  Each block holds a full base sample followed by up to
+ * ACPI_FAN_LOG_BLKRECS - 1 records encoded as deltas to the previous
+ * sample.  Because blocks have a fixed size, block i starts at
+ * sizeof(hdr) + i * hdr.blksize and a reader can mmap(2) the file and
+ * binary-search the t_first/t_last index of the blocks directly.
+ *
+ * The driver encodes the blocks itself.  dev.fan.N.log returns the
+ * completed blocks it still holds; writing a sequence number in the same
+ * request returns only blocks with a greater seq, so a writer appends
+ * whatever it gets and remembers the last seq.  seq is 64 bits wide like
+ * the generation and epoch counters and does not wrap.  The writer copies
+ * hw.acpi.fan.model into the header so that logs collected from many
+ * hosts can be grouped by platform.
+ */
+#define	ACPI_FAN_LOG_MAGIC	0x4e414641	/* "AFAN" */
+#define	ACPI_FAN_LOG_VERSION	4
+#define	ACPI_FAN_LOG_BLKRECS	63
+
+struct acpi_fan_log_hdr {
+	uint32_t	magic;		/* ACPI_FAN_LOG_MAGIC */
+	uint16_t	version;	/* ACPI_FAN_LOG_VERSION */
+	uint16_t	unit;		/* fan unit number */
+	uint32_t	blksize;	/* sizeof(struct acpi_fan_log_blk) */
+	uint32_t	reserved;
+	char		desc[48];	/* free form, set by the writer */
+	char		model[32];	/* hw.acpi.fan.model */
+};
+
+/*
+ * One block decoded into columns, for readers that scan many blocks,
+ * see acpi_fan_log_decode and acpi_fan_log_accum.
+ */
+struct acpi_fan_log_cols {
+	uint64_t	time[ACPI_FAN_LOG_BLKRECS];
+	int32_t		control[ACPI_FAN_LOG_BLKRECS];
+	int32_t		speed[ACPI_FAN_LOG_BLKRECS];
+	int32_t		level[ACPI_FAN_LOG_BLKRECS];
+	int16_t		temp[ACPI_FAN_SAMPLE_NTZ][ACPI_FAN_LOG_BLKRECS];
+	uint8_t		powered[ACPI_FAN_LOG_BLKRECS];
+	uint8_t		flags[ACPI_FAN_LOG_BLKRECS];
+};
+
+/*
+ * Running totals over the samples with valid _FST of any number of
+ * decoded blocks.  Start from a zeroed struct; min and max are only
+ * meaningful once n is not 0.
+ */
+struct acpi_fan_log_agg {
+	uint64_t	n;		/* samples counted */
+	int64_t		control_sum;
+	int64_t		speed_sum;
+	int32_t		speed_min;
+	int32_t		speed_max;
+};
+
+struct acpi_fan_log_delta {
+	uint32_t	dt;		/* microseconds since previous sample */
+	int16_t		control;
+	int16_t		speed;
+	int16_t		level;
+	uint8_t		powered;	/* absolute, not a delta */
+	uint8_t		flags;		/* absolute, not a delta */
+	int16_t		temp[ACPI_FAN_SAMPLE_NTZ];
+};
+
+struct acpi_fan_log_blk {
+	uint64_t	t_first;	/* time of base sample */
+	uint64_t	t_last;		/* time of last sample in block */
+	uint64_t	seq;		/* per-fan block sequence number */
+	uint16_t	unit;		/* fan unit number */
+	uint16_t	count;		/* samples in block, base included */
+	uint32_t	reserved;
+	struct acpi_fan_sample		base;
+	struct acpi_fan_log_delta	delta[ACPI_FAN_LOG_BLKRECS - 1];
+};
+
+/* Decode sample i (0 <= i < blk->count) of a block. */
+static __inline void
+acpi_fan_log_sample(const struct acpi_fan_log_blk *blk, u_int i,
+    struct acpi_fan_sample *s)
+{
+	const struct acpi_fan_log_delta *d;
+	u_int j, k;
+
+	*s = blk->base;
+	for (k = 0; k < i; k++) {
+		d = &blk->delta[k];
+		s->time += d->dt;
+		s->control += d->control;
+		s->speed += d->speed;
+		s->level += d->level;
+		s->powered = d->powered;
+		s->flags = d->flags;
+		for (j = 0; j < ACPI_FAN_SAMPLE_NTZ; j++)
+			s->temp[j] += d->temp[j];
+	}
+}
+
+/* Decode a whole block into columns; returns the number of samples. */
+static __inline u_int
+acpi_fan_log_decode(const struct acpi_fan_log_blk *blk,
+    struct acpi_fan_log_cols *c)
+{
+	const struct acpi_fan_log_delta *d;
+	u_int j, k, n;
+
+	n = blk->count;
+	if (n == 0)
+		return (0);
+	if (n > ACPI_FAN_LOG_BLKRECS)
+		n = ACPI_FAN_LOG_BLKRECS;
+	d = blk->delta;
+
+	c->time[0] = blk->base.time;
+	for (k = 1; k < n; k++)
+		c->time[k] = c->time[k - 1] + d[k - 1].dt;
+	c->control[0] = blk->base.control;
+	for (k = 1; k < n; k++)
+		c->control[k] = c->control[k - 1] + d[k - 1].control;
+	c->speed[0] = blk->base.speed;
+	for (k = 1; k < n; k++)
+		c->speed[k] = c->speed[k - 1] + d[k - 1].speed;
+	c->level[0] = blk->base.level;
+	for (k = 1; k < n; k++)
+		c->level[k] = c->level[k - 1] + d[k - 1].level;
+	for (j = 0; j < ACPI_FAN_SAMPLE_NTZ; j++) {
+		c->temp[j][0] = blk->base.temp[j];
+		for (k = 1; k < n; k++)
+			c->temp[j][k] = c->temp[j][k - 1] + d[k - 1].temp[j];
+	}
+	c->powered[0] = blk->base.powered;
+	c->flags[0] = blk->base.flags;
+	for (k = 1; k < n; k++) {
+		c->powered[k] = d[k - 1].powered;
+		c->flags[k] = d[k - 1].flags;
+	}
+	return (n);
+}
+
+/*
+ * Add n decoded samples to a running total.  The decode is a chain of
+ * running sums and stays serial, but this is a plain reduction: samples
+ * without _FST are masked out rather than skipped, so compilers can
+ * vectorize the loop.
+ */
+static __inline void
+acpi_fan_log_accum(const struct acpi_fan_log_cols *c, u_int n,
+    struct acpi_fan_log_agg *a)
+{
+	int64_t csum, ssum;
+	int32_t hi, lo, m, ok, v, x, y;
+	u_int k;
+
+	csum = ssum = 0;
+	lo = a->n > 0 ? a->speed_min : 0x7fffffff;
+	hi = a->n > 0 ? a->speed_max : -0x7fffffff - 1;
+	m = 0;
+	for (k = 0; k < n; k++) {
+		ok = -(int32_t)((c->flags[k] & ACPI_FAN_SAMPLE_FST) != 0);
+		v = c->speed[k];
+		m -= ok;
+		csum += c->control[k] & ok;
+		ssum += v & ok;
+		x = (v & ok) | (0x7fffffff & ~ok);
+		y = (v & ok) | ((-0x7fffffff - 1) & ~ok);
+		lo = x < lo ? x : lo;
+		hi = y > hi ? y : hi;
+	}
+	a->n += m;
+	a->control_sum += csum;
+	a->speed_sum += ssum;
+	a->speed_min = lo;
+	a->speed_max = hi;
+}
+
+/*
+ * Return the index of the first of nblk blocks whose t_last is not
+ * before t, or nblk if there is none.  blk is usually the mmap(2)ed
+ * file just past its header.
+ */
+static __inline size_t
+acpi_fan_log_search(const struct acpi_fan_log_blk *blk, size_t nblk,
+    uint64_t t)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = nblk;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (blk[mid].t_last < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+#endif /* !_ACPI_FANIO_H_ */
@@ -0,0 +1,210 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * fanagg: fleet statistics over fan log files as fanlogd writes them.
+ *
+ * Each file is mmap(2)ed and its blocks are decoded with
+ * acpi_fan_log_decode and summed with acpi_fan_log_accum, so only the
+ * samples with a valid _FST count.  With -a and -b only samples taken in
+ * that window are counted; acpi_fan_log_search finds the first block.
+ * One line is printed per file, then one per platform model
+ * (hw.acpi.fan.model in the header) and one for all files.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../acpi_fanio.h"
+
+#define	MAXGROUPS	64
+
+struct group {
+	char			model[33];	/* hdr.model, terminated */
+	u_int			files;
+	struct acpi_fan_log_agg	agg;
+};
+
+static struct group	groups[MAXGROUPS];
+static u_int		ngroups;
+
+/* Fold b into a, as if all their samples went through one accum. */
+static void
+merge(struct acpi_fan_log_agg *a, const struct acpi_fan_log_agg *b)
+{
+
+	if (b->n == 0)
+		return;
+	if (a->n == 0 || b->speed_min < a->speed_min)
+		a->speed_min = b->speed_min;
+	if (a->n == 0 || b->speed_max > a->speed_max)
+		a->speed_max = b->speed_max;
+	a->n += b->n;
+	a->control_sum += b->control_sum;
+	a->speed_sum += b->speed_sum;
+}
+
+static void
+print(const char *what, const struct acpi_fan_log_agg *a)
+{
+
+	if (a->n == 0) {
+		printf("%-40s  no samples\n", what);
+		return;
+	}
+	printf("%-40s  %8ju %7jd %7jd %7d %7d\n", what, (uintmax_t)a->n,
+	    (intmax_t)(a->control_sum / (int64_t)a->n),
+	    (intmax_t)(a->speed_sum / (int64_t)a->n), a->speed_min,
+	    a->speed_max);
+}
+
+/* Sum the samples of one file taken in [after, before]. */
+static int
+scan(const char *path, uint64_t after, uint64_t before,
+    struct acpi_fan_log_hdr *hdr, struct acpi_fan_log_agg *a, size_t *nblk)
+{
+	const struct acpi_fan_log_blk *blk;
+	struct acpi_fan_log_cols c;
+	struct stat st;
+	size_t i;
+	void *p;
+	u_int k, n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		warn("%s", path);
+		return (-1);
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*hdr) ||
+	    pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)) {
+		warnx("%s: no log header", path);
+		close(fd);
+		return (-1);
+	}
+	if (hdr->magic != ACPI_FAN_LOG_MAGIC ||
+	    hdr->version != ACPI_FAN_LOG_VERSION ||
+	    hdr->blksize != sizeof(*blk)) {
+		warnx("%s: not a version %d fan log", path,
+		    ACPI_FAN_LOG_VERSION);
+		close(fd);
+		return (-1);
+	}
+	*nblk = (st.st_size - sizeof(*hdr)) / hdr->blksize;
+	memset(a, 0, sizeof(*a));
+	if (*nblk == 0) {
+		close(fd);
+		return (0);
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("%s: mmap", path);
+		return (-1);
+	}
+	blk = (const struct acpi_fan_log_blk *)((const char *)p +
+	    sizeof(*hdr));
+	for (i = acpi_fan_log_search(blk, *nblk, after);
+	    i < *nblk && blk[i].t_first <= before; i++) {
+		n = acpi_fan_log_decode(&blk[i], &c);
+		/* Mask samples outside the window like those without _FST. */
+		if (blk[i].t_first < after || blk[i].t_last > before)
+			for (k = 0; k < n; k++)
+				if (c.time[k] < after || c.time[k] > before)
+					c.flags[k] &= ~ACPI_FAN_SAMPLE_FST;
+		acpi_fan_log_accum(&c, n, a);
+	}
+	munmap(p, st.st_size);
+	return (0);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fanagg [-a after] [-b before] file ...\n"
+	    "       (times in seconds since the Epoch)\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct acpi_fan_log_hdr hdr;
+	struct acpi_fan_log_agg a, all;
+	struct group *g;
+	uint64_t after, before;
+	size_t nblk;
+	char desc[sizeof(hdr.desc) + 1], model[sizeof(hdr.model) + 1];
+	char line[160];
+	u_int files, i;
+	int ch, bad;
+
+	after = 0;
+	before = UINT64_MAX;
+	while ((ch = getopt(argc, argv, "a:b:")) != -1) {
+		switch (ch) {
+		case 'a':
+			after = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		case 'b':
+			before = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0 || after > before)
+		usage();
+
+	memset(&all, 0, sizeof(all));
+	files = bad = 0;
+	printf("%-40s  %8s %7s %7s %7s %7s\n", "file unit model desc blocks",
+	    "samples", "control", "rpm", "min", "max");
+	for (; argc > 0; argc--, argv++) {
+		if (scan(*argv, after, before, &hdr, &a, &nblk) != 0) {
+			bad = 1;
+			continue;
+		}
+		memcpy(model, hdr.model, sizeof(hdr.model));
+		model[sizeof(hdr.model)] = '\0';
+		memcpy(desc, hdr.desc, sizeof(hdr.desc));
+		desc[sizeof(hdr.desc)] = '\0';
+		snprintf(line, sizeof(line), "%s %u %s %s %zu", *argv,
+		    hdr.unit, model[0] != '\0' ? model : "-",
+		    desc[0] != '\0' ? desc : "-", nblk);
+		print(line, &a);
+
+		for (i = 0; i < ngroups; i++)
+			if (strcmp(groups[i].model, model) == 0)
+				break;
+		if (i == ngroups && ngroups < MAXGROUPS)
+			strcpy(groups[ngroups++].model, model);
+		if (i < ngroups) {
+			g = &groups[i];
+			g->files++;
+			merge(&g->agg, &a);
+		}
+		merge(&all, &a);
+		files++;
+	}
+	for (i = 0; i < ngroups; i++) {
+		g = &groups[i];
+		snprintf(line, sizeof(line), "model %s, %u files",
+		    g->model[0] != '\0' ? g->model : "-", g->files);
+		print(line, &g->agg);
+	}
+	snprintf(line, sizeof(line), "all, %u files", files);
+	print(line, &all);
+	return (bad);
+}
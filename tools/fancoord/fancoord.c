@@ -0,0 +1,464 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * fancoord: the multi-node coordinator of acpi_fanio.h and its node
+ * agent, talking over a Unix domain stream socket.
+ *
+ * An agent (-n) sends hw.acpi.fan.summary every period and writes the
+ * acpi_fan_offset it gets back to hw.acpi.fan.offset.  When the
+ * coordinator goes away the agent stops writing, so the offset in force
+ * runs out with its lease; the agent reports that, and reconnects.
+ *
+ * The coordinator (-s) answers every summary from the latest summaries
+ * of all nodes connected: a node hotter than the mean of the fleet is
+ * asked for more airflow and a cooler one for less, one level per gain
+ * tenths of a degree, within -max and max.  A node reporting a failing
+ * fan is never asked for less.  The driver itself floors the offset at
+ * hw.acpi.fan.offset_min and never applies a negative one to a fan that
+ * is near a trip point.
+ *
+ * -S runs the coordinator together with simulated nodes, each a forked
+ * process with a first-order thermal model in place of the driver, so
+ * that the protocol and the policy can be tried on one machine.
+ */
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../acpi_fanio.h"
+
+#define	MAXNODES	64
+
+struct node {
+	int			fd;	/* -1 free */
+	int			have;	/* sum is valid */
+	struct acpi_fan_summary	sum;
+};
+
+static struct node	nodes[MAXNODES];
+static const char	*path;
+static int		gain = 5;	/* tenths of a degree per level */
+static int		maxoff = 20;
+static int		lease = 5;	/* seconds */
+static int		period = 1000;	/* ms */
+static int		verbose;
+static volatile sig_atomic_t quit;
+
+/* simulated node, see sim_step */
+static int		sim;		/* node number + 1, 0 the driver */
+static int		sim_temp, sim_heat, sim_level;
+static int32_t		sim_off;
+static int64_t		sim_until;
+static uint64_t		sim_epoch;
+
+static void
+onsig(int sig)
+{
+
+	quit = 1;
+}
+
+static int64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void
+sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = ms % 1000 * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+static int
+xfer(int fd, void *p, size_t len, int out)
+{
+	ssize_t n;
+
+	n = out ? send(fd, p, len, MSG_NOSIGNAL) : recv(fd, p, len,
+	    MSG_WAITALL);
+	return (n == (ssize_t)len ? 0 : -1);
+}
+
+/* Offset for node i from the latest summaries of all nodes. */
+static int32_t
+policy(int i)
+{
+	const struct acpi_fan_summary *s;
+	int64_t sum;
+	int j, n, off;
+
+	sum = n = 0;
+	for (j = 0; j < MAXNODES; j++) {
+		s = &nodes[j].sum;
+		if (nodes[j].fd < 0 || !nodes[j].have || s->temp < 0)
+			continue;
+		sum += s->temp;
+		n++;
+	}
+	s = &nodes[i].sum;
+	if (n == 0 || s->temp < 0)
+		return (0);
+	off = (s->temp - (int)(sum / n)) / gain;
+	off = MIN(MAX(off, -maxoff), maxoff);
+	if (s->health >= ACPI_FAN_HEALTH_FAILING)
+		off = MAX(off, 0);
+	return (off);
+}
+
+static void
+coordinator(int seconds)
+{
+	struct sockaddr_un sun;
+	struct pollfd pfd[MAXNODES + 1];
+	struct acpi_fan_offset off;
+	struct acpi_fan_summary s;
+	int64_t end;
+	int fd, i, lfd, served;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path))
+		errx(1, "%s: path too long", path);
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	unlink(path);
+	if (bind(lfd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		err(1, "%s", path);
+	if (listen(lfd, MAXNODES) < 0)
+		err(1, "listen");
+	for (i = 0; i < MAXNODES; i++)
+		nodes[i].fd = -1;
+
+	end = seconds > 0 ? now_ms() + seconds * 1000 : 0;
+	served = 0;
+	while (!quit && (end == 0 || now_ms() < end)) {
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		for (i = 0; i < MAXNODES; i++) {
+			pfd[i + 1].fd = nodes[i].fd;
+			pfd[i + 1].events = POLLIN;
+		}
+		if (poll(pfd, MAXNODES + 1, 100) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+		if (pfd[0].revents & POLLIN) {
+			if ((fd = accept(lfd, NULL, NULL)) < 0)
+				err(1, "accept");
+			for (i = 0; i < MAXNODES && nodes[i].fd >= 0; i++)
+				;
+			if (i == MAXNODES) {
+				warnx("more than %d nodes, refused", MAXNODES);
+				close(fd);
+			} else {
+				nodes[i].fd = fd;
+				nodes[i].have = 0;
+				served++;
+			}
+		}
+		for (i = 0; i < MAXNODES; i++) {
+			if (nodes[i].fd < 0 ||
+			    (pfd[i + 1].revents & (POLLIN | POLLHUP)) == 0)
+				continue;
+			if (xfer(nodes[i].fd, &s, sizeof(s), 0) != 0 ||
+			    s.version != ACPI_FAN_SUMMARY_VERSION) {
+				close(nodes[i].fd);
+				nodes[i].fd = -1;
+				continue;
+			}
+			nodes[i].sum = s;
+			nodes[i].have = 1;
+			off.offset = policy(i);
+			off.lease = lease;
+			if (verbose)
+				printf("node %d: temp %d level %d offset %d\n",
+				    i, s.temp, s.level_mean, off.offset);
+			if (xfer(nodes[i].fd, &off, sizeof(off), 1) != 0) {
+				close(nodes[i].fd);
+				nodes[i].fd = -1;
+			}
+		}
+		/* Simulated, stop once all nodes are done. */
+		if (sim < 0 && served > 0) {
+			for (i = 0; i < MAXNODES && nodes[i].fd < 0; i++)
+				;
+			if (i == MAXNODES)
+				break;
+		}
+	}
+	for (i = 0; i < MAXNODES; i++)
+		if (nodes[i].fd >= 0)
+			close(nodes[i].fd);
+	close(lfd);
+	unlink(path);
+}
+
+/*
+ * One period of a simulated node: the zone relaxes towards ambient plus
+ * its heat, less what the fan removes, and the fan follows a linear
+ * curve from 30 to 60 C plus the offset in force, as the driver would.
+ */
+static void
+sim_step(void)
+{
+	int off, target;
+
+	off = sim_off != 0 && now_ms() < sim_until ? sim_off : 0;
+	sim_level = (sim_temp - 3032) * 100 / 300 + off;
+	sim_level = MIN(MAX(sim_level, 0), 100);
+	target = 2982 + sim_heat * (100 - sim_level * 7 / 10) / 100;
+	sim_temp += (target - sim_temp) / 4;
+	sim_epoch++;
+}
+
+static int
+get_summary(struct acpi_fan_summary *s)
+{
+	size_t len;
+
+	if (!sim) {
+		len = sizeof(*s);
+		return (sysctlbyname("hw.acpi.fan.summary", s, &len, NULL, 0));
+	}
+	sim_step();
+	memset(s, 0, sizeof(*s));
+	s->version = ACPI_FAN_SUMMARY_VERSION;
+	s->count = 1;
+	s->epoch = sim_epoch;
+	s->temp = sim_temp;
+	s->forecast = -1;
+	s->level_max = s->level_mean = sim_level;
+	s->headroom = 100 - sim_level;
+	s->health = ACPI_FAN_HEALTH_OK;
+	s->offset = sim_off != 0 && now_ms() < sim_until ? sim_off : 0;
+	return (0);
+}
+
+static int
+put_offset(const struct acpi_fan_offset *off)
+{
+
+	if (!sim)
+		return (sysctlbyname("hw.acpi.fan.offset", NULL, NULL, off,
+		    sizeof(*off)));
+	sim_off = MAX(off->offset, -20);
+	sim_until = now_ms() + off->lease * 1000;
+	return (0);
+}
+
+/* The offset in force now, 0 once its lease ran out. */
+static int
+in_force(void)
+{
+	struct acpi_fan_offset off;
+	size_t len;
+
+	if (sim)
+		return (sim_off != 0 && now_ms() < sim_until ? sim_off : 0);
+	len = sizeof(off);
+	if (sysctlbyname("hw.acpi.fan.offset", &off, &len, NULL, 0) < 0)
+		err(1, "hw.acpi.fan.offset");
+	return (off.offset);
+}
+
+static int
+connect_to(void)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+static void
+agent(int rounds)
+{
+	struct acpi_fan_offset off;
+	struct acpi_fan_summary s;
+	const char *who;
+	char name[32];
+	int fd, i, last;
+
+	if (sim) {
+		snprintf(name, sizeof(name), "node %d", sim - 1);
+		who = name;
+	} else
+		who = "agent";
+	memset(&s, 0, sizeof(s));
+	fd = -1;
+	last = 0;
+	for (i = 0; !quit && (rounds == 0 || i < rounds); i++) {
+		if (i > 0)
+			sleep_ms(period);
+		if (get_summary(&s) < 0)
+			err(1, "hw.acpi.fan.summary");
+		if (fd < 0 && (fd = connect_to()) >= 0 && verbose)
+			printf("%s: connected\n", who);
+		if (fd >= 0 && (xfer(fd, &s, sizeof(s), 1) != 0 ||
+		    xfer(fd, &off, sizeof(off), 0) != 0)) {
+			close(fd);
+			fd = -1;
+			printf("%s: coordinator lost, offset %d lapses with "
+			    "its lease\n", who, last);
+		}
+		if (fd >= 0) {
+			if (put_offset(&off) < 0)
+				err(1, "hw.acpi.fan.offset");
+			last = off.offset;
+			if (verbose)
+				printf("%s: temp %d level %d offset %d\n", who,
+				    s.temp, s.level_mean, off.offset);
+		} else if (last != 0 && in_force() == 0) {
+			printf("%s: offset %d lapsed\n", who, last);
+			last = 0;
+		}
+	}
+	printf("%s: temp %d level %d offset %d\n", who, s.temp, s.level_mean,
+	    in_force());
+	if (fd >= 0)
+		close(fd);
+}
+
+static void
+simulate(int k, int rounds)
+{
+	pid_t pid;
+	int i, status;
+
+	for (i = 0; i < k; i++) {
+		if ((pid = fork()) < 0)
+			err(1, "fork");
+		if (pid == 0) {
+			/* Give the coordinator time to listen. */
+			sleep_ms(100);
+			sim = i + 1;
+			sim_heat = 200 + 400 * i / MAX(k - 1, 1);
+			sim_temp = 2982 + sim_heat;
+			agent(rounds);
+			fflush(stdout);
+			_exit(0);
+		}
+	}
+	sim = -1;
+	coordinator(0);
+	status = 0;
+	while (wait(&i) > 0)
+		status |= !WIFEXITED(i) || WEXITSTATUS(i) != 0;
+	if (status)
+		errx(1, "a simulated node failed");
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: fancoord -s path [-v] [-d seconds] [-g gain] [-l lease] "
+	    "[-m max]\n"
+	    "       fancoord -n path [-v] [-c rounds] [-p ms]\n"
+	    "       fancoord -S nodes [-v] [-c rounds] [-p ms] [-g gain] "
+	    "[-l lease] [-m max]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	char tmp[64];
+	int ch, mode, rounds, seconds, simnodes;
+
+	mode = 0;
+	rounds = seconds = simnodes = 0;
+	while ((ch = getopt(argc, argv, "S:c:d:g:l:m:n:p:s:v")) != -1) {
+		switch (ch) {
+		case 'S':
+			mode = ch;
+			simnodes = atoi(optarg);
+			break;
+		case 'c':
+			rounds = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'g':
+			gain = atoi(optarg);
+			break;
+		case 'l':
+			lease = atoi(optarg);
+			break;
+		case 'm':
+			maxoff = atoi(optarg);
+			break;
+		case 'n':
+		case 's':
+			mode = ch;
+			path = optarg;
+			break;
+		case 'p':
+			period = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind || mode == 0 || gain < 1 || lease < 1 ||
+	    lease > 3600 || maxoff < 0 || maxoff > 100 || period < 1 ||
+	    rounds < 0 || seconds < 0 ||
+	    (mode == 'S' && (simnodes < 1 || simnodes > MAXNODES)))
+		usage();
+	signal(SIGINT, onsig);
+	signal(SIGTERM, onsig);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	switch (mode) {
+	case 's':
+		coordinator(seconds);
+		break;
+	case 'n':
+		agent(rounds);
+		break;
+	case 'S':
+		snprintf(tmp, sizeof(tmp), "/tmp/fancoord.%d", (int)getpid());
+		path = tmp;
+		simulate(simnodes, rounds != 0 ? rounds : 50);
+		break;
+	}
+	return (0);
+}
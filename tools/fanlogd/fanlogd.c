@@ -0,0 +1,324 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * fanlogd: drain the binary telemetry log of every fan, dev.fan.N.log,
+ * into one file per fan, DIR/fanN.log, laid out as acpi_fanio.h
+ * describes: an acpi_fan_log_hdr followed by the blocks in time order.
+ *
+ * Every interval the fans are listed from hw.acpi.fan.snapshot and each
+ * log is read with the sequence number of the last block taken, so only
+ * newer blocks come back.  The driver holds hw.acpi.fan.log_blocks
+ * blocks per fan; poll faster than they fill or raise the tunable.  A
+ * jump in the sequence numbers is reported as lost blocks.
+ *
+ * An existing file is appended to.  A torn last block is cut off, and a
+ * block that starts before the end of the file is dropped, so that the
+ * file stays in time order for acpi_fan_log_search across restarts of
+ * the daemon, reboots and clock steps.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../acpi_fanio.h"
+
+#define	MAXFANS		ACPI_FAN_CONF_MAXFANS
+
+struct fan {
+	int		fd;		/* -1 not open */
+	uint64_t	seq;		/* last block taken, 0 none yet */
+	uint64_t	t_last;		/* end of the file */
+	uint64_t	lost;
+};
+
+static struct fan	fans[MAXFANS];
+static const char	*dir = "/var/log/fan";
+static char		desc[48];
+static char		model[32];
+static struct acpi_fan_log_blk *buf;
+static size_t		bufcnt = 16;
+static int		daemonized, verbose;
+static volatile sig_atomic_t quit;
+
+static void
+logmsg(int pri, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (daemonized)
+		vsyslog(pri, fmt, ap);
+	else if (pri != LOG_DEBUG || verbose)
+		vwarnx(fmt, ap);
+	va_end(ap);
+}
+
+static void
+onsig(int sig)
+{
+
+	quit = 1;
+}
+
+/* Open or create the file of a fan and find where it ends. */
+static int
+fan_open(int unit, struct fan *f)
+{
+	struct acpi_fan_log_hdr hdr;
+	struct acpi_fan_log_blk last;
+	struct stat st;
+	char path[1024];
+	off_t nblk;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/fan%d.log", dir, unit);
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		logmsg(LOG_ERR, "%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	if (fstat(fd, &st) < 0)
+		goto fail;
+	f->seq = f->t_last = 0;
+	if (st.st_size == 0) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = ACPI_FAN_LOG_MAGIC;
+		hdr.version = ACPI_FAN_LOG_VERSION;
+		hdr.unit = unit;
+		hdr.blksize = sizeof(struct acpi_fan_log_blk);
+		memcpy(hdr.desc, desc, sizeof(hdr.desc));
+		memcpy(hdr.model, model, sizeof(hdr.model));
+		if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+			goto fail;
+	} else {
+		if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+		    hdr.magic != ACPI_FAN_LOG_MAGIC ||
+		    hdr.version != ACPI_FAN_LOG_VERSION ||
+		    hdr.blksize != sizeof(struct acpi_fan_log_blk) ||
+		    hdr.unit != unit) {
+			logmsg(LOG_ERR, "%s: not a version %d log of fan%d, "
+			    "left alone", path, ACPI_FAN_LOG_VERSION, unit);
+			close(fd);
+			return (-1);
+		}
+		nblk = (st.st_size - (off_t)sizeof(hdr)) / hdr.blksize;
+		if (ftruncate(fd, sizeof(hdr) + nblk * hdr.blksize) < 0)
+			goto fail;
+		if (nblk > 0) {
+			if (pread(fd, &last, sizeof(last), sizeof(hdr) +
+			    (nblk - 1) * hdr.blksize) != sizeof(last))
+				goto fail;
+			f->t_last = last.t_last;
+		}
+	}
+	if (lseek(fd, 0, SEEK_END) < 0)
+		goto fail;
+	f->fd = fd;
+	return (0);
+fail:
+	logmsg(LOG_ERR, "%s: %s", path, strerror(errno));
+	close(fd);
+	return (-1);
+}
+
+static void
+fan_close(struct fan *f)
+{
+
+	if (f->fd >= 0)
+		close(f->fd);
+	f->fd = -1;
+}
+
+/* Append the blocks of one fan that are newer than what we have. */
+static void
+fan_drain(int unit, struct fan *f)
+{
+	struct acpi_fan_log_blk *b;
+	char name[64];
+	size_t len, i, n, w;
+	uint64_t since;
+
+	if (f->fd < 0 && fan_open(unit, f) != 0)
+		return;
+	snprintf(name, sizeof(name), "dev.fan.%d.log", unit);
+	since = f->seq;
+	for (;;) {
+		len = bufcnt * sizeof(*buf);
+		if (sysctlbyname(name, buf, &len, &since, sizeof(since)) == 0)
+			break;
+		if (errno == ENOENT || errno == ENXIO) {
+			/* Detached; the file is reopened if it comes back. */
+			fan_close(f);
+			return;
+		}
+		if (errno != ENOMEM) {
+			logmsg(LOG_ERR, "%s: %s", name, strerror(errno));
+			return;
+		}
+		bufcnt *= 2;
+		if ((buf = reallocarray(buf, bufcnt, sizeof(*buf))) == NULL)
+			err(1, "reallocarray");
+	}
+
+	n = len / sizeof(*buf);
+	w = 0;
+	for (i = 0; i < n; i++) {
+		b = &buf[i];
+		if (f->seq != 0 && b->seq != f->seq + 1) {
+			f->lost += b->seq - f->seq - 1;
+			logmsg(LOG_WARNING, "fan%d: lost blocks %ju-%ju", unit,
+			    (uintmax_t)f->seq + 1, (uintmax_t)b->seq - 1);
+		}
+		f->seq = b->seq;
+		if (b->t_first <= f->t_last)
+			continue;
+		f->t_last = b->t_last;
+		if (w != i)
+			buf[w] = *b;
+		w++;
+	}
+	if (w > 0 && write(f->fd, buf, w * sizeof(*buf)) !=
+	    (ssize_t)(w * sizeof(*buf))) {
+		logmsg(LOG_ERR, "fan%d: write: %s", unit, strerror(errno));
+		fan_close(f);
+		return;
+	}
+	logmsg(LOG_DEBUG, "fan%d: %zu blocks, seq %ju", unit, w,
+	    (uintmax_t)f->seq);
+}
+
+/* One pass over the fans attached now. */
+static void
+poll_fans(void)
+{
+	static char snap[sizeof(struct acpi_fan_snap_hdr) +
+	    MAXFANS * sizeof(struct acpi_fan_snap)];
+	struct acpi_fan_snap_hdr hdr;
+	struct acpi_fan_snap s;
+	char seen[MAXFANS];
+	size_t len;
+	u_int i;
+
+	len = sizeof(snap);
+	if (sysctlbyname("hw.acpi.fan.snapshot", snap, &len, NULL, 0) < 0) {
+		/* The tree goes away with the last fan. */
+		if (errno != ENOENT)
+			logmsg(LOG_ERR, "hw.acpi.fan.snapshot: %s",
+			    strerror(errno));
+		return;
+	}
+	memcpy(&hdr, snap, sizeof(hdr));
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < hdr.count && i < MAXFANS; i++) {
+		memcpy(&s, snap + sizeof(hdr) + i * sizeof(s), sizeof(s));
+		if (s.unit < 0 || s.unit >= MAXFANS)
+			continue;
+		seen[s.unit] = 1;
+		fan_drain(s.unit, &fans[s.unit]);
+	}
+	for (i = 0; i < MAXFANS; i++)
+		if (!seen[i])
+			fan_close(&fans[i]);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fanlogd [-fv] [-d desc] [-i seconds] "
+	    "[-n polls] [-o dir]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timespec ts;
+	size_t len;
+	char m[256];
+	int ch, foreground, i, interval, polls;
+
+	foreground = 0;
+	interval = 60;
+	polls = 0;
+	if (gethostname(desc, sizeof(desc)) < 0)
+		desc[0] = '\0';
+	desc[sizeof(desc) - 1] = '\0';
+	while ((ch = getopt(argc, argv, "d:fi:n:o:v")) != -1) {
+		switch (ch) {
+		case 'd':
+			memset(desc, 0, sizeof(desc));
+			snprintf(desc, sizeof(desc), "%s", optarg);
+			break;
+		case 'f':
+			foreground = 1;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'n':
+			polls = atoi(optarg);
+			break;
+		case 'o':
+			dir = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind || interval < 1 || polls < 0)
+		usage();
+
+	len = sizeof(m);
+	if (sysctlbyname("hw.acpi.fan.model", m, &len, NULL, 0) < 0 &&
+	    errno != ENOMEM)
+		err(1, "hw.acpi.fan.model");
+	m[sizeof(m) - 1] = '\0';
+	snprintf(model, sizeof(model), "%s", m);
+	for (i = 0; i < MAXFANS; i++)
+		fans[i].fd = -1;
+	if ((buf = calloc(bufcnt, sizeof(*buf))) == NULL)
+		err(1, "calloc");
+
+	if (!foreground) {
+		openlog("fanlogd", LOG_PID, LOG_DAEMON);
+		if (daemon(1, 0) < 0)
+			err(1, "daemon");
+		daemonized = 1;
+	}
+	signal(SIGINT, onsig);
+	signal(SIGTERM, onsig);
+
+	for (i = 0; !quit && (polls == 0 || i < polls); i++) {
+		if (i > 0) {
+			ts.tv_sec = interval;
+			ts.tv_nsec = 0;
+			nanosleep(&ts, NULL);
+		}
+		poll_fans();
+	}
+	for (i = 0; i < MAXFANS; i++) {
+		if (fans[i].lost != 0)
+			logmsg(LOG_WARNING, "fan%d: %ju blocks lost in all", i,
+			    (uintmax_t)fans[i].lost);
+		fan_close(&fans[i]);
+	}
+	return (0);
+}
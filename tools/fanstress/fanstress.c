@@ -0,0 +1,559 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Stress acpi_fan.c in userland against the mock kernel and ACPI
+ * namespace in mock/, to be run under ThreadSanitizer and
+ * AddressSanitizer (make tsan, make asan).
+ *
+ * Reader and writer threads hammer every sysctl node of the driver while
+ * notifier threads send fan and thermal zone notifies and a lifecycle
+ * thread detaches, reattaches, suspends and resumes fans.  Every so often
+ * it detaches all of them so that the last-fan teardown runs against
+ * handlers in flight, and the acpi_fan_detach fail point widens the
+ * window between unlinking a fan and removing its notify handler.
+ *
+ * Each operation has a set of errors it may legitimately return, ENXIO
+ * or ENOENT for a fan that went away or EIO for a failed AML call; any
+ * other error is reported and makes the run fail.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock/mock.h"
+#include "../../acpi_fanio.h"
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define	BUFSZ		(256 * 1024)
+#define	MAXERRNO	160
+
+/* errors an operation may return besides 0 */
+#define	OK_GONE		0x01	/* ENOENT, ENXIO: the fan went away */
+#define	OK_AML		0x02	/* EIO: an AML call failed */
+#define	OK_BUSY		0x04	/* EBUSY, ENOSPC: profile slots */
+#define	OK_INVAL	0x08	/* EINVAL: the value is rejected by design */
+
+enum kind {
+	K_READ,			/* read into a buffer */
+	K_INT,			/* write an int in [lo, hi] */
+	K_BAD,			/* as K_INT, but it must fail with EINVAL */
+	K_SEQ,			/* write a uint64_t, read what is newer */
+	K_CONFIG,		/* read hw.acpi.fan.config and write it back */
+	K_POLICY,		/* load a valid policy program */
+	K_PROFILE,		/* load a profile and make it active */
+	K_OFFSET,		/* set a demand offset */
+};
+
+struct op {
+	const char	*name;		/* below dev.fan.N or hw.acpi.fan */
+	int		 fan;		/* per-fan node */
+	enum kind	 kind;
+	int		 lo, hi;
+	int		 ok;		/* OK_* */
+};
+
+static const struct op ops[] = {
+	/* per fan */
+	{ "fan_speed",		1, K_READ,	0, 0,	OK_GONE | OK_AML },
+	{ "current_fan_level",	1, K_READ,	0, 0,	OK_GONE | OK_AML },
+	{ "rpm",		1, K_READ,	0, 0,	OK_GONE | OK_AML },
+	{ "step_size",		1, K_READ,	0, 0,	OK_GONE },
+	{ "history",		1, K_READ,	0, 0,	OK_GONE },
+	{ "recorder",		1, K_READ,	0, 0,	OK_GONE },
+	{ "temperature",	1, K_READ,	0, 0,	OK_GONE },
+	{ "policy",		1, K_READ,	0, 0,	OK_GONE },
+	{ "policy_faults",	1, K_READ,	0, 0,	OK_GONE },
+	{ "forecast",		1, K_READ,	0, 0,	OK_GONE },
+	{ "headroom",		1, K_READ,	0, 0,	OK_GONE },
+	{ "resistance",		1, K_READ,	0, 0,	OK_GONE },
+	{ "owner",		1, K_READ,	0, 0,	OK_GONE },
+	{ "owner_skipped",	1, K_READ,	0, 0,	OK_GONE },
+	{ "power_capped",	1, K_READ,	0, 0,	OK_GONE },
+	{ "health",		1, K_READ,	0, 0,	OK_GONE },
+	{ "health_score",	1, K_READ,	0, 0,	OK_GONE },
+	{ "health_reasons",	1, K_READ,	0, 0,	OK_GONE },
+	{ "mpc_model",		1, K_READ,	0, 0,	OK_GONE },
+	{ "obstructed",		1, K_READ,	0, 0,	OK_GONE },
+	{ "log",		1, K_SEQ,	0, 0,	OK_GONE },
+	{ "fan_speed",		1, K_INT,	0, 100,	OK_GONE | OK_AML },
+	{ "current_fan_level",	1, K_INT,	0, 100,	OK_GONE | OK_AML },
+	{ "powered",		1, K_INT,	0, 1,	OK_GONE | OK_AML },
+	{ "control",		1, K_INT,	0, 3,	OK_GONE | OK_INVAL },
+	{ "mpc_limit",		1, K_INT,	0, 100,	OK_GONE },
+	{ "priority",		1, K_INT,	0, 7,	OK_GONE },
+	{ "priority",		1, K_BAD,	8, 100,	OK_GONE | OK_INVAL },
+	{ "obstructed",		1, K_INT,	0, 0,	OK_GONE },
+	{ "policy",		1, K_POLICY,	0, 0,	OK_GONE },
+
+	/* global */
+	{ "snapshot",		0, K_SEQ,	0, 0,	0 },
+	{ "epoch",		0, K_SEQ,	0, 0,	0 },
+	{ "summary",		0, K_READ,	0, 0,	0 },
+	{ "offset",		0, K_READ,	0, 0,	0 },
+	{ "config",		0, K_READ,	0, 0,	0 },
+	{ "profile",		0, K_READ,	0, 0,	0 },
+	{ "profiles",		0, K_READ,	0, 0,	0 },
+	{ "aml",		0, K_READ,	0, 0,	0 },
+	{ "trace",		0, K_SEQ,	0, 0,	0 },
+	{ "generation",		0, K_READ,	0, 0,	0 },
+	{ "power",		0, K_READ,	0, 0,	0 },
+	{ "model",		0, K_READ,	0, 0,	0 },
+	{ "tmp_cache_hits",	0, K_READ,	0, 0,	0 },
+	{ "event_dropped",	0, K_READ,	0, 0,	0 },
+	{ "config",		0, K_CONFIG,	0, 0,	OK_GONE | OK_AML },
+	{ "profile_load",	0, K_PROFILE,	0, 0,	OK_BUSY },
+	{ "offset",		0, K_OFFSET,	0, 0,	0 },
+	{ "offset_min",		0, K_INT,	-100, 0, 0 },
+	{ "sample_interval",	0, K_INT,	1, 5,	0 },
+	{ "recorder_interval",	0, K_INT,	0, 5,	0 },
+	{ "recorder_freeze",	0, K_INT,	0, 1,	0 },
+	{ "trace_enable",	0, K_INT,	0, 1,	0 },
+	{ "aml_rate",		0, K_INT,	0, 1000, 0 },
+	{ "aml_burst",		0, K_INT,	1, 64,	0 },
+	{ "tmp_cache_ms",	0, K_INT,	0, 50,	0 },
+	{ "contested_policy",	0, K_INT,	0, 1,	0 },
+	{ "power_cap",		0, K_INT,	0, 5000, 0 },
+	{ "buffer_idle",	0, K_INT,	0, 2,	0 },
+	{ "event_window",	0, K_INT,	0, 100,	0 },
+	{ "event_max",		0, K_INT,	0, 64,	0 },
+	{ "event_window",	0, K_BAD,	-100, -1, OK_INVAL },
+	{ "sample_interval",	0, K_BAD,	-100, -1, OK_INVAL },
+};
+
+#define	NCLASS	4
+static const char *classes[NCLASS] = { "read", "write", "notify",
+    "lifecycle" };
+
+struct tally {
+	uint64_t	ops;
+	uint64_t	err[MAXERRNO];
+};
+
+static struct tally	tallies[NCLASS];
+static uint64_t		unexpected;
+static int		stop;
+static int		nfans = 4, nzones = 2;
+
+static void
+count(int class, int error)
+{
+
+	__atomic_add_fetch(&tallies[class].ops, 1, __ATOMIC_RELAXED);
+	if (error > 0 && error < MAXERRNO)
+		__atomic_add_fetch(&tallies[class].err[error], 1,
+		    __ATOMIC_RELAXED);
+}
+
+static int
+allowed(int ok, int error)
+{
+
+	switch (error) {
+	case 0:
+		return (1);
+	case ENOENT:
+	case ENXIO:
+		return ((ok & OK_GONE) != 0);
+	case EIO:
+		return ((ok & OK_AML) != 0);
+	case EBUSY:
+	case ENOSPC:
+		return ((ok & OK_BUSY) != 0);
+	case EINVAL:
+		return ((ok & OK_INVAL) != 0);
+	}
+	return (0);
+}
+
+static void
+check(const struct op *op, const char *name, int error)
+{
+
+	if (allowed(op->ok, error) && (op->kind != K_BAD || error != 0))
+		return;
+	__atomic_add_fetch(&unexpected, 1, __ATOMIC_RELAXED);
+	fprintf(stderr, "fanstress: %s %s: %s\n",
+	    op->kind == K_READ ? "read" : "write", name,
+	    error != 0 ? strerror(error) : "accepted");
+}
+
+static int
+rnd(unsigned *seed, int lo, int hi)
+{
+
+	return (lo + rand_r(seed) % (hi - lo + 1));
+}
+
+static void
+policy_prog(struct acpi_fan_insn *p, int *n, unsigned *seed)
+{
+
+	/* level = min(temp / 10 - 273, imm), roughly a linear curve */
+	memset(p, 0, 5 * sizeof(*p));
+	p[0].op = ACPI_FAN_OP_LDX;
+	p[0].dst = 0;
+	p[0].imm = ACPI_FAN_IN_TEMP;
+	p[1].op = ACPI_FAN_OP_DIV;
+	p[1].dst = 0;
+	p[1].src = ACPI_FAN_REG_IMM;
+	p[1].imm = 10;
+	p[2].op = ACPI_FAN_OP_SUB;
+	p[2].dst = 0;
+	p[2].src = ACPI_FAN_REG_IMM;
+	p[2].imm = 273;
+	p[3].op = ACPI_FAN_OP_MIN;
+	p[3].dst = 0;
+	p[3].src = ACPI_FAN_REG_IMM;
+	p[3].imm = rnd(seed, 20, 100);
+	p[4].op = ACPI_FAN_OP_RET;
+	p[4].dst = 0;
+	*n = 5;
+}
+
+static int
+profile_load(unsigned *seed)
+{
+	struct {
+		struct acpi_fan_prof_hdr	hdr;
+		struct acpi_fan_prof_fan	fan[2];
+	} p;
+	char name[ACPI_FAN_PROF_NAMELEN];
+	int error, i;
+
+	memset(&p, 0, sizeof(p));
+	p.hdr.magic = ACPI_FAN_PROF_MAGIC;
+	p.hdr.version = ACPI_FAN_PROF_VERSION;
+	p.hdr.count = 2;
+	snprintf(p.hdr.name, sizeof(p.hdr.name), "stress%d", rnd(seed, 0, 9));
+	for (i = 0; i < 2; i++) {
+		p.fan[i].unit = i;
+		p.fan[i].min_level = 0;
+		p.fan[i].max_level = 100;
+		p.fan[i].ramp = rnd(seed, 0, 20);
+		p.fan[i].npoints = 3;
+		p.fan[i].point[0].temp = 30;
+		p.fan[i].point[0].level = 0;
+		p.fan[i].point[1].temp = rnd(seed, 40, 60);
+		p.fan[i].point[1].level = 50;
+		p.fan[i].point[2].temp = 90;
+		p.fan[i].point[2].level = 100;
+	}
+	error = mock_sysctl("hw.acpi.fan.profile_load", NULL, NULL, &p,
+	    sizeof(p));
+	if (error != 0)
+		return (error);
+	/* A slot holding the active profile cannot be replaced: EBUSY. */
+	snprintf(name, sizeof(name), "%s", rand_r(seed) % 4 == 0 ? "" :
+	    p.hdr.name);
+	error = mock_sysctl("hw.acpi.fan.profile", NULL, NULL, name,
+	    strlen(name) + 1);
+	/* Another writer may have replaced it in between. */
+	return (error == ENOENT ? 0 : error);
+}
+
+static int
+run(const struct op *op, char *buf, unsigned *seed)
+{
+	struct acpi_fan_insn prog[ACPI_FAN_POL_MAXINSN];
+	struct acpi_fan_offset off;
+	char name[64];
+	uint64_t seq;
+	size_t len;
+	int error, n, v;
+
+	if (op->fan)
+		snprintf(name, sizeof(name), "dev.fan.%d.%s",
+		    rnd(seed, 0, nfans - 1), op->name);
+	else
+		snprintf(name, sizeof(name), "hw.acpi.fan.%s", op->name);
+
+	len = BUFSZ;
+	switch (op->kind) {
+	case K_READ:
+		error = mock_sysctl(name, buf, &len, NULL, 0);
+		break;
+	case K_INT:
+	case K_BAD:
+		v = rnd(seed, op->lo, op->hi);
+		error = mock_sysctl(name, NULL, NULL, &v, sizeof(v));
+		break;
+	case K_SEQ:
+		seq = rand_r(seed) % 4 == 0 ? 0 : (uint64_t)rand_r(seed) % 64;
+		error = mock_sysctl(name, buf, &len, &seq, sizeof(seq));
+		break;
+	case K_CONFIG:
+		error = mock_sysctl(name, buf, &len, NULL, 0);
+		if (error == 0)
+			error = mock_sysctl(name, NULL, NULL, buf, len);
+		break;
+	case K_POLICY:
+		policy_prog(prog, &n, seed);
+		error = mock_sysctl(name, NULL, NULL, prog,
+		    n * sizeof(prog[0]));
+		break;
+	case K_PROFILE:
+		error = profile_load(seed);
+		break;
+	case K_OFFSET:
+		off.offset = rnd(seed, -20, 20);
+		off.lease = rnd(seed, 0, 2);
+		error = mock_sysctl(name, NULL, NULL, &off, sizeof(off));
+		break;
+	default:
+		abort();
+	}
+	/*
+	 * Nodes of a detached fan are gone, or never were there on ACPI 1.0;
+	 * hw.acpi.fan goes with the last fan.
+	 */
+	if (error == ENOENT)
+		return (0);
+	check(op, name, error);
+	return (error);
+}
+
+static void *
+reader(void *arg)
+{
+	unsigned seed;
+	char *buf;
+	const struct op *op;
+
+	seed = (unsigned)(uintptr_t)arg;
+	buf = malloc(BUFSZ);
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		do
+			op = &ops[rand_r(&seed) % nitems(ops)];
+		while (op->kind != K_READ && op->kind != K_SEQ);
+		count(0, run(op, buf, &seed));
+	}
+	free(buf);
+	return (NULL);
+}
+
+static void *
+writer(void *arg)
+{
+	unsigned seed;
+	char *buf;
+	const struct op *op;
+
+	seed = (unsigned)(uintptr_t)arg;
+	buf = malloc(BUFSZ);
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		do
+			op = &ops[rand_r(&seed) % nitems(ops)];
+		while (op->kind == K_READ || op->kind == K_SEQ);
+		count(1, run(op, buf, &seed));
+		if (rand_r(&seed) % 8 == 0)
+			usleep(100);
+	}
+	free(buf);
+	return (NULL);
+}
+
+static void *
+notifier(void *arg)
+{
+	unsigned seed;
+	uint32_t notify;
+
+	seed = (unsigned)(uintptr_t)arg;
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		notify = rand_r(&seed) % 2 ? 0x80 : 0x81;
+		if (rand_r(&seed) % 2)
+			mock_acpi_notify_fan(rnd(&seed, 0, nfans - 1), notify);
+		else
+			mock_acpi_notify_tz(rnd(&seed, 0, nzones - 1), notify);
+		count(2, 0);
+		usleep(rnd(&seed, 0, 200));
+	}
+	return (NULL);
+}
+
+static void
+lifecycle_check(const char *what, int unit, int error, int ok)
+{
+
+	if (error == 0 || error == ok)
+		return;
+	__atomic_add_fetch(&unexpected, 1, __ATOMIC_RELAXED);
+	fprintf(stderr, "fanstress: %s fan%d: %s\n", what, unit,
+	    strerror(error));
+}
+
+static void *
+lifecycle(void *arg)
+{
+	unsigned seed;
+	int error, i, unit;
+
+	seed = (unsigned)(uintptr_t)arg;
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		unit = rnd(&seed, 0, nfans - 1);
+		switch (rand_r(&seed) % 8) {
+		case 0:
+			/* Detach everything: the last-fan teardown path. */
+			for (i = 0; i < nfans; i++) {
+				error = mock_fan_detach(i);
+				lifecycle_check("detach", i, error, ENXIO);
+				count(3, error);
+			}
+			usleep(rnd(&seed, 0, 2000));
+			for (i = 0; i < nfans; i++) {
+				error = mock_fan_attach(i);
+				lifecycle_check("attach", i, error, EEXIST);
+				count(3, error);
+			}
+			break;
+		case 1:
+		case 2:
+			error = mock_fan_detach(unit);
+			lifecycle_check("detach", unit, error, ENXIO);
+			count(3, error);
+			usleep(rnd(&seed, 0, 2000));
+			error = mock_fan_attach(unit);
+			lifecycle_check("attach", unit, error, EEXIST);
+			count(3, error);
+			break;
+		case 3:
+			error = mock_fan_suspend(unit);
+			lifecycle_check("suspend", unit, error, ENXIO);
+			count(3, error);
+			usleep(rnd(&seed, 0, 1000));
+			error = mock_fan_resume(unit);
+			lifecycle_check("resume", unit, error, ENXIO);
+			count(3, error);
+			break;
+		default:
+			usleep(rnd(&seed, 1000, 5000));
+			break;
+		}
+	}
+	return (NULL);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fanstress [-v] [-a us] [-d seconds] "
+	    "[-e fail%%] [-f fans] [-z zones]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct acpi_fan_aml_hdr aml;
+	struct mock_acpi_conf conf;
+	pthread_t td[8];
+	size_t len;
+	int ch, duration, error, i, nt, one, slow, v;
+
+	duration = 10;
+	slow = 0;
+	memset(&conf, 0, sizeof(conf));
+	conf.fail_pct = 2;
+	conf.acpi1_every = 4;
+	while ((ch = getopt(argc, argv, "a:d:e:f:vz:")) != -1) {
+		switch (ch) {
+		case 'a':
+			slow = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'e':
+			conf.fail_pct = atoi(optarg);
+			break;
+		case 'f':
+			nfans = atoi(optarg);
+			break;
+		case 'v':
+			mock_verbose = 1;
+			break;
+		case 'z':
+			nzones = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind || duration < 1 || nfans < 1 ||
+	    nfans > MOCK_MAXFANS || nzones < 1 || nzones > MOCK_MAXTZ)
+		usage();
+	conf.nfans = nfans;
+	conf.nzones = nzones;
+	mock_acpi_init(&conf);
+
+	for (i = 0; i < nfans; i++)
+		if ((error = mock_fan_attach(i)) != 0)
+			mock_panic("attach fan%d: %s", i, strerror(error));
+	one = 1;
+	if ((error = mock_sysctl("hw.acpi.fan.sample_interval", NULL, NULL,
+	    &one, sizeof(one))) != 0 ||
+	    (error = mock_sysctl("hw.acpi.fan.aml", NULL, NULL, &one,
+	    sizeof(one))) != 0 ||
+	    (error = mock_sysctl("hw.acpi.fan.recorder_interval", NULL, NULL,
+	    &one, sizeof(one))) != 0)
+		mock_panic("setup: %s", strerror(error));
+	mock_fail_set("acpi_fan_detach", 50, 1);
+	/* A slow EC: every tenth AML call of the driver takes slow us. */
+	if (slow > 0)
+		mock_fail_set("acpi_fan_aml", 10, slow);
+
+	nt = 0;
+	for (v = 0; v < 2; v++, nt++)
+		pthread_create(&td[nt], NULL, reader, (void *)(uintptr_t)(nt + 1));
+	for (v = 0; v < 2; v++, nt++)
+		pthread_create(&td[nt], NULL, writer, (void *)(uintptr_t)(nt + 1));
+	for (v = 0; v < 2; v++, nt++)
+		pthread_create(&td[nt], NULL, notifier, (void *)(uintptr_t)(nt + 1));
+	pthread_create(&td[nt], NULL, lifecycle, (void *)(uintptr_t)(nt + 1));
+	nt++;
+	sleep(duration);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < nt; i++)
+		pthread_join(td[i], NULL);
+
+	/* All fans are attached again once the lifecycle thread is done. */
+	len = sizeof(aml);
+	memset(&aml, 0, sizeof(aml));
+	mock_sysctl("hw.acpi.fan.aml", &aml, &len, NULL, 0);
+
+	for (i = 0; i < nfans; i++)
+		mock_fan_detach(i);
+	mock_acpi_fini();
+
+	for (i = 0; i < NCLASS; i++) {
+		printf("%-10s %10ju ops %8.0f/s", classes[i],
+		    (uintmax_t)tallies[i].ops,
+		    (double)tallies[i].ops / duration);
+		for (v = 1; v < MAXERRNO; v++)
+			if (tallies[i].err[v] != 0)
+				printf("  %s %ju", strerror(v),
+				    (uintmax_t)tallies[i].err[v]);
+		printf("\n");
+	}
+	printf("AML lock waits %ju, mean %ju us, max %ju us\n",
+	    (uintmax_t)aml.lock_count, (uintmax_t)(aml.lock_count != 0 ?
+	    aml.lock_wait / aml.lock_count / 1000 : 0),
+	    (uintmax_t)aml.lock_wait_max / 1000);
+	printf("AML calls %ju, devctl events %ju, unexpected errors %ju\n",
+	    (uintmax_t)mock_aml_calls, (uintmax_t)mock_devctl_events,
+	    (uintmax_t)unexpected);
+	return (unexpected != 0);
+}
@@ -0,0 +1,495 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Mock ACPI namespace: fans with _FIF, _FPS, _FST, _FSL, _STA, _ON and
+ * _OFF, and thermal zones with _TMP, _CRT, _ACx and _ALx.  Zone i is
+ * cooled by the fans whose unit is i modulo the number of zones, and
+ * its temperature follows a slow load wave minus what its fans remove.
+ *
+ * Notify handlers run under a read lock that AcpiRemoveNotifyHandler
+ * takes for writing, so removal waits for handlers in flight as
+ * AcpiOsWaitEventsComplete does.
+ */
+
+#define	MOCK_IMPL
+#include "kern.h"
+
+#define	MOCK_FAN	1
+#define	MOCK_TZ		2
+#define	MOCK_NFPS	5
+#define	MOCK_NAC	2
+
+struct mock_node {
+	int			 type;
+	int			 idx;
+	char			 path[24];
+	pthread_rwlock_t	 nh_lock;
+	ACPI_NOTIFY_HANDLER	 nh;
+	void			*nh_context;
+
+	/* fans, protected by mock_acpi_mtx */
+	int			 acpi1;
+	int			 on;
+	int			 level;
+	int			 fine;
+};
+
+static pthread_mutex_t	mock_acpi_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_node	mock_fans[MOCK_MAXFANS];
+static struct mock_node	mock_tzs[MOCK_MAXTZ];
+static struct mock_acpi_conf mock_conf;
+static int64_t		mock_epoch;
+uint64_t		mock_aml_calls;
+
+void
+mock_acpi_init(const struct mock_acpi_conf *conf)
+{
+	struct mock_node *n;
+	int i;
+
+	mock_conf = *conf;
+	mock_conf.nfans = MIN(MAX(conf->nfans, 1), MOCK_MAXFANS);
+	mock_conf.nzones = MIN(MAX(conf->nzones, 1), MOCK_MAXTZ);
+	mock_epoch = mock_sbinuptime();
+	for (i = 0; i < mock_conf.nfans; i++) {
+		n = &mock_fans[i];
+		n->type = MOCK_FAN;
+		n->idx = i;
+		snprintf(n->path, sizeof(n->path), "\\_SB.FAN%d", i);
+		pthread_rwlock_init(&n->nh_lock, NULL);
+		n->acpi1 = conf->acpi1_every > 0 &&
+		    i % conf->acpi1_every == conf->acpi1_every - 1;
+		n->fine = i % 2 == 0;
+		n->on = 1;
+		n->level = 50;
+	}
+	for (i = 0; i < mock_conf.nzones; i++) {
+		n = &mock_tzs[i];
+		n->type = MOCK_TZ;
+		n->idx = i;
+		snprintf(n->path, sizeof(n->path), "\\_TZ.TZ%02d", i);
+		pthread_rwlock_init(&n->nh_lock, NULL);
+	}
+	mock_newbus_init();
+}
+
+void
+mock_acpi_fini(void)
+{
+	int i;
+
+	for (i = 0; i < mock_conf.nfans; i++)
+		pthread_rwlock_destroy(&mock_fans[i].nh_lock);
+	for (i = 0; i < mock_conf.nzones; i++)
+		pthread_rwlock_destroy(&mock_tzs[i].nh_lock);
+}
+
+void *
+mock_acpi_fan_handle(int unit)
+{
+
+	return (&mock_fans[unit]);
+}
+
+static struct mock_node *
+mock_node(ACPI_HANDLE h)
+{
+	struct mock_node *n;
+
+	n = h;
+	if ((n < mock_fans || n >= mock_fans + mock_conf.nfans) &&
+	    (n < mock_tzs || n >= mock_tzs + mock_conf.nzones))
+		mock_panic("bad ACPI handle %p", h);
+	return (n);
+}
+
+/* One AML evaluation; conf.fail_pct of them fail. */
+static int
+mock_aml_fails(void)
+{
+	static __thread unsigned int seed;
+
+	__atomic_fetch_add(&mock_aml_calls, 1, __ATOMIC_RELAXED);
+	mock_may_sleep("AML evaluation");
+	if (seed == 0)
+		seed = (unsigned int)(uintptr_t)&seed;
+	return (mock_conf.fail_pct > 0 &&
+	    rand_r(&seed) % 100 < mock_conf.fail_pct);
+}
+
+/* Zone temperature in tenths of Kelvin. */
+static int
+mock_tz_temp(struct mock_node *n)
+{
+	int64_t ms;
+	int cool, heat, i, nf;
+
+	ms = (mock_sbinuptime() - mock_epoch) / (SBT_1S / 1000);
+	heat = (int)(ms / 10 % 800);
+	heat = heat < 400 ? heat : 800 - heat;
+	cool = nf = 0;
+	pthread_mutex_lock(&mock_acpi_mtx);
+	for (i = n->idx; i < mock_conf.nfans; i += mock_conf.nzones, nf++)
+		cool += mock_fans[i].on ? mock_fans[i].level : 0;
+	pthread_mutex_unlock(&mock_acpi_mtx);
+	return (3082 + mock_conf.load + heat + 200 -
+	    (nf > 0 ? cool * 3 / nf : 0));
+}
+
+static int
+mock_fan_speed(struct mock_node *n)
+{
+
+	return (n->on ? n->level * 50 : 0);
+}
+
+static ACPI_OBJECT *
+mock_pkg(ACPI_OBJECT *o, ACPI_OBJECT *elems, int count)
+{
+
+	o->Package.Type = ACPI_TYPE_PACKAGE;
+	o->Package.Count = count;
+	o->Package.Elements = elems;
+	return (elems + count);
+}
+
+static void
+mock_int(ACPI_OBJECT *o, UINT64 v)
+{
+
+	o->Integer.Type = ACPI_TYPE_INTEGER;
+	o->Integer.Value = v;
+}
+
+/*
+ * Build the result of a package method in one allocation, as ACPICA
+ * does for ACPI_ALLOCATE_BUFFER, so AcpiOsFree() releases all of it.
+ */
+static ACPI_STATUS
+mock_eval_pkg(struct mock_node *n, const char *name, ACPI_BUFFER *ret)
+{
+	ACPI_OBJECT *o, *e, *next;
+	int i, j, count;
+
+	o = calloc(64, sizeof(*o));
+	ret->Pointer = o;
+	ret->Length = 64 * sizeof(*o);
+	if (n->type == MOCK_FAN && !n->acpi1 && strcmp(name, "_FIF") == 0) {
+		mock_pkg(o, o + 1, 4);
+		mock_int(&o[1], 0);
+		mock_int(&o[2], n->fine);
+		mock_int(&o[3], 5);
+		mock_int(&o[4], 1);
+		return (AE_OK);
+	}
+	if (n->type == MOCK_FAN && !n->acpi1 && strcmp(name, "_FST") == 0) {
+		mock_pkg(o, o + 1, 3);
+		pthread_mutex_lock(&mock_acpi_mtx);
+		mock_int(&o[1], 0);
+		mock_int(&o[2], n->level);
+		mock_int(&o[3], mock_fan_speed(n));
+		pthread_mutex_unlock(&mock_acpi_mtx);
+		return (AE_OK);
+	}
+	if (n->type == MOCK_FAN && !n->acpi1 && strcmp(name, "_FPS") == 0) {
+		next = mock_pkg(o, o + 1, MOCK_NFPS + 1);
+		mock_int(&o[1], 0);
+		for (i = 0; i < MOCK_NFPS; i++) {
+			e = &o[2 + i];
+			next = mock_pkg(e, next, 5);
+			j = i * 100 / (MOCK_NFPS - 1);
+			mock_int(&e->Package.Elements[0], j);
+			mock_int(&e->Package.Elements[1], ACPI_UINT32_MAX);
+			mock_int(&e->Package.Elements[2], j * 50);
+			mock_int(&e->Package.Elements[3], j / 2);
+			mock_int(&e->Package.Elements[4], j * 30);
+		}
+		return (AE_OK);
+	}
+	if (n->type == MOCK_TZ && strncmp(name, "_AL", 3) == 0 &&
+	    name[3] - '0' >= 0 && name[3] - '0' < MOCK_NAC) {
+		for (i = n->idx, count = 0; i < mock_conf.nfans;
+		    i += mock_conf.nzones)
+			count++;
+		mock_pkg(o, o + 1, count);
+		for (i = n->idx, j = 1; i < mock_conf.nfans;
+		    i += mock_conf.nzones, j++) {
+			o[j].Reference.Type = ACPI_TYPE_LOCAL_REFERENCE;
+			o[j].Reference.ActualType = ACPI_TYPE_DEVICE;
+			o[j].Reference.Handle = &mock_fans[i];
+		}
+		return (AE_OK);
+	}
+	free(o);
+	ret->Pointer = NULL;
+	ret->Length = 0;
+	return (AE_NOT_FOUND);
+}
+
+static ACPI_STATUS
+mock_eval_int(struct mock_node *n, const char *name, UINT32 *v)
+{
+
+	if (n->type == MOCK_FAN && strcmp(name, "_STA") == 0) {
+		pthread_mutex_lock(&mock_acpi_mtx);
+		*v = n->acpi1 ? (UINT32)n->on : 0x0f;
+		pthread_mutex_unlock(&mock_acpi_mtx);
+		return (AE_OK);
+	}
+	if (n->type == MOCK_TZ && strcmp(name, "_TMP") == 0) {
+		*v = mock_tz_temp(n);
+		return (AE_OK);
+	}
+	if (n->type == MOCK_TZ && strcmp(name, "_CRT") == 0) {
+		*v = 3632;
+		return (AE_OK);
+	}
+	if (n->type == MOCK_TZ && strncmp(name, "_AC", 3) == 0 &&
+	    name[3] - '0' >= 0 && name[3] - '0' < MOCK_NAC) {
+		*v = 3382 - 100 * (name[3] - '0');
+		return (AE_OK);
+	}
+	return (AE_NOT_FOUND);
+}
+
+ACPI_STATUS
+AcpiEvaluateObject(ACPI_HANDLE h, const char *path, ACPI_OBJECT_LIST *args,
+    ACPI_BUFFER *ret)
+{
+	struct mock_node *n;
+	ACPI_STATUS status;
+	UINT32 v;
+
+	n = mock_node(h);
+	if (mock_aml_fails())
+		return (AE_AML_INTERNAL);
+	if (n->type == MOCK_FAN && (strcmp(path, "_ON") == 0 ||
+	    strcmp(path, "_OFF") == 0)) {
+		pthread_mutex_lock(&mock_acpi_mtx);
+		n->on = path[2] == 'N';
+		pthread_mutex_unlock(&mock_acpi_mtx);
+		return (AE_OK);
+	}
+	if (n->type == MOCK_FAN && !n->acpi1 && strcmp(path, "_FSL") == 0) {
+		if (args == NULL || args->Count != 1 ||
+		    args->Pointer[0].Type != ACPI_TYPE_INTEGER)
+			return (AE_BAD_PARAMETER);
+		pthread_mutex_lock(&mock_acpi_mtx);
+		n->level = (int)MIN(args->Pointer[0].Integer.Value, 100);
+		pthread_mutex_unlock(&mock_acpi_mtx);
+		return (AE_OK);
+	}
+	if (ret == NULL)
+		return (AE_BAD_PARAMETER);
+	if (ret->Length != ACPI_ALLOCATE_BUFFER)
+		mock_panic("%s: only ACPI_ALLOCATE_BUFFER results", path);
+	status = mock_eval_pkg(n, path, ret);
+	if (status != AE_NOT_FOUND)
+		return (status);
+	status = mock_eval_int(n, path, &v);
+	if (ACPI_SUCCESS(status)) {
+		ret->Pointer = calloc(1, sizeof(ACPI_OBJECT));
+		ret->Length = sizeof(ACPI_OBJECT);
+		mock_int(ret->Pointer, v);
+	}
+	return (status);
+}
+
+ACPI_STATUS
+AcpiGetHandle(ACPI_HANDLE parent, const char *path, ACPI_HANDLE *ret)
+{
+	int i;
+
+	for (i = 0; i < mock_conf.nzones; i++)
+		if (strcmp(mock_tzs[i].path, path) == 0) {
+			*ret = &mock_tzs[i];
+			return (AE_OK);
+		}
+	for (i = 0; i < mock_conf.nfans; i++)
+		if (strcmp(mock_fans[i].path, path) == 0) {
+			*ret = &mock_fans[i];
+			return (AE_OK);
+		}
+	return (AE_NOT_FOUND);
+}
+
+ACPI_STATUS
+AcpiInstallNotifyHandler(ACPI_HANDLE h, UINT32 type,
+    ACPI_NOTIFY_HANDLER handler, void *context)
+{
+	struct mock_node *n;
+	ACPI_STATUS status;
+
+	n = mock_node(h);
+	pthread_rwlock_wrlock(&n->nh_lock);
+	if (n->nh != NULL)
+		status = AE_ALREADY_EXISTS;
+	else {
+		n->nh = handler;
+		n->nh_context = context;
+		status = AE_OK;
+	}
+	pthread_rwlock_unlock(&n->nh_lock);
+	return (status);
+}
+
+ACPI_STATUS
+AcpiRemoveNotifyHandler(ACPI_HANDLE h, UINT32 type,
+    ACPI_NOTIFY_HANDLER handler)
+{
+	struct mock_node *n;
+	ACPI_STATUS status;
+
+	n = mock_node(h);
+	mock_may_sleep("AcpiRemoveNotifyHandler");
+	pthread_rwlock_wrlock(&n->nh_lock);
+	if (n->nh != handler)
+		status = AE_NOT_EXIST;
+	else {
+		n->nh = NULL;
+		n->nh_context = NULL;
+		status = AE_OK;
+	}
+	pthread_rwlock_unlock(&n->nh_lock);
+	return (status);
+}
+
+static void
+mock_notify(struct mock_node *n, UINT32 notify)
+{
+
+	pthread_rwlock_rdlock(&n->nh_lock);
+	if (n->nh != NULL)
+		n->nh(n, notify, n->nh_context);
+	pthread_rwlock_unlock(&n->nh_lock);
+}
+
+void
+mock_acpi_notify_fan(int unit, uint32_t notify)
+{
+
+	mock_notify(&mock_fans[unit], notify);
+}
+
+void
+mock_acpi_notify_tz(int zone, uint32_t notify)
+{
+
+	mock_notify(&mock_tzs[zone], notify);
+}
+
+ACPI_STATUS
+AcpiWalkNamespace(ACPI_OBJECT_TYPE type, ACPI_HANDLE start, UINT32 depth,
+    ACPI_WALK_CALLBACK pre, ACPI_WALK_CALLBACK post, void *context,
+    void **ret)
+{
+	ACPI_STATUS status;
+	int i;
+
+	if (type != ACPI_TYPE_THERMAL)
+		return (AE_OK);
+	for (i = 0; i < mock_conf.nzones; i++) {
+		status = pre(&mock_tzs[i], 1, context, ret);
+		if (status == AE_CTRL_TERMINATE)
+			break;
+	}
+	return (AE_OK);
+}
+
+void
+AcpiOsFree(void *p)
+{
+
+	free(p);
+}
+
+const char *
+AcpiFormatException(ACPI_STATUS status)
+{
+
+	switch (status) {
+	case AE_OK:
+		return ("AE_OK");
+	case AE_NOT_FOUND:
+		return ("AE_NOT_FOUND");
+	case AE_BAD_PARAMETER:
+		return ("AE_BAD_PARAMETER");
+	case AE_AML_INTERNAL:
+		return ("AE_AML_INTERNAL");
+	}
+	return ("AE_ERROR");
+}
+
+const char *
+acpi_name(ACPI_HANDLE h)
+{
+
+	return (mock_node(h)->path);
+}
+
+int
+acpi_DeviceIsPresent(device_t dev)
+{
+
+	mock_node(acpi_get_handle(dev));
+	return (!mock_aml_fails());
+}
+
+ACPI_STATUS
+acpi_GetInteger(ACPI_HANDLE h, const char *path, UINT32 *number)
+{
+	struct mock_node *n;
+
+	n = mock_node(h);
+	if (mock_aml_fails())
+		return (AE_AML_INTERNAL);
+	return (mock_eval_int(n, path, number));
+}
+
+ACPI_STATUS
+acpi_SetInteger(ACPI_HANDLE h, const char *path, UINT32 number)
+{
+	ACPI_OBJECT arg;
+	ACPI_OBJECT_LIST args;
+
+	mock_int(&arg, number);
+	args.Count = 1;
+	args.Pointer = &arg;
+	return (AcpiEvaluateObject(h, path, &args, NULL));
+}
+
+ACPI_STATUS
+acpi_GetHandleInScope(ACPI_HANDLE parent, const char *path,
+    ACPI_HANDLE *result)
+{
+	struct mock_node *n;
+
+	n = mock_node(parent);
+	if (n->type != MOCK_FAN || n->acpi1 || strcmp(path, "_FSL") != 0)
+		return (AE_NOT_FOUND);
+	*result = n;
+	return (AE_OK);
+}
+
+ACPI_STATUS
+acpi_PkgInt32(ACPI_OBJECT *res, int idx, UINT32 *dst)
+{
+	ACPI_OBJECT *o;
+
+	if (idx < 0 || (UINT32)idx >= res->Package.Count)
+		return (AE_BAD_PARAMETER);
+	o = &res->Package.Elements[idx];
+	if (o->Type != ACPI_TYPE_INTEGER)
+		return (AE_BAD_DATA);
+	*dst = (UINT32)o->Integer.Value;
+	return (AE_OK);
+}
+
+ACPI_HANDLE
+acpi_GetReference(ACPI_HANDLE scope, ACPI_OBJECT *obj)
+{
+
+	if (obj == NULL || obj->Type != ACPI_TYPE_LOCAL_REFERENCE)
+		return (NULL);
+	return (obj->Reference.Handle);
+}
@@ -0,0 +1,138 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * The part of ACPICA and of the acpi(4) glue acpi_fan.c uses.  Handles
+ * point at nodes of the mock namespace in acpi.c.
+ */
+
+#ifndef _MOCK_ACPICA_H_
+#define	_MOCK_ACPICA_H_
+
+typedef uint8_t		UINT8;
+typedef uint32_t	UINT32;
+typedef uint64_t	UINT64;
+typedef UINT32		ACPI_STATUS;
+typedef UINT32		ACPI_OBJECT_TYPE;
+typedef void		*ACPI_HANDLE;
+
+#define	AE_OK			0x0000
+#define	AE_ERROR		0x0001
+#define	AE_NO_MEMORY		0x0004
+#define	AE_NOT_FOUND		0x0005
+#define	AE_NOT_EXIST		0x0006
+#define	AE_ALREADY_EXISTS	0x0007
+#define	AE_TYPE			0x0009
+#define	AE_TIME			0x0011
+#define	AE_BAD_PARAMETER	0x1001
+#define	AE_BAD_DATA		0x3000
+#define	AE_AML_INTERNAL		0x300d
+#define	AE_CTRL_TERMINATE	0x4000
+
+#define	ACPI_SUCCESS(s)		((s) == AE_OK)
+#define	ACPI_FAILURE(s)		((s) != AE_OK)
+
+#define	ACPI_UINT32_MAX		0xffffffffU
+#define	ACPI_ROOT_OBJECT	((ACPI_HANDLE)(uintptr_t)-1)
+#define	ACPI_ALLOCATE_BUFFER	((size_t)-1)
+#define	ACPI_DEVICE_NOTIFY	0x2
+
+#define	ACPI_TYPE_INTEGER	0x01
+#define	ACPI_TYPE_PACKAGE	0x04
+#define	ACPI_TYPE_DEVICE	0x06
+#define	ACPI_TYPE_THERMAL	0x0d
+#define	ACPI_TYPE_LOCAL_REFERENCE 0x14
+
+typedef union acpi_object {
+	ACPI_OBJECT_TYPE	Type;
+	struct {
+		ACPI_OBJECT_TYPE	Type;
+		UINT64			Value;
+	} Integer;
+	struct {
+		ACPI_OBJECT_TYPE	Type;
+		UINT32			Count;
+		union acpi_object	*Elements;
+	} Package;
+	struct {
+		ACPI_OBJECT_TYPE	Type;
+		ACPI_OBJECT_TYPE	ActualType;
+		ACPI_HANDLE		Handle;
+	} Reference;
+} ACPI_OBJECT;
+
+typedef struct {
+	size_t		 Length;
+	void		*Pointer;
+} ACPI_BUFFER;
+
+typedef struct {
+	UINT32		 Count;
+	ACPI_OBJECT	*Pointer;
+} ACPI_OBJECT_LIST;
+
+typedef void (*ACPI_NOTIFY_HANDLER)(ACPI_HANDLE, UINT32, void *);
+typedef ACPI_STATUS (*ACPI_WALK_CALLBACK)(ACPI_HANDLE, UINT32, void *,
+    void **);
+
+#define	ACPI_MODULE_NAME(name)
+
+ACPI_STATUS	AcpiEvaluateObject(ACPI_HANDLE h, const char *path,
+		    ACPI_OBJECT_LIST *args, ACPI_BUFFER *ret);
+ACPI_STATUS	AcpiGetHandle(ACPI_HANDLE parent, const char *path,
+		    ACPI_HANDLE *ret);
+ACPI_STATUS	AcpiInstallNotifyHandler(ACPI_HANDLE h, UINT32 type,
+		    ACPI_NOTIFY_HANDLER handler, void *context);
+ACPI_STATUS	AcpiRemoveNotifyHandler(ACPI_HANDLE h, UINT32 type,
+		    ACPI_NOTIFY_HANDLER handler);
+ACPI_STATUS	AcpiWalkNamespace(ACPI_OBJECT_TYPE type, ACPI_HANDLE start,
+		    UINT32 depth, ACPI_WALK_CALLBACK pre,
+		    ACPI_WALK_CALLBACK post, void *context, void **ret);
+void		AcpiOsFree(void *p);
+const char	*AcpiFormatException(ACPI_STATUS status);
+
+/* dev/acpica/acpivar.h */
+struct acpi_softc {
+	struct sysctl_ctx_list	 acpi_sysctl_ctx;
+	struct sysctl_oid	*acpi_sysctl_tree;
+};
+
+#define	ACPI_SERIAL_DECL(sys, name)					\
+static struct sx acpi_##sys##_sxlock;					\
+static void __attribute__((__constructor__))				\
+acpi_##sys##_sxinit(void)						\
+{									\
+									\
+	sx_init(&acpi_##sys##_sxlock, "ACPI " #sys);			\
+}
+#define	ACPI_SERIAL_BEGIN(sys)	sx_xlock(&acpi_##sys##_sxlock)
+#define	ACPI_SERIAL_END(sys)	sx_xunlock(&acpi_##sys##_sxlock)
+#define	ACPI_SERIAL_ASSERT(sys)	sx_assert(&acpi_##sys##_sxlock, SA_XLOCKED)
+
+#define	ACPI_STA_PRESENT	0x00000001
+#define	ACPI_DEVICE_PRESENT(x)	(((x) & ACPI_STA_PRESENT) != 0)
+
+#define	ACPI_PKG_VALID(pkg, size)					\
+	((pkg) != NULL && (pkg)->Type == ACPI_TYPE_PACKAGE &&		\
+	(pkg)->Package.Count >= (size))
+#define	ACPI_VPRINT(dev, acpi_sc, ...) do {				\
+	(void)(acpi_sc);						\
+	if (mock_verbose)						\
+		device_printf((dev), __VA_ARGS__);			\
+} while (0)
+#define	ACPI_ID_PROBE(bus, dev, ids, match)	((void)(ids), 0)
+
+ACPI_HANDLE	acpi_get_handle(device_t dev);
+void		*acpi_device_get_parent_softc(device_t dev);
+int		acpi_disabled(const char *subsys);
+const char	*acpi_name(ACPI_HANDLE h);
+int		acpi_DeviceIsPresent(device_t dev);
+ACPI_STATUS	acpi_GetInteger(ACPI_HANDLE h, const char *path,
+		    UINT32 *number);
+ACPI_STATUS	acpi_SetInteger(ACPI_HANDLE h, const char *path,
+		    UINT32 number);
+ACPI_STATUS	acpi_GetHandleInScope(ACPI_HANDLE parent, const char *path,
+		    ACPI_HANDLE *result);
+ACPI_STATUS	acpi_PkgInt32(ACPI_OBJECT *res, int idx, UINT32 *dst);
+ACPI_HANDLE	acpi_GetReference(ACPI_HANDLE scope, ACPI_OBJECT *obj);
+
+#endif /* !_MOCK_ACPICA_H_ */
@@ -0,0 +1 @@
+#include "../../../../../acpi_fanio.h"
@@ -0,0 +1,71 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * sysctlbyname(3) for the userland tools, backed by acpi_fan.c running
+ * on the mock kernel, so that they can be run without the hardware.
+ * The first call boots a machine of FANMOCK_FANS fans (default 4) and
+ * FANMOCK_ZONES thermal zones (default 2) sampled every
+ * FANMOCK_SAMPLE_MS ms (default 10), its zones FANMOCK_LOAD tenths of
+ * a degree hotter than the mock makes them.  Every process boots its
+ * own machine, so separate processes are separate nodes.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock.h"
+#include "host/sys/sysctl.h"
+
+static pthread_once_t	host_once = PTHREAD_ONCE_INIT;
+
+static int
+host_env(const char *name, int def)
+{
+	const char *v;
+
+	v = getenv(name);
+	return (v != NULL && *v != '\0' ? atoi(v) : def);
+}
+
+static void
+host_boot(void)
+{
+	struct mock_acpi_conf conf;
+	int error, i, ms;
+
+	/* hw.acpi.fan.model, unless the environment names one */
+	setenv("smbios.system.product", "fanmock", 0);
+	memset(&conf, 0, sizeof(conf));
+	conf.nfans = host_env("FANMOCK_FANS", 4);
+	conf.nzones = host_env("FANMOCK_ZONES", 2);
+	conf.load = host_env("FANMOCK_LOAD", 0);
+	if (conf.nfans < 1 || conf.nfans > MOCK_MAXFANS ||
+	    conf.nzones < 1 || conf.nzones > MOCK_MAXTZ)
+		mock_panic("FANMOCK_FANS or FANMOCK_ZONES out of range");
+	mock_acpi_init(&conf);
+	for (i = 0; i < conf.nfans; i++)
+		if ((error = mock_fan_attach(i)) != 0)
+			mock_panic("attach fan%d: %s", i, strerror(error));
+	ms = host_env("FANMOCK_SAMPLE_MS", 10);
+	if ((error = mock_sysctl("hw.acpi.fan.sample_interval", NULL, NULL,
+	    &ms, sizeof(ms))) != 0)
+		mock_panic("sample_interval: %s", strerror(error));
+}
+
+int
+sysctlbyname(const char *name, void *oldp, size_t *oldlenp,
+    const void *newp, size_t newlen)
+{
+	int error;
+
+	pthread_once(&host_once, host_boot);
+	if ((error = mock_sysctl(name, oldp, oldlenp, newp, newlen)) != 0) {
+		errno = error;
+		return (-1);
+	}
+	return (0);
+}
@@ -0,0 +1,16 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * What the userland tools use of <sys/sysctl.h>, for building them
+ * against the mock driver (make tools).  See host.c.
+ */
+
+#ifndef _MOCK_HOST_SYS_SYSCTL_H_
+#define	_MOCK_HOST_SYS_SYSCTL_H_
+
+#include <stddef.h>
+
+int	sysctlbyname(const char *name, void *oldp, size_t *oldlenp,
+	    const void *newp, size_t newlen);
+
+#endif /* !_MOCK_HOST_SYS_SYSCTL_H_ */
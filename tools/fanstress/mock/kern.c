@@ -0,0 +1,1103 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Mock kernel: locks, malloc, callouts, taskqueues, the sysctl tree and
+ * just enough newbus to attach and detach the driver.  See kern.h.
+ */
+
+#define	MOCK_IMPL
+#include "kern.h"
+
+#include <time.h>
+#include <unistd.h>
+
+int		mock_verbose;
+u_int		mock_mp_maxid = 3;
+uint64_t	mock_devctl_events;
+struct mock_loadavg mock_averunnable = { { 1024, 1024, 1024 }, 2048 };
+
+/* held locks of this thread, for the WITNESS-like checks */
+static __thread int		 mock_mtx_held;
+static __thread const char	*mock_mtx_last;
+static __thread int		 mock_sx_held;
+
+void
+mock_panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "panic: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	abort();
+}
+
+/* Anything that may sleep in the kernel must not hold a mutex. */
+void
+mock_may_sleep(const char *what)
+{
+
+	if (mock_mtx_held != 0)
+		mock_panic("%s with mutex \"%s\" held", what, mock_mtx_last);
+}
+
+int64_t
+mock_sbinuptime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((int64_t)ts.tv_sec << 32) +
+	    (((uint64_t)ts.tv_nsec << 32) / 1000000000));
+}
+
+int
+mock_pause_sbt(const char *wmesg, int64_t sbt)
+{
+	struct timespec ts;
+
+	mock_may_sleep(wmesg);
+	ts.tv_sec = sbt >> 32;
+	ts.tv_nsec = ((sbt & 0xffffffff) * 1000000000) >> 32;
+	nanosleep(&ts, NULL);
+	return (0);
+}
+
+size_t
+mock_strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len;
+
+	len = strlen(src);
+	if (size > 0) {
+		memcpy(dst, src, MIN(len, size - 1));
+		dst[MIN(len, size - 1)] = '\0';
+	}
+	return (len);
+}
+
+/* malloc(9) */
+void *
+mock_malloc(size_t size, struct malloc_type *type, int flags)
+{
+	void *p;
+
+	if (flags & M_WAITOK)
+		mock_may_sleep("malloc(M_WAITOK)");
+	p = (flags & M_ZERO) ? calloc(1, size) : malloc(size);
+	if (p == NULL && (flags & M_WAITOK))
+		mock_panic("malloc(%zu) for %s failed", size,
+		    type->ks_shortdesc);
+	return (p);
+}
+
+void *
+mock_mallocarray(size_t nmemb, size_t size, struct malloc_type *type,
+    int flags)
+{
+
+	if (size != 0 && nmemb > SIZE_MAX / size)
+		mock_panic("mallocarray(%zu, %zu) overflows", nmemb, size);
+	return (mock_malloc(nmemb * size, type, flags));
+}
+
+void
+mock_free(void *addr)
+{
+
+	free(addr);
+}
+
+/* mutex(9) and sx(9); owners are read by other threads' assertions */
+static int
+mock_owned(pthread_t *owner, int *owned)
+{
+
+	return (__atomic_load_n(owned, __ATOMIC_RELAXED) &&
+	    pthread_equal(__atomic_load_n(owner, __ATOMIC_RELAXED),
+	    pthread_self()));
+}
+
+static void
+mock_own(pthread_t *owner, int *owned, int on)
+{
+
+	if (on)
+		__atomic_store_n(owner, pthread_self(), __ATOMIC_RELAXED);
+	__atomic_store_n(owned, on, __ATOMIC_RELAXED);
+}
+
+void
+mtx_init(struct mtx *m, const char *name, const char *type, int opts)
+{
+
+	pthread_mutex_init(&m->mtx_lock, NULL);
+	m->mtx_name = name;
+	m->mtx_owned = 0;
+}
+
+void
+mtx_destroy(struct mtx *m)
+{
+
+	pthread_mutex_destroy(&m->mtx_lock);
+}
+
+void
+mtx_lock(struct mtx *m)
+{
+
+	if (mock_owned(&m->mtx_owner, &m->mtx_owned))
+		mock_panic("mutex \"%s\" recursed", m->mtx_name);
+	pthread_mutex_lock(&m->mtx_lock);
+	mock_own(&m->mtx_owner, &m->mtx_owned, 1);
+	mock_mtx_held++;
+	mock_mtx_last = m->mtx_name;
+}
+
+void
+mtx_unlock(struct mtx *m)
+{
+
+	if (!mock_owned(&m->mtx_owner, &m->mtx_owned))
+		mock_panic("mutex \"%s\" not owned", m->mtx_name);
+	mock_own(&m->mtx_owner, &m->mtx_owned, 0);
+	mock_mtx_held--;
+	pthread_mutex_unlock(&m->mtx_lock);
+}
+
+void
+mtx_assert(struct mtx *m, int what)
+{
+
+	if ((what & MA_OWNED) && !mock_owned(&m->mtx_owner, &m->mtx_owned))
+		mock_panic("mutex \"%s\" not owned", m->mtx_name);
+}
+
+void
+sx_init(struct sx *sx, const char *name)
+{
+
+	pthread_mutex_init(&sx->sx_lock, NULL);
+	sx->sx_name = name;
+	sx->sx_owned = 0;
+}
+
+void
+sx_xlock(struct sx *sx)
+{
+
+	mock_may_sleep("sx_xlock");
+	if (mock_owned(&sx->sx_owner, &sx->sx_owned))
+		mock_panic("sx \"%s\" recursed", sx->sx_name);
+	pthread_mutex_lock(&sx->sx_lock);
+	mock_own(&sx->sx_owner, &sx->sx_owned, 1);
+	mock_sx_held++;
+}
+
+void
+sx_xunlock(struct sx *sx)
+{
+
+	if (!mock_owned(&sx->sx_owner, &sx->sx_owned))
+		mock_panic("sx \"%s\" not owned", sx->sx_name);
+	mock_own(&sx->sx_owner, &sx->sx_owned, 0);
+	mock_sx_held--;
+	pthread_mutex_unlock(&sx->sx_lock);
+}
+
+void
+sx_assert(struct sx *sx, int what)
+{
+
+	if ((what & SA_XLOCKED) && !mock_owned(&sx->sx_owner, &sx->sx_owned))
+		mock_panic("sx \"%s\" not owned", sx->sx_name);
+}
+
+/* fail(9) */
+struct mock_fp {
+	char	name[32];
+	int	pct;
+	int	value;
+};
+
+static pthread_mutex_t	mock_fp_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_fp	mock_fps[8];
+
+void
+mock_fail_set(const char *name, int pct, int value)
+{
+	struct mock_fp *fp;
+	int i;
+
+	pthread_mutex_lock(&mock_fp_mtx);
+	for (i = 0, fp = NULL; i < (int)nitems(mock_fps); i++) {
+		if (strcmp(mock_fps[i].name, name) == 0) {
+			fp = &mock_fps[i];
+			break;
+		}
+		if (fp == NULL && mock_fps[i].name[0] == '\0')
+			fp = &mock_fps[i];
+	}
+	if (fp == NULL)
+		mock_panic("too many fail points");
+	mock_strlcpy(fp->name, name, sizeof(fp->name));
+	fp->pct = pct;
+	fp->value = value;
+	pthread_mutex_unlock(&mock_fp_mtx);
+}
+
+int
+mock_fail_point(const char *name, int *value)
+{
+	static __thread unsigned int seed;
+	int i, fire;
+
+	if (seed == 0)
+		seed = (unsigned int)(uintptr_t)&seed ^ (unsigned int)time(NULL);
+	fire = 0;
+	pthread_mutex_lock(&mock_fp_mtx);
+	for (i = 0; i < (int)nitems(mock_fps); i++)
+		if (strcmp(mock_fps[i].name, name) == 0) {
+			fire = mock_fps[i].pct > 0 &&
+			    rand_r(&seed) % 100 < mock_fps[i].pct;
+			*value = mock_fps[i].value;
+			break;
+		}
+	pthread_mutex_unlock(&mock_fp_mtx);
+	return (fire);
+}
+
+/* callout(9), run by one timer thread like softclock */
+static pthread_mutex_t	mock_co_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	mock_co_cv;
+static pthread_cond_t	mock_co_done = PTHREAD_COND_INITIALIZER;
+static pthread_once_t	mock_co_once = PTHREAD_ONCE_INIT;
+static TAILQ_HEAD(, callout) mock_co_list =
+    TAILQ_HEAD_INITIALIZER(mock_co_list);
+static struct callout	*mock_co_curr;
+static struct callout	*mock_co_draining;
+
+static void *
+mock_co_thread(void *arg)
+{
+	struct callout *c;
+	struct timespec ts;
+	void (*func)(void *);
+	void *farg;
+	int64_t now;
+
+	pthread_mutex_lock(&mock_co_mtx);
+	for (;;) {
+		c = TAILQ_FIRST(&mock_co_list);
+		now = mock_sbinuptime();
+		if (c == NULL) {
+			pthread_cond_wait(&mock_co_cv, &mock_co_mtx);
+			continue;
+		}
+		if (c->c_time > now) {
+			ts.tv_sec = c->c_time >> 32;
+			ts.tv_nsec = ((c->c_time & 0xffffffff) * 1000000000) >>
+			    32;
+			pthread_cond_timedwait(&mock_co_cv, &mock_co_mtx, &ts);
+			continue;
+		}
+		TAILQ_REMOVE(&mock_co_list, c, c_link);
+		c->c_pending = 0;
+		func = c->c_func;
+		farg = c->c_arg;
+		mock_co_curr = c;
+		pthread_mutex_unlock(&mock_co_mtx);
+		func(farg);
+		pthread_mutex_lock(&mock_co_mtx);
+		mock_co_curr = NULL;
+		pthread_cond_broadcast(&mock_co_done);
+	}
+	return (NULL);
+}
+
+static void
+mock_co_start(void)
+{
+	pthread_condattr_t attr;
+	pthread_t td;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mock_co_cv, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&td, NULL, mock_co_thread, NULL) != 0)
+		mock_panic("cannot start the callout thread");
+	pthread_detach(td);
+}
+
+void
+callout_init(struct callout *c, int mpsafe)
+{
+
+	pthread_once(&mock_co_once, mock_co_start);
+	memset(c, 0, sizeof(*c));
+}
+
+int
+callout_reset_sbt_on(struct callout *c, sbintime_t sbt, sbintime_t pr,
+    void (*func)(void *), void *arg, int cpu, int flags)
+{
+	struct callout *n;
+	int pending;
+
+	pthread_mutex_lock(&mock_co_mtx);
+	/* Like callout_drain(9), a handler cannot rearm what is drained. */
+	if (mock_co_draining == c) {
+		pthread_mutex_unlock(&mock_co_mtx);
+		return (0);
+	}
+	pending = c->c_pending;
+	if (pending)
+		TAILQ_REMOVE(&mock_co_list, c, c_link);
+	c->c_time = (flags & C_ABSOLUTE) ? sbt : mock_sbinuptime() + sbt;
+	c->c_func = func;
+	c->c_arg = arg;
+	c->c_pending = 1;
+	TAILQ_FOREACH(n, &mock_co_list, c_link)
+		if (n->c_time > c->c_time)
+			break;
+	if (n != NULL)
+		TAILQ_INSERT_BEFORE(n, c, c_link);
+	else
+		TAILQ_INSERT_TAIL(&mock_co_list, c, c_link);
+	pthread_cond_signal(&mock_co_cv);
+	pthread_mutex_unlock(&mock_co_mtx);
+	return (pending);
+}
+
+int
+callout_drain(struct callout *c)
+{
+	int pending;
+
+	mock_may_sleep("callout_drain");
+	pthread_mutex_lock(&mock_co_mtx);
+	pending = c->c_pending;
+	if (pending) {
+		TAILQ_REMOVE(&mock_co_list, c, c_link);
+		c->c_pending = 0;
+	}
+	mock_co_draining = c;
+	while (mock_co_curr == c)
+		pthread_cond_wait(&mock_co_done, &mock_co_mtx);
+	mock_co_draining = NULL;
+	pthread_mutex_unlock(&mock_co_mtx);
+	return (pending);
+}
+
+/* taskqueue(9) */
+struct taskqueue {
+	pthread_mutex_t		 tq_mtx;
+	pthread_cond_t		 tq_cv;
+	STAILQ_HEAD(, task)	 tq_queue;
+	struct task		*tq_running;
+	pthread_t		 tq_thread;
+	int			 tq_started;
+	int			 tq_exit;
+};
+
+struct taskqueue *
+taskqueue_create(const char *name, int mflags, taskqueue_enqueue_fn *enqueue,
+    void *context)
+{
+	struct taskqueue *tq;
+
+	if (mflags & M_WAITOK)
+		mock_may_sleep("taskqueue_create");
+	tq = calloc(1, sizeof(*tq));
+	pthread_mutex_init(&tq->tq_mtx, NULL);
+	pthread_cond_init(&tq->tq_cv, NULL);
+	STAILQ_INIT(&tq->tq_queue);
+	return (tq);
+}
+
+void
+taskqueue_thread_enqueue(void *context)
+{
+}
+
+static void *
+mock_tq_thread(void *arg)
+{
+	struct taskqueue *tq;
+	struct task *t;
+	int pending;
+
+	tq = arg;
+	pthread_mutex_lock(&tq->tq_mtx);
+	for (;;) {
+		t = STAILQ_FIRST(&tq->tq_queue);
+		if (t == NULL) {
+			if (tq->tq_exit)
+				break;
+			pthread_cond_wait(&tq->tq_cv, &tq->tq_mtx);
+			continue;
+		}
+		STAILQ_REMOVE_HEAD(&tq->tq_queue, ta_link);
+		pending = t->ta_pending;
+		t->ta_pending = 0;
+		tq->tq_running = t;
+		pthread_mutex_unlock(&tq->tq_mtx);
+		t->ta_func(t->ta_context, pending);
+		pthread_mutex_lock(&tq->tq_mtx);
+		tq->tq_running = NULL;
+		pthread_cond_broadcast(&tq->tq_cv);
+	}
+	pthread_mutex_unlock(&tq->tq_mtx);
+	return (NULL);
+}
+
+int
+taskqueue_start_threads(struct taskqueue **tqp, int count, int pri,
+    const char *name, ...)
+{
+	struct taskqueue *tq;
+
+	tq = *tqp;
+	if (count != 1)
+		mock_panic("one taskqueue thread only");
+	if (pthread_create(&tq->tq_thread, NULL, mock_tq_thread, tq) != 0)
+		return (ENOMEM);
+	tq->tq_started = 1;
+	return (0);
+}
+
+int
+taskqueue_start_threads_cpuset(struct taskqueue **tqp, int count, int pri,
+    cpuset_t *mask, const char *name, ...)
+{
+
+	return (taskqueue_start_threads(tqp, count, pri, name));
+}
+
+int
+taskqueue_enqueue(struct taskqueue *tq, struct task *t)
+{
+
+	pthread_mutex_lock(&tq->tq_mtx);
+	if (t->ta_pending == 0)
+		STAILQ_INSERT_TAIL(&tq->tq_queue, t, ta_link);
+	if (t->ta_pending < 0xffff)
+		t->ta_pending++;
+	pthread_cond_broadcast(&tq->tq_cv);
+	pthread_mutex_unlock(&tq->tq_mtx);
+	return (0);
+}
+
+void
+taskqueue_drain(struct taskqueue *tq, struct task *t)
+{
+
+	mock_may_sleep("taskqueue_drain");
+	pthread_mutex_lock(&tq->tq_mtx);
+	while (t->ta_pending != 0 || tq->tq_running == t)
+		pthread_cond_wait(&tq->tq_cv, &tq->tq_mtx);
+	pthread_mutex_unlock(&tq->tq_mtx);
+}
+
+void
+taskqueue_free(struct taskqueue *tq)
+{
+
+	mock_may_sleep("taskqueue_free");
+	pthread_mutex_lock(&tq->tq_mtx);
+	tq->tq_exit = 1;
+	pthread_cond_broadcast(&tq->tq_cv);
+	pthread_mutex_unlock(&tq->tq_mtx);
+	if (tq->tq_started)
+		pthread_join(tq->tq_thread, NULL);
+	pthread_cond_destroy(&tq->tq_cv);
+	pthread_mutex_destroy(&tq->tq_mtx);
+	free(tq);
+}
+
+/*
+ * sysctl(9).  A handler holds a running reference on its node, and
+ * sysctl_ctx_free() waits for those before the nodes go away.
+ */
+static pthread_mutex_t	mock_sysctl_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	mock_sysctl_cv = PTHREAD_COND_INITIALIZER;
+static struct sysctl_oid mock_sysctl_root = {
+	.oid_children = TAILQ_HEAD_INITIALIZER(mock_sysctl_root.oid_children),
+	.oid_name = "",
+	.oid_kind = CTLTYPE_NODE | CTLFLAG_RD,
+};
+
+static struct sysctl_oid *
+mock_sysctl_child(struct sysctl_oid *parent, const char *name, size_t len)
+{
+	struct sysctl_oid *oid;
+
+	TAILQ_FOREACH(oid, &parent->oid_children, oid_link)
+		if (strncmp(oid->oid_name, name, len) == 0 &&
+		    oid->oid_name[len] == '\0')
+			return (oid);
+	return (NULL);
+}
+
+struct sysctl_oid *
+sysctl_add_oid(struct sysctl_ctx_list *ctx, struct sysctl_oid_list *parent,
+    int nbr, const char *name, int kind, void *arg1, intmax_t arg2,
+    int (*handler)(SYSCTL_HANDLER_ARGS), const char *fmt, const char *descr)
+{
+	struct sysctl_ctx_entry *e;
+	struct sysctl_oid *oid, *p;
+
+	p = (struct sysctl_oid *)((char *)parent -
+	    offsetof(struct sysctl_oid, oid_children));
+	pthread_mutex_lock(&mock_sysctl_mtx);
+	if (mock_sysctl_child(p, name, strlen(name)) != NULL)
+		mock_panic("sysctl %s.%s added twice", p->oid_name, name);
+	oid = calloc(1, sizeof(*oid));
+	TAILQ_INIT(&oid->oid_children);
+	oid->oid_parent = p;
+	oid->oid_name = strdup(name);
+	oid->oid_kind = kind;
+	oid->oid_arg1 = arg1;
+	oid->oid_arg2 = arg2;
+	oid->oid_handler = handler;
+	TAILQ_INSERT_TAIL(&p->oid_children, oid, oid_link);
+	if (ctx != NULL) {
+		e = calloc(1, sizeof(*e));
+		e->entry = oid;
+		TAILQ_INSERT_HEAD(ctx, e, link);
+	}
+	pthread_mutex_unlock(&mock_sysctl_mtx);
+	return (oid);
+}
+
+int
+sysctl_ctx_init(struct sysctl_ctx_list *ctx)
+{
+
+	TAILQ_INIT(ctx);
+	return (0);
+}
+
+int
+sysctl_ctx_free(struct sysctl_ctx_list *ctx)
+{
+	struct sysctl_ctx_entry *e;
+	struct sysctl_oid *oid;
+
+	/* A handler waiting for the lock would never finish. */
+	if (mock_sx_held != 0)
+		mock_panic("sysctl_ctx_free with an sx held");
+	mock_may_sleep("sysctl_ctx_free");
+	pthread_mutex_lock(&mock_sysctl_mtx);
+	TAILQ_FOREACH(e, ctx, link)
+		e->entry->oid_dying = 1;
+	TAILQ_FOREACH(e, ctx, link)
+		while (e->entry->oid_running != 0)
+			pthread_cond_wait(&mock_sysctl_cv, &mock_sysctl_mtx);
+	while ((e = TAILQ_FIRST(ctx)) != NULL) {
+		TAILQ_REMOVE(ctx, e, link);
+		oid = e->entry;
+		TAILQ_REMOVE(&oid->oid_parent->oid_children, oid, oid_link);
+		free(oid->oid_name);
+		free(oid);
+		free(e);
+	}
+	pthread_mutex_unlock(&mock_sysctl_mtx);
+	return (0);
+}
+
+int
+mock_sysctl_out(struct sysctl_req *req, const void *p, size_t l)
+{
+	size_t i;
+
+	mock_may_sleep("SYSCTL_OUT");
+	if (req->oldptr == NULL) {
+		req->oldidx += l;
+		return (0);
+	}
+	i = req->oldidx < req->oldlen ? MIN(l, req->oldlen - req->oldidx) : 0;
+	memcpy((char *)req->oldptr + req->oldidx, p, i);
+	req->oldidx += l;
+	return (i < l ? ENOMEM : 0);
+}
+
+int
+mock_sysctl_in(struct sysctl_req *req, void *p, size_t l)
+{
+
+	mock_may_sleep("SYSCTL_IN");
+	if (req->newptr == NULL)
+		return (0);
+	if (req->newlen - req->newidx < l)
+		return (EINVAL);
+	memcpy(p, (const char *)req->newptr + req->newidx, l);
+	req->newidx += l;
+	return (0);
+}
+
+int
+sysctl_handle_int(SYSCTL_HANDLER_ARGS)
+{
+	int error, tmp;
+
+	tmp = arg1 != NULL ? *(int *)arg1 : (int)arg2;
+	error = SYSCTL_OUT(req, &tmp, sizeof(tmp));
+	if (error || req->newptr == NULL)
+		return (error);
+	if (arg1 == NULL)
+		return (EPERM);
+	error = SYSCTL_IN(req, &tmp, sizeof(tmp));
+	if (error == 0)
+		*(int *)arg1 = tmp;
+	return (error);
+}
+
+int
+sysctl_handle_string(SYSCTL_HANDLER_ARGS)
+{
+	size_t len;
+	int error;
+
+	error = SYSCTL_OUT(req, arg1, strlen(arg1) + 1);
+	if (error || req->newptr == NULL)
+		return (error);
+	len = req->newlen - req->newidx;
+	if (len >= (size_t)arg2)
+		return (EINVAL);
+	error = SYSCTL_IN(req, arg1, len);
+	((char *)arg1)[len] = '\0';
+	return (error);
+}
+
+/*
+ * Plain int, u_int, uint64_t and string nodes, read and written without
+ * a lock as the kernel does; tsan.supp names this function.
+ */
+static int __attribute__((__noinline__))
+mock_sysctl_raw(struct sysctl_oid *oidp, struct sysctl_req *req)
+{
+	uint64_t v64;
+	int error;
+
+	switch (oidp->oid_kind & CTLTYPE) {
+	case CTLTYPE_INT:
+	case CTLTYPE_UINT:
+		return (sysctl_handle_int(oidp, oidp->oid_arg1,
+		    oidp->oid_arg2, req));
+	case CTLTYPE_U64:
+		v64 = *(uint64_t *)oidp->oid_arg1;
+		error = SYSCTL_OUT(req, &v64, sizeof(v64));
+		if (error || req->newptr == NULL)
+			return (error);
+		error = SYSCTL_IN(req, &v64, sizeof(v64));
+		if (error == 0)
+			*(uint64_t *)oidp->oid_arg1 = v64;
+		return (error);
+	case CTLTYPE_STRING:
+		return (sysctl_handle_string(oidp, oidp->oid_arg1,
+		    oidp->oid_arg2, req));
+	}
+	return (EINVAL);
+}
+
+int
+mock_sysctl(const char *name, void *oldp, size_t *oldlenp, const void *newp,
+    size_t newlen)
+{
+	struct sysctl_oid *oid;
+	struct sysctl_req req;
+	const char *p, *q;
+	int error;
+
+	pthread_mutex_lock(&mock_sysctl_mtx);
+	oid = &mock_sysctl_root;
+	for (p = name; oid != NULL && *p != '\0'; p = *q ? q + 1 : q) {
+		q = strchr(p, '.');
+		if (q == NULL)
+			q = p + strlen(p);
+		oid = mock_sysctl_child(oid, p, q - p);
+	}
+	if (oid == NULL || oid->oid_dying ||
+	    (oid->oid_kind & CTLTYPE) == CTLTYPE_NODE) {
+		pthread_mutex_unlock(&mock_sysctl_mtx);
+		return (ENOENT);
+	}
+	if (newp != NULL && !(oid->oid_kind & CTLFLAG_WR)) {
+		pthread_mutex_unlock(&mock_sysctl_mtx);
+		return (EPERM);
+	}
+	oid->oid_running++;
+	pthread_mutex_unlock(&mock_sysctl_mtx);
+
+	memset(&req, 0, sizeof(req));
+	req.oldptr = oldp;
+	req.oldlen = oldp != NULL ? *oldlenp : 0;
+	req.newptr = newp;
+	req.newlen = newlen;
+	if (oid->oid_handler != NULL)
+		error = oid->oid_handler(oid, oid->oid_arg1, oid->oid_arg2,
+		    &req);
+	else
+		error = mock_sysctl_raw(oid, &req);
+	if (oldlenp != NULL)
+		*oldlenp = req.oldidx;
+
+	pthread_mutex_lock(&mock_sysctl_mtx);
+	if (--oid->oid_running == 0 && oid->oid_dying)
+		pthread_cond_broadcast(&mock_sysctl_cv);
+	pthread_mutex_unlock(&mock_sysctl_mtx);
+	return (error);
+}
+
+/* sbuf(9) for sysctl handlers, draining through SYSCTL_OUT when full */
+struct sbuf *
+sbuf_new_for_sysctl(struct sbuf *s, char *buf, int length,
+    struct sysctl_req *req)
+{
+
+	if (s == NULL)
+		mock_panic("sbuf_new_for_sysctl without an sbuf");
+	s->s_size = MAX(length, 2);
+	s->s_buf = malloc(s->s_size);
+	s->s_len = 0;
+	s->s_error = 0;
+	s->s_req = req;
+	return (s);
+}
+
+int
+sbuf_printf(struct sbuf *s, const char *fmt, ...)
+{
+	va_list ap;
+	char *tmp;
+	size_t i, n;
+	int len;
+
+	if (s->s_error)
+		return (-1);
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	tmp = malloc(len + 1);
+	va_start(ap, fmt);
+	vsnprintf(tmp, len + 1, fmt, ap);
+	va_end(ap);
+	for (i = 0; i < (size_t)len && s->s_error == 0; i += n) {
+		if (s->s_len == s->s_size) {
+			s->s_error = SYSCTL_OUT(s->s_req, s->s_buf, s->s_len);
+			s->s_len = 0;
+		}
+		n = MIN((size_t)len - i, s->s_size - s->s_len);
+		memcpy(s->s_buf + s->s_len, tmp + i, n);
+		s->s_len += n;
+	}
+	free(tmp);
+	return (s->s_error ? -1 : 0);
+}
+
+ssize_t
+sbuf_len(struct sbuf *s)
+{
+
+	return (s->s_error ? -1 : (ssize_t)s->s_len);
+}
+
+int
+sbuf_finish(struct sbuf *s)
+{
+	static const char nul;
+
+	if (s->s_error == 0 && s->s_len > 0)
+		s->s_error = SYSCTL_OUT(s->s_req, s->s_buf, s->s_len);
+	if (s->s_error == 0)
+		s->s_error = SYSCTL_OUT(s->s_req, &nul, 1);
+	s->s_len = 0;
+	return (s->s_error);
+}
+
+void
+sbuf_delete(struct sbuf *s)
+{
+
+	free(s->s_buf);
+	s->s_buf = NULL;
+}
+
+/*
+ * newbus.  Attach and detach hold the topology lock, as in the kernel,
+ * and the softc outlives the device's sysctl nodes.
+ */
+struct mock_device {
+	int			 unit;
+	int			 attached;
+	void			*softc;
+	ACPI_HANDLE		 handle;
+	struct sysctl_ctx_list	 ctx;
+	struct sysctl_oid	*tree;
+};
+
+extern driver_t		*mock_driver_acpi_fan;
+
+static pthread_mutex_t	 mock_topo_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_device mock_devs[MOCK_MAXFANS];
+static struct acpi_softc mock_acpi_sc;
+static struct sysctl_ctx_list mock_root_ctx;
+static struct sysctl_oid *mock_dev_fan;
+
+static int
+mock_method(device_t dev, const char *name)
+{
+	device_method_t *m;
+
+	for (m = mock_driver_acpi_fan->methods; m->name != NULL; m++)
+		if (strcmp(m->name, name) == 0)
+			return (m->func(dev));
+	return (0);
+}
+
+void
+mock_newbus_init(void)
+{
+	struct sysctl_oid *hw, *dev;
+
+	sysctl_ctx_init(&mock_root_ctx);
+	hw = SYSCTL_ADD_NODE(&mock_root_ctx,
+	    SYSCTL_CHILDREN(&mock_sysctl_root), OID_AUTO, "hw", CTLFLAG_RD,
+	    NULL, "hardware");
+	mock_acpi_sc.acpi_sysctl_tree = SYSCTL_ADD_NODE(&mock_root_ctx,
+	    SYSCTL_CHILDREN(hw), OID_AUTO, "acpi", CTLFLAG_RD, NULL, "ACPI");
+	dev = SYSCTL_ADD_NODE(&mock_root_ctx,
+	    SYSCTL_CHILDREN(&mock_sysctl_root), OID_AUTO, "dev", CTLFLAG_RD,
+	    NULL, "devices");
+	mock_dev_fan = SYSCTL_ADD_NODE(&mock_root_ctx, SYSCTL_CHILDREN(dev),
+	    OID_AUTO, "fan", CTLFLAG_RD, NULL, "fan");
+}
+
+int
+mock_fan_attach(int unit)
+{
+	struct mock_device *d;
+	char name[16];
+	int error;
+
+	d = &mock_devs[unit];
+	pthread_mutex_lock(&mock_topo_mtx);
+	if (d->attached) {
+		pthread_mutex_unlock(&mock_topo_mtx);
+		return (EEXIST);
+	}
+	d->unit = unit;
+	d->handle = mock_acpi_fan_handle(unit);
+	d->softc = calloc(1, mock_driver_acpi_fan->size);
+	sysctl_ctx_init(&d->ctx);
+	snprintf(name, sizeof(name), "%d", unit);
+	d->tree = SYSCTL_ADD_NODE(&d->ctx, SYSCTL_CHILDREN(mock_dev_fan),
+	    OID_AUTO, name, CTLFLAG_RD, NULL, "");
+	error = mock_method(d, "device_probe");
+	if (error <= 0)
+		error = mock_method(d, "device_attach");
+	if (error != 0) {
+		sysctl_ctx_free(&d->ctx);
+		free(d->softc);
+		d->softc = NULL;
+	} else
+		d->attached = 1;
+	pthread_mutex_unlock(&mock_topo_mtx);
+	return (error);
+}
+
+int
+mock_fan_detach(int unit)
+{
+	struct mock_device *d;
+	int error;
+
+	d = &mock_devs[unit];
+	pthread_mutex_lock(&mock_topo_mtx);
+	if (!d->attached) {
+		pthread_mutex_unlock(&mock_topo_mtx);
+		return (ENXIO);
+	}
+	error = mock_method(d, "device_detach");
+	if (error == 0) {
+		d->attached = 0;
+		sysctl_ctx_free(&d->ctx);
+		free(d->softc);
+		d->softc = NULL;
+	}
+	pthread_mutex_unlock(&mock_topo_mtx);
+	return (error);
+}
+
+static int
+mock_fan_method(int unit, const char *name)
+{
+	struct mock_device *d;
+	int error;
+
+	d = &mock_devs[unit];
+	pthread_mutex_lock(&mock_topo_mtx);
+	error = d->attached ? mock_method(d, name) : ENXIO;
+	pthread_mutex_unlock(&mock_topo_mtx);
+	return (error);
+}
+
+int
+mock_fan_suspend(int unit)
+{
+
+	return (mock_fan_method(unit, "device_suspend"));
+}
+
+int
+mock_fan_resume(int unit)
+{
+
+	return (mock_fan_method(unit, "device_resume"));
+}
+
+void *
+device_get_softc(device_t dev)
+{
+
+	return (dev->softc);
+}
+
+device_t
+device_get_parent(device_t dev)
+{
+
+	return (NULL);
+}
+
+int
+device_get_unit(device_t dev)
+{
+
+	return (dev->unit);
+}
+
+const char *
+device_get_name(device_t dev)
+{
+
+	return ("fan");
+}
+
+void
+device_set_desc(device_t dev, const char *desc)
+{
+}
+
+int
+device_printf(device_t dev, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!mock_verbose)
+		return (0);
+	va_start(ap, fmt);
+	n = fprintf(stderr, "fan%d: ", dev->unit);
+	n += vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return (n);
+}
+
+struct sysctl_ctx_list *
+device_get_sysctl_ctx(device_t dev)
+{
+
+	return (&dev->ctx);
+}
+
+struct sysctl_oid *
+device_get_sysctl_tree(device_t dev)
+{
+
+	return (dev->tree);
+}
+
+ACPI_HANDLE
+acpi_get_handle(device_t dev)
+{
+
+	return (dev->handle);
+}
+
+void *
+acpi_device_get_parent_softc(device_t dev)
+{
+
+	return (&mock_acpi_sc);
+}
+
+int
+acpi_disabled(const char *subsys)
+{
+
+	return (0);
+}
+
+/* device hints and kenv come from the environment */
+int
+resource_int_value(const char *name, int unit, const char *resname,
+    int *result)
+{
+	const char *s;
+	char *end;
+	long v;
+
+	if (resource_string_value(name, unit, resname, &s) != 0)
+		return (ENOENT);
+	v = strtol(s, &end, 0);
+	if (*s == '\0' || *end != '\0')
+		return (EINVAL);
+	*result = (int)v;
+	return (0);
+}
+
+int
+resource_string_value(const char *name, int unit, const char *resname,
+    const char **result)
+{
+	char var[64];
+
+	snprintf(var, sizeof(var), "hint.%s.%d.%s", name, unit, resname);
+	if ((*result = getenv(var)) == NULL)
+		return (ENOENT);
+	return (0);
+}
+
+char *
+kern_getenv(const char *name)
+{
+	const char *v;
+
+	mock_may_sleep("kern_getenv");
+	v = getenv(name);
+	return (v != NULL ? strdup(v) : NULL);
+}
+
+void
+freeenv(char *env)
+{
+
+	free(env);
+}
+
+void
+devctl_notify(const char *system, const char *subsystem, const char *type,
+    const char *data)
+{
+
+	__atomic_fetch_add(&mock_devctl_events, 1, __ATOMIC_RELAXED);
+	if (mock_verbose)
+		fprintf(stderr, "devctl: system=%s subsystem=%s type=%s %s\n",
+		    system, subsystem, type, data);
+}
@@ -0,0 +1,421 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Userland stand-ins for the kernel interfaces acpi_fan.c uses.  The
+ * driver is compiled unchanged with this file included first; the
+ * kernel-only headers it names are empty files next to this one.
+ *
+ * Locks keep an owner so the driver's assertions hold, and a per-thread
+ * list of held mutexes catches sleeping with one held, as WITNESS
+ * would.  Callouts run from one timer thread, taskqueues from their own.
+ */
+
+#ifndef _MOCK_KERN_H_
+#define	_MOCK_KERN_H_
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "mock.h"
+
+#ifndef __FBSDID
+#define	__FBSDID(s)		struct __hack
+#endif
+#ifndef __unused
+#define	__unused		__attribute__((__unused__))
+#endif
+#ifndef __packed
+#define	__packed		__attribute__((__packed__))
+#endif
+#ifndef __printflike
+#define	__printflike(f, a)	__attribute__((__format__(__printf__, f, a)))
+#endif
+#ifndef __predict_false
+#define	__predict_false(e)	__builtin_expect((e), 0)
+#define	__predict_true(e)	__builtin_expect((e), 1)
+#endif
+#ifndef __DECONST
+#define	__DECONST(t, v)		((t)(uintptr_t)(const void *)(v))
+#endif
+#ifndef nitems
+#define	nitems(x)		(sizeof((x)) / sizeof((x)[0]))
+#endif
+#ifndef roundup2
+#define	roundup2(x, y)		(((x) + ((y) - 1)) & (~((y) - 1)))
+#endif
+#ifndef CTASSERT
+#define	CTASSERT(x)		_Static_assert(x, "compile-time assertion")
+#endif
+#define	KASSERT(e, m) do {						\
+	if (!(e)) {							\
+		printf m;						\
+		mock_panic("KASSERT " #e);				\
+	}								\
+} while (0)
+
+#define	bitcount32(x)		((u_int)__builtin_popcount((uint32_t)(x)))
+#define	flsll(x)		mock_flsll(x)
+#define	strlcpy(d, s, n)	mock_strlcpy((d), (s), (n))
+
+static inline int
+mock_flsll(long long x)
+{
+
+	return (x == 0 ? 0 : 64 - __builtin_clzll((unsigned long long)x));
+}
+
+/* time */
+#ifndef SBT_1S
+typedef int64_t sbintime_t;
+#define	SBT_1S	((sbintime_t)1 << 32)
+#define	SBT_1MS	(SBT_1S / 1000)
+#define	SBT_1US	(SBT_1S / 1000000)
+#define	SBT_1NS	(SBT_1S / 1000000000)
+
+static inline int64_t
+sbttons(sbintime_t sbt)
+{
+
+	return ((sbt >> 32) * 1000000000 +
+	    (((sbt & 0xffffffff) * 1000000000) >> 32));
+}
+
+static inline int64_t
+sbttous(sbintime_t sbt)
+{
+
+	return (sbttons(sbt) / 1000);
+}
+
+static inline int64_t
+sbttoms(sbintime_t sbt)
+{
+
+	return (sbttons(sbt) / 1000000);
+}
+#endif
+
+#define	sbinuptime()		mock_sbinuptime()
+#define	microtime(tv)		gettimeofday((tv), NULL)
+#define	pause_sbt(w, s, p, f)	mock_pause_sbt((w), (s))
+
+/* malloc(9) */
+struct malloc_type {
+	const char	*ks_shortdesc;
+};
+
+#define	MALLOC_DEFINE(type, shortdesc, longdesc)			\
+	struct malloc_type type[1] = { { shortdesc } }
+#define	MALLOC_DECLARE(type)	extern struct malloc_type type[1]
+#define	M_NOWAIT	0x0001
+#define	M_WAITOK	0x0002
+#define	M_ZERO		0x0100
+
+void	*mock_malloc(size_t size, struct malloc_type *type, int flags);
+void	*mock_mallocarray(size_t nmemb, size_t size, struct malloc_type *type,
+	    int flags);
+void	 mock_free(void *addr);
+
+#ifndef MOCK_IMPL
+#define	malloc(s, t, f)		mock_malloc((s), (t), (f))
+#define	mallocarray(n, s, t, f)	mock_mallocarray((n), (s), (t), (f))
+#define	free(p, t)		mock_free(p)
+#endif
+
+/* locks */
+struct mtx {
+	pthread_mutex_t	 mtx_lock;
+	const char	*mtx_name;
+	pthread_t	 mtx_owner;
+	int		 mtx_owned;
+};
+
+struct sx {
+	pthread_mutex_t	 sx_lock;
+	const char	*sx_name;
+	pthread_t	 sx_owner;
+	int		 sx_owned;
+};
+
+#define	MTX_DEF		0x0000
+#define	MA_OWNED	0x01
+#define	SA_XLOCKED	0x04
+
+void	mtx_init(struct mtx *m, const char *name, const char *type, int opts);
+void	mtx_destroy(struct mtx *m);
+void	mtx_lock(struct mtx *m);
+void	mtx_unlock(struct mtx *m);
+void	mtx_assert(struct mtx *m, int what);
+void	sx_init(struct sx *sx, const char *name);
+void	sx_xlock(struct sx *sx);
+void	sx_xunlock(struct sx *sx);
+void	sx_assert(struct sx *sx, int what);
+
+#define	MTX_SYSINIT(name, m, desc, opts)				\
+static void __attribute__((__constructor__))				\
+name##_mtx_sysinit(void)						\
+{									\
+									\
+	mtx_init((m), (desc), NULL, (opts));				\
+}
+
+/* atomic(9), on the compiler's builtins */
+#define	atomic_add_int(p, v)	 __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define	atomic_add_64(p, v)	 __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define	atomic_fetchadd_int(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define	atomic_fetchadd_64(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define	atomic_load_int(p)	 __atomic_load_n((p), __ATOMIC_RELAXED)
+#define	atomic_load_64(p)	 __atomic_load_n((p), __ATOMIC_RELAXED)
+#define	atomic_load_acq_int(p)	 __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	atomic_load_acq_ptr(p)	 __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	atomic_store_int(p, v)	 __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define	atomic_store_rel_int(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	atomic_store_rel_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	atomic_readandclear_int(p) __atomic_exchange_n((p), 0, __ATOMIC_SEQ_CST)
+
+/* callout(9) and taskqueue(9) */
+struct callout {
+	TAILQ_ENTRY(callout)	 c_link;
+	sbintime_t		 c_time;
+	void			(*c_func)(void *);
+	void			*c_arg;
+	int			 c_pending;
+};
+
+#define	C_DIRECT_EXEC	0x0001
+#define	C_PREL(x)	(((x) + 1) << 1)
+#define	C_HARDCLOCK	0x0100
+#define	C_ABSOLUTE	0x0200
+
+void	callout_init(struct callout *c, int mpsafe);
+int	callout_reset_sbt_on(struct callout *c, sbintime_t sbt, sbintime_t pr,
+	    void (*func)(void *), void *arg, int cpu, int flags);
+int	callout_drain(struct callout *c);
+
+typedef void task_fn_t(void *context, int pending);
+
+struct task {
+	STAILQ_ENTRY(task)	 ta_link;
+	int			 ta_pending;
+	task_fn_t		*ta_func;
+	void			*ta_context;
+};
+
+#define	TASK_INIT(t, pri, func, context) do {				\
+	(t)->ta_pending = 0;						\
+	(t)->ta_func = (func);						\
+	(t)->ta_context = (context);					\
+} while (0)
+
+struct taskqueue;
+typedef void taskqueue_enqueue_fn(void *context);
+
+#ifndef PWAIT
+#define	PWAIT		120
+#endif
+
+typedef struct {
+	u_long		__bits[4];
+} mock_cpuset_t;
+#define	cpuset_t		mock_cpuset_t
+#define	mp_maxid		mock_mp_maxid
+#define	CPU_ABSENT(c)		((u_int)(c) > mock_mp_maxid)
+#define	CPU_SETOF(c, s) do {						\
+	memset((s), 0, sizeof(*(s)));					\
+	(s)->__bits[(c) / 64] = 1UL << ((c) % 64);			\
+} while (0)
+
+extern u_int	mock_mp_maxid;
+
+struct taskqueue *taskqueue_create(const char *name, int mflags,
+	    taskqueue_enqueue_fn *enqueue, void *context);
+void	taskqueue_thread_enqueue(void *context);
+int	taskqueue_start_threads(struct taskqueue **tqp, int count, int pri,
+	    const char *name, ...);
+int	taskqueue_start_threads_cpuset(struct taskqueue **tqp, int count,
+	    int pri, cpuset_t *mask, const char *name, ...);
+int	taskqueue_enqueue(struct taskqueue *tq, struct task *task);
+void	taskqueue_drain(struct taskqueue *tq, struct task *task);
+void	taskqueue_free(struct taskqueue *tq);
+
+/* sysctl(9) */
+struct sysctl_oid;
+struct sysctl_req;
+
+#define	SYSCTL_HANDLER_ARGS	struct sysctl_oid *oidp, void *arg1,	\
+	intmax_t arg2, struct sysctl_req *req
+
+TAILQ_HEAD(sysctl_oid_list, sysctl_oid);
+
+struct sysctl_oid {
+	struct sysctl_oid_list	 oid_children;
+	TAILQ_ENTRY(sysctl_oid)	 oid_link;
+	struct sysctl_oid	*oid_parent;
+	char			*oid_name;
+	int			 oid_kind;
+	void			*oid_arg1;
+	intmax_t		 oid_arg2;
+	int			(*oid_handler)(SYSCTL_HANDLER_ARGS);
+	u_int			 oid_running;
+	int			 oid_dying;
+};
+
+struct sysctl_ctx_entry {
+	struct sysctl_oid		*entry;
+	TAILQ_ENTRY(sysctl_ctx_entry)	 link;
+};
+
+TAILQ_HEAD(sysctl_ctx_list, sysctl_ctx_entry);
+
+struct sysctl_req {
+	void		*oldptr;
+	size_t		 oldlen;
+	size_t		 oldidx;
+	const void	*newptr;
+	size_t		 newlen;
+	size_t		 newidx;
+};
+
+#define	CTLTYPE		0xf
+#define	CTLTYPE_NODE	1
+#define	CTLTYPE_INT	2
+#define	CTLTYPE_STRING	3
+#define	CTLTYPE_OPAQUE	5
+#define	CTLTYPE_UINT	6
+#define	CTLTYPE_U64	9
+#define	CTLFLAG_RD	0x80000000
+#define	CTLFLAG_WR	0x40000000
+#define	CTLFLAG_RW	(CTLFLAG_RD | CTLFLAG_WR)
+#define	CTLFLAG_MPSAFE	0x00040000
+#define	OID_AUTO	(-1)
+
+#define	SYSCTL_CHILDREN(oid)	(&(oid)->oid_children)
+#define	SYSCTL_IN(req, p, l)	mock_sysctl_in((req), (p), (l))
+#define	SYSCTL_OUT(req, p, l)	mock_sysctl_out((req), (p), (l))
+
+#define	SYSCTL_ADD_NODE(ctx, parent, nbr, name, access, handler, descr)	\
+	sysctl_add_oid((ctx), (parent), (nbr), (name),			\
+	    CTLTYPE_NODE | (access), NULL, 0, (handler), "N", (descr))
+#define	SYSCTL_ADD_PROC(ctx, parent, nbr, name, access, ptr, arg,	\
+	    handler, fmt, descr)					\
+	sysctl_add_oid((ctx), (parent), (nbr), (name), (access),	\
+	    (ptr), (arg), (handler), (fmt), (descr))
+#define	SYSCTL_ADD_INT(ctx, parent, nbr, name, access, ptr, val, descr)	\
+	sysctl_add_oid((ctx), (parent), (nbr), (name),			\
+	    CTLTYPE_INT | CTLFLAG_MPSAFE | (access), (int *)(ptr),	\
+	    (val), NULL, "I", (descr))
+#define	SYSCTL_ADD_UINT(ctx, parent, nbr, name, access, ptr, val, descr) \
+	sysctl_add_oid((ctx), (parent), (nbr), (name),			\
+	    CTLTYPE_UINT | CTLFLAG_MPSAFE | (access), (u_int *)(ptr),	\
+	    (val), NULL, "IU", (descr))
+#define	SYSCTL_ADD_U64(ctx, parent, nbr, name, access, ptr, val, descr)	\
+	sysctl_add_oid((ctx), (parent), (nbr), (name),			\
+	    CTLTYPE_U64 | CTLFLAG_MPSAFE | (access), (uint64_t *)(ptr),	\
+	    (val), NULL, "QU", (descr))
+#define	SYSCTL_ADD_STRING(ctx, parent, nbr, name, access, arg, len,	\
+	    descr)							\
+	sysctl_add_oid((ctx), (parent), (nbr), (name),			\
+	    CTLTYPE_STRING | CTLFLAG_MPSAFE | (access), (char *)(arg),	\
+	    (len), NULL, "A", (descr))
+
+struct sysctl_oid *sysctl_add_oid(struct sysctl_ctx_list *ctx,
+	    struct sysctl_oid_list *parent, int nbr, const char *name,
+	    int kind, void *arg1, intmax_t arg2,
+	    int (*handler)(SYSCTL_HANDLER_ARGS), const char *fmt,
+	    const char *descr);
+int	sysctl_ctx_init(struct sysctl_ctx_list *ctx);
+int	sysctl_ctx_free(struct sysctl_ctx_list *ctx);
+int	sysctl_handle_int(SYSCTL_HANDLER_ARGS);
+int	sysctl_handle_string(SYSCTL_HANDLER_ARGS);
+int	mock_sysctl_in(struct sysctl_req *req, void *p, size_t l);
+int	mock_sysctl_out(struct sysctl_req *req, const void *p, size_t l);
+
+#define	TUNABLE_INT(path, var)	struct __hack
+
+/* sbuf(9), only what sysctl handlers need */
+struct sbuf {
+	char			*s_buf;
+	size_t			 s_len;
+	size_t			 s_size;
+	int			 s_error;
+	struct sysctl_req	*s_req;
+};
+
+struct sbuf *sbuf_new_for_sysctl(struct sbuf *s, char *buf, int length,
+	    struct sysctl_req *req);
+int	sbuf_printf(struct sbuf *s, const char *fmt, ...) __printflike(2, 3);
+ssize_t	sbuf_len(struct sbuf *s);
+int	sbuf_finish(struct sbuf *s);
+void	sbuf_delete(struct sbuf *s);
+
+/* newbus */
+struct mock_device;
+typedef struct mock_device *device_t;
+
+typedef struct {
+	const char	*name;
+	int		(*func)(device_t);
+} device_method_t;
+
+typedef struct {
+	const char		*name;
+	device_method_t		*methods;
+	size_t			 size;
+} driver_t;
+
+#define	DEVMETHOD(name, func)	{ #name, (int (*)(device_t))(func) }
+#define	DEVMETHOD_END		{ NULL, NULL }
+#define	DRIVER_MODULE(name, bus, driver, evh, arg)			\
+	driver_t *mock_driver_##name = &(driver)
+#define	MODULE_DEPEND(name, dep, min, pref, max)	struct __hack
+
+void	*device_get_softc(device_t dev);
+device_t device_get_parent(device_t dev);
+int	 device_get_unit(device_t dev);
+const char *device_get_name(device_t dev);
+void	 device_set_desc(device_t dev, const char *desc);
+int	 device_printf(device_t dev, const char *fmt, ...) __printflike(2, 3);
+struct sysctl_ctx_list *device_get_sysctl_ctx(device_t dev);
+struct sysctl_oid *device_get_sysctl_tree(device_t dev);
+int	 resource_int_value(const char *name, int unit, const char *resname,
+	    int *result);
+int	 resource_string_value(const char *name, int unit,
+	    const char *resname, const char **result);
+
+/* kenv(9), devctl(4), fail(9) and the load average */
+char	*kern_getenv(const char *name);
+void	 freeenv(char *env);
+void	 devctl_notify(const char *system, const char *subsystem,
+	    const char *type, const char *data);
+
+#define	DEBUG_FP	0
+#define	KFAIL_POINT_CODE(parent, name, flags, code) do {		\
+	int RETURN_VALUE;						\
+									\
+	if (mock_fail_point(#name, &RETURN_VALUE)) {			\
+		code;							\
+	}								\
+} while (0)
+
+struct mock_loadavg {
+	uint32_t	ldavg[3];
+	long		fscale;
+};
+#define	averunnable	mock_averunnable
+extern struct mock_loadavg mock_averunnable;
+
+#include "acpica.h"
+
+#endif /* !_MOCK_KERN_H_ */
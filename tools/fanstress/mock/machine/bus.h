@@ -0,0 +1 @@
+/* Empty; the mock kernel is in kern.h. */
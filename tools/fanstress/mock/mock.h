@@ -0,0 +1,62 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * What the mock kernel and ACPI namespace offer the harness.  Errors
+ * are returned as errno values, like sysctl(3) would set them.
+ */
+
+#ifndef _MOCK_MOCK_H_
+#define	_MOCK_MOCK_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#define	MOCK_MAXFANS	16
+#define	MOCK_MAXTZ	8
+
+extern int	mock_verbose;
+
+void	mock_panic(const char *fmt, ...)
+	    __attribute__((__noreturn__, __format__(__printf__, 1, 2)));
+int64_t	mock_sbinuptime(void);
+int	mock_pause_sbt(const char *wmesg, int64_t sbt);
+size_t	mock_strlcpy(char *dst, const char *src, size_t size);
+void	mock_may_sleep(const char *what);
+
+/* fail(9): fire name with pct percent probability, returning value */
+int	mock_fail_point(const char *name, int *value);
+void	mock_fail_set(const char *name, int pct, int value);
+
+/* sysctlbyname(3) on the mock tree */
+int	mock_sysctl(const char *name, void *oldp, size_t *oldlenp,
+	    const void *newp, size_t newlen);
+
+/* newbus; units are fan nodes of the namespace */
+int	mock_fan_attach(int unit);
+int	mock_fan_detach(int unit);
+int	mock_fan_suspend(int unit);
+int	mock_fan_resume(int unit);
+
+/* namespace */
+struct mock_acpi_conf {
+	int	nfans;
+	int	nzones;
+	int	fail_pct;	/* AML evaluations failing, percent */
+	int	acpi1_every;	/* every nth fan has no _FIF/_FST, 0 none */
+	int	load;		/* added to every zone, tenths of a degree */
+};
+
+void	mock_acpi_init(const struct mock_acpi_conf *conf);
+void	mock_acpi_fini(void);
+void	mock_acpi_notify_fan(int unit, uint32_t notify);
+void	mock_acpi_notify_tz(int zone, uint32_t notify);
+
+/* between the mock files */
+void	*mock_acpi_fan_handle(int unit);
+void	mock_newbus_init(void);
+
+/* counters */
+extern uint64_t	mock_devctl_events;
+extern uint64_t	mock_aml_calls;
+
+#endif /* !_MOCK_MOCK_H_ */
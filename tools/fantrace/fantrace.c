@@ -0,0 +1,351 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * fantrace: convert the event trace of the acpi fan driver,
+ * hw.acpi.fan.trace, to the Chrome trace event JSON format that
+ * chrome://tracing and Perfetto (ui.perfetto.dev) load.
+ *
+ * Live, the trace is polled for a while, passing hdr.next of each read to
+ * the next so that every record is taken once; -e turns tracing on for
+ * the run.  With -r the records come from files instead, each one a raw
+ * read of the node as "sysctl -b hw.acpi.fan.trace > file" saves it.
+ *
+ * The mapping is the one acpi_fanio.h gives: *_BEGIN and *_END are "B"
+ * and "E" events on the thread of the fan unit, thermal zones sharing
+ * one thread of their own, and CONTROL and POWER are instant events
+ * carrying their argument.  An END whose BEGIN was overwritten in the
+ * ring is left out, so that the slices nest.
+ */
+
+#include <sys/param.h>
+#include <sys/sysctl.h>
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../acpi_fanio.h"
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define	NTID		(ACPI_FAN_CONF_MAXFANS + 1)
+#define	ZONE_TID	ACPI_FAN_CONF_MAXFANS	/* unit -1 */
+
+static const char *methods[ACPI_FAN_M_MAX] = {
+	[ACPI_FAN_M_FST] = "_FST",
+	[ACPI_FAN_M_FSL] = "_FSL",
+	[ACPI_FAN_M_STA] = "_STA",
+	[ACPI_FAN_M_ON] = "_ON",
+	[ACPI_FAN_M_OFF] = "_OFF",
+	[ACPI_FAN_M_FPS] = "_FPS",
+	[ACPI_FAN_M_FIF] = "_FIF",
+	[ACPI_FAN_M_TMP] = "_TMP",
+	[ACPI_FAN_M_CRT] = "_CRT",
+	[ACPI_FAN_M_ALX] = "_ALx",
+	[ACPI_FAN_M_ACX] = "_ACx",
+};
+
+static const char *sysctls[] = {
+	[ACPI_FAN_S_LEVEL] = "level",
+	[ACPI_FAN_S_POWERED] = "powered",
+};
+
+static struct acpi_fan_trace *recs;
+static size_t		nrecs, maxrecs;
+static uint64_t		lost;
+static volatile sig_atomic_t quit;
+
+static void
+onsig(int sig)
+{
+
+	quit = 1;
+}
+
+static void
+add(const struct acpi_fan_trace *t, size_t n)
+{
+
+	if (n == 0)
+		return;
+	if (nrecs + n > maxrecs) {
+		maxrecs = MAX(maxrecs * 2, nrecs + n);
+		if ((recs = reallocarray(recs, maxrecs, sizeof(*recs))) == NULL)
+			err(1, "reallocarray");
+	}
+	memcpy(recs + nrecs, t, n * sizeof(*t));
+	nrecs += n;
+}
+
+/* One read of the node, or of a file holding one. */
+static int
+take(const char *p, size_t len, uint64_t *next)
+{
+	struct acpi_fan_trace_hdr hdr;
+
+	if (len < sizeof(hdr))
+		return (-1);
+	memcpy(&hdr, p, sizeof(hdr));
+	if (len < sizeof(hdr) + hdr.count * sizeof(struct acpi_fan_trace))
+		return (-1);
+	add((const struct acpi_fan_trace *)(p + sizeof(hdr)), hdr.count);
+	lost += hdr.lost;
+	*next = hdr.next;
+	return (0);
+}
+
+static void
+poll_live(int seconds, int ms)
+{
+	struct timespec ts, end, now;
+	uint64_t next;
+	size_t len, size;
+	char *buf;
+
+	size = 64 * 1024;
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+	next = 0;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += seconds;
+	for (;;) {
+		len = size;
+		if (sysctlbyname("hw.acpi.fan.trace", buf, &len, &next,
+		    sizeof(next)) < 0) {
+			if (errno != ENOMEM)
+				err(1, "hw.acpi.fan.trace");
+			size *= 2;
+			if ((buf = realloc(buf, size)) == NULL)
+				err(1, "realloc");
+			continue;
+		}
+		if (take(buf, len, &next) != 0)
+			errx(1, "hw.acpi.fan.trace: short read");
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (quit || now.tv_sec > end.tv_sec ||
+		    (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec))
+			break;
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = ms % 1000 * 1000000;
+		nanosleep(&ts, NULL);
+	}
+	free(buf);
+}
+
+static void
+read_file(const char *path)
+{
+	uint64_t next;
+	size_t len, size;
+	char *buf;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	size = 64 * 1024;
+	len = 0;
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+	while (!feof(f)) {
+		if (len == size) {
+			size *= 2;
+			if ((buf = realloc(buf, size)) == NULL)
+				err(1, "realloc");
+		}
+		len += fread(buf + len, 1, size - len, f);
+		if (ferror(f))
+			err(1, "%s", path);
+	}
+	fclose(f);
+	if (take(buf, len, &next) != 0)
+		errx(1, "%s: not a read of hw.acpi.fan.trace", path);
+	free(buf);
+}
+
+static int
+tid(const struct acpi_fan_trace *t)
+{
+
+	return (t->unit >= 0 && t->unit < ZONE_TID ? t->unit : ZONE_TID);
+}
+
+static const char *
+name(const char **tab, size_t n, int what)
+{
+
+	return (what > 0 && (size_t)what < n && tab[what] != NULL ?
+	    tab[what] : "?");
+}
+
+/* Start an event; the caller adds its own fields and closes it. */
+static void
+event(FILE *out, const struct acpi_fan_trace *t, const char *name,
+    const char *cat, const char *ph)
+{
+
+	fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+	    "\"ts\":%ju.%03u,\"pid\":1,\"tid\":%d", name, cat, ph,
+	    (uintmax_t)(t->time / 1000), (u_int)(t->time % 1000), tid(t));
+}
+
+static void
+write_json(FILE *out)
+{
+	const struct acpi_fan_trace *t;
+	static int depth[NTID];
+	char seen[NTID];
+	size_t i;
+	int n;
+
+	memset(seen, 0, sizeof(seen));
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	fprintf(out, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+	    "\"args\":{\"name\":\"acpi_fan\"}}");
+	for (i = 0; i < nrecs; i++) {
+		t = &recs[i];
+		n = tid(t);
+		if (!seen[n]) {
+			seen[n] = 1;
+			if (n == ZONE_TID)
+				fprintf(out, ",\n{\"name\":\"thread_name\","
+				    "\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				    "\"args\":{\"name\":\"thermal zones\"}}", n);
+			else
+				fprintf(out, ",\n{\"name\":\"thread_name\","
+				    "\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				    "\"args\":{\"name\":\"fan%d\"}}", n, n);
+		}
+		switch (t->type) {
+		case ACPI_FAN_TR_AML_BEGIN:
+			depth[n]++;
+			event(out, t, name(methods, nitems(methods),
+			    t->what), "aml", "B");
+			fprintf(out, "}");
+			break;
+		case ACPI_FAN_TR_AML_END:
+			if (depth[n] == 0)
+				break;
+			depth[n]--;
+			event(out, t, name(methods, nitems(methods),
+			    t->what), "aml", "E");
+			fprintf(out, ",\"args\":{\"status\":\"0x%x\"}}",
+			    (u_int)t->arg);
+			break;
+		case ACPI_FAN_TR_CONTROL:
+			event(out, t, "control", "control", "i");
+			fprintf(out, ",\"s\":\"t\",\"args\":{\"level\":%d}}",
+			    (int)t->arg);
+			break;
+		case ACPI_FAN_TR_POWER:
+			event(out, t, "power", "control", "i");
+			fprintf(out, ",\"s\":\"t\",\"args\":{\"state\":%d}}",
+			    (int)t->arg);
+			break;
+		case ACPI_FAN_TR_SYSCTL_BEGIN:
+			depth[n]++;
+			event(out, t, name(sysctls, nitems(sysctls),
+			    t->what), "sysctl", "B");
+			fprintf(out, ",\"args\":{\"write\":%d}}", (int)t->arg);
+			break;
+		case ACPI_FAN_TR_SYSCTL_END:
+			if (depth[n] == 0)
+				break;
+			depth[n]--;
+			event(out, t, name(sysctls, nitems(sysctls),
+			    t->what), "sysctl", "E");
+			fprintf(out, "}");
+			break;
+		}
+	}
+	fprintf(out, "\n]}\n");
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: fantrace [-e] [-d seconds] [-i ms] "
+	    "[-o file]\n"
+	    "       fantrace [-o file] -r dump ...\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *outpath;
+	FILE *out;
+	size_t len;
+	int ch, enable, interval, old, one, raw, seconds;
+
+	enable = raw = 0;
+	seconds = 10;
+	interval = 100;
+	outpath = NULL;
+	while ((ch = getopt(argc, argv, "d:ei:o:r")) != -1) {
+		switch (ch) {
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'e':
+			enable = 1;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'o':
+			outpath = optarg;
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (raw ? argc == 0 || enable : argc != 0 || seconds < 0 ||
+	    interval < 1)
+		usage();
+
+	if (raw) {
+		for (; argc > 0; argc--, argv++)
+			read_file(*argv);
+	} else {
+		old = 1;
+		if (enable) {
+			len = sizeof(old);
+			one = 1;
+			if (sysctlbyname("hw.acpi.fan.trace_enable", &old, &len,
+			    &one, sizeof(one)) < 0)
+				err(1, "hw.acpi.fan.trace_enable");
+		}
+		signal(SIGINT, onsig);
+		signal(SIGTERM, onsig);
+		poll_live(seconds, interval);
+		if (enable && !old && sysctlbyname("hw.acpi.fan.trace_enable",
+		    NULL, NULL, &old, sizeof(old)) < 0)
+			err(1, "hw.acpi.fan.trace_enable");
+	}
+
+	if (outpath == NULL)
+		out = stdout;
+	else if ((out = fopen(outpath, "w")) == NULL)
+		err(1, "%s", outpath);
+	write_json(out);
+	if (fclose(out) != 0)
+		err(1, "%s", outpath != NULL ? outpath : "stdout");
+	if (lost != 0)
+		warnx("%ju records were overwritten before they were read",
+		    (uintmax_t)lost);
+	return (0);
+}